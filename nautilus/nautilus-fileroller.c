@@ -71,20 +71,15 @@ extract_to_callback (NautilusMenuItem *item,
 
 
 static void
-extract_here_callback (NautilusMenuItem *item,
-		       gpointer          user_data)
+spawn_extract_here (char **uris)
 {
-	GList            *files, *scan;
-	GString          *cmd;
-
-	files = g_object_get_data (G_OBJECT (item), "files");
+	GString *cmd;
+	int      i;
 
 	cmd = g_string_new ("file-roller --extract-here --notify");
 
-	for (scan = files; scan; scan = scan->next) {
-		NautilusFileInfo *file = scan->data;
-		g_autofree char *uri = nautilus_file_info_get_uri (file);
-		g_autofree char *quoted_uri = g_shell_quote (uri);
+	for (i = 0; uris[i] != NULL; i++) {
+		g_autofree char *quoted_uri = g_shell_quote (uris[i]);
 		g_string_append_printf (cmd, " %s", quoted_uri);
 	}
 
@@ -97,6 +92,79 @@ extract_here_callback (NautilusMenuItem *item,
 	g_string_free (cmd, TRUE);
 }
 
+
+static void
+extract_all_here_ready_cb (GObject      *source_object,
+			   GAsyncResult *result,
+			   gpointer      user_data)
+{
+	char               **uris = user_data;
+	g_autoptr (GVariant) value = NULL;
+	g_autoptr (GError)   error = NULL;
+
+	value = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), result, &error);
+
+	/* use the command line if the service cannot be activated or is
+	 * too old, errors from the extraction are reported by the
+	 * service itself. */
+
+	if ((value == NULL)
+	    && (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)
+		|| g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER)
+		|| g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)
+		|| g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_EXEC_FAILED)
+		|| g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SPAWN_CHILD_EXITED)))
+	{
+		spawn_extract_here (uris);
+	}
+
+	g_strfreev (uris);
+}
+
+
+static void
+extract_here_callback (NautilusMenuItem *item,
+		       gpointer          user_data)
+{
+	GList            *files, *scan;
+	GPtrArray        *uri_array;
+	char            **uris;
+	GDBusConnection  *connection;
+
+	files = g_object_get_data (G_OBJECT (item), "files");
+
+	uri_array = g_ptr_array_new ();
+	for (scan = files; scan; scan = scan->next)
+		g_ptr_array_add (uri_array, nautilus_file_info_get_uri (NAUTILUS_FILE_INFO (scan->data)));
+	g_ptr_array_add (uri_array, NULL);
+	uris = (char **) g_ptr_array_free (uri_array, FALSE);
+
+	/* extract all the archives with a single call to the running
+	 * service, started by D-Bus if needed. */
+
+	connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+	if (connection == NULL) {
+		spawn_extract_here (uris);
+		g_strfreev (uris);
+		return;
+	}
+
+	g_dbus_connection_call (connection,
+				"org.gnome.ArchiveManager1",
+				"/org/gnome/ArchiveManager1",
+				"org.gnome.ArchiveManager1",
+				"ExtractAllHere",
+				g_variant_new ("(^asbb)", uris, TRUE, TRUE),
+				NULL,
+				G_DBUS_CALL_FLAGS_NONE,
+				G_MAXINT,
+				NULL,
+				extract_all_here_ready_cb,
+				uris);
+
+	g_object_unref (connection);
+}
+
 /** mime-types which aren't supported by nautilus itself */
 static struct {
 	char     *mime_type;
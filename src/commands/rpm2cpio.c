@@ -38,6 +38,7 @@ get_mime_type_from_magic_numbers (char *buffer)
 		{ "application/x-bzip2", "BZh", 0, 3 },
 		{ "application/x-gzip", "\037\213", 0, 2 },
 		{ "application/x-xz", "\3757zXZ\000", 0, 6 },
+		{ "application/zstd", "\050\265\057\375", 0, 4 },
 	};
 
 	for (size_t i = 0; i < G_N_ELEMENTS (sniffer_data); i++) {
@@ -122,6 +123,8 @@ main (int argc, char **argv)
 		archive_command = "xz -dc";
 	else if (strcmp (mime_type, "application/x-gzip") == 0)
 		archive_command = "gzip -dc";
+	else if (strcmp (mime_type, "application/zstd") == 0)
+		archive_command = "zstd -dc";
 	else
 		archive_command = "bzip2 -dc";
 	fclose (stream);
@@ -677,18 +677,218 @@ _g_file_dir_contains_one_object (GFile *file)
 /* program */
 
 
+#define PROGRAMS_CACHE_GROUP "Programs"
+#define PROGRAMS_CACHE_KEY_GROUP "Path"
+
+
+static char       *programs_cache_key = NULL;
+static gboolean    programs_cache_changed = FALSE;
+static GHashTable *programs_cache_not_saved = NULL;  /* names kept in memory only */
+
+
+/* The available programs depend on the folders in the PATH and on their
+ * content: installing or removing a program changes the modification time
+ * of its folder.  Plugins installed elsewhere are not detected, see
+ * _g_programs_cache_clear(). */
+static char *
+_g_programs_cache_compute_key (void)
+{
+	const char  *path;
+	char       **folders;
+	GString     *key;
+	char        *checksum;
+
+	path = g_getenv ("PATH");
+	if (path == NULL)
+		path = "";
+
+	key = g_string_new (path);
+	folders = g_strsplit (path, G_SEARCHPATH_SEPARATOR_S, -1);
+	for (int i = 0; folders[i] != NULL; i++) {
+		struct stat buf;
+
+		if ((*folders[i] != '\0') && (stat (folders[i], &buf) == 0))
+			g_string_append_printf (key, ";%" G_GINT64_FORMAT ".%09ld", (gint64) buf.st_mtim.tv_sec, (long) buf.st_mtim.tv_nsec);
+		else
+			g_string_append (key, ";-");
+	}
+	checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA256, key->str, key->len);
+
+	g_strfreev (folders);
+	g_string_free (key, TRUE);
+
+	return checksum;
+}
+
+
+static GFile *
+_g_programs_cache_get_file (void)
+{
+	char  *path;
+	GFile *file;
+
+	path = g_build_filename (g_get_user_cache_dir (), "file-roller", "programs", NULL);
+	file = g_file_new_for_path (path);
+	g_free (path);
+
+	return file;
+}
+
+
+void
+_g_programs_cache_load (void)
+{
+	GFile    *file;
+	char     *path;
+	GKeyFile *key_file;
+
+	g_free (programs_cache_key);
+	programs_cache_key = _g_programs_cache_compute_key ();
+
+	file = _g_programs_cache_get_file ();
+	path = g_file_get_path (file);
+	key_file = g_key_file_new ();
+	if (g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL)) {
+		char *key;
+
+		key = g_key_file_get_string (key_file, PROGRAMS_CACHE_KEY_GROUP, "Key", NULL);
+		if (g_strcmp0 (key, programs_cache_key) == 0) {
+			char **names;
+
+			names = g_key_file_get_keys (key_file, PROGRAMS_CACHE_GROUP, NULL, NULL);
+			for (int i = 0; (names != NULL) && (names[i] != NULL); i++)
+				g_hash_table_insert (ProgramsCache,
+						     g_strdup (names[i]),
+						     g_key_file_get_boolean (key_file, PROGRAMS_CACHE_GROUP, names[i], NULL) ? "1" : "0");
+
+			g_strfreev (names);
+		}
+
+		g_free (key);
+	}
+
+	g_key_file_free (key_file);
+	g_free (path);
+	g_object_unref (file);
+}
+
+
+void
+_g_programs_cache_save (void)
+{
+	GFile          *file;
+	GFile          *parent;
+	GKeyFile       *key_file;
+	GHashTableIter  iter;
+	gpointer        name;
+	gpointer        value;
+
+	if (! programs_cache_changed)
+		return;
+
+	key_file = g_key_file_new ();
+	g_key_file_set_string (key_file, PROGRAMS_CACHE_KEY_GROUP, "Key", programs_cache_key);
+	g_hash_table_iter_init (&iter, ProgramsCache);
+	while (g_hash_table_iter_next (&iter, &name, &value)) {
+		if ((programs_cache_not_saved != NULL) && g_hash_table_contains (programs_cache_not_saved, name))
+			continue;
+		g_key_file_set_boolean (key_file, PROGRAMS_CACHE_GROUP, name, strcmp (value, "1") == 0);
+	}
+
+	file = _g_programs_cache_get_file ();
+	parent = g_file_get_parent (file);
+	if (_g_file_make_directory_tree (parent, 0700, NULL))
+		_g_key_file_save (key_file, file);
+	programs_cache_changed = FALSE;
+
+	g_object_unref (parent);
+	g_object_unref (file);
+	g_key_file_free (key_file);
+}
+
+
+/* Returns FALSE and empties the cache if the programs in the PATH changed
+ * since the cache was filled. */
 gboolean
-_g_program_is_in_path (const char *filename)
+_g_programs_cache_revalidate (void)
+{
+	char *key;
+
+	key = _g_programs_cache_compute_key ();
+	if (g_strcmp0 (key, programs_cache_key) == 0) {
+		g_free (key);
+		return TRUE;
+	}
+
+	g_free (programs_cache_key);
+	programs_cache_key = key;
+	g_hash_table_remove_all (ProgramsCache);
+	if (programs_cache_not_saved != NULL)
+		g_hash_table_remove_all (programs_cache_not_saved);
+	programs_cache_changed = TRUE;
+
+	return FALSE;
+}
+
+
+/* Empties the cache even if the PATH didn't change, for example after
+ * installing a plugin, and saves it right away. */
+void
+_g_programs_cache_clear (void)
+{
+	g_free (programs_cache_key);
+	programs_cache_key = _g_programs_cache_compute_key ();
+	g_hash_table_remove_all (ProgramsCache);
+	if (programs_cache_not_saved != NULL)
+		g_hash_table_remove_all (programs_cache_not_saved);
+	programs_cache_changed = TRUE;
+	_g_programs_cache_save ();
+}
+
+
+gboolean
+_g_programs_cache_lookup (const char *name,
+			  gboolean   *result)
 {
-	char *str;
 	char *value;
-	int   result = FALSE;
 
-	value = g_hash_table_lookup (ProgramsCache, filename);
-	if (value != NULL) {
-		result = (strcmp (value, "1") == 0);
-		return result;
+	value = g_hash_table_lookup (ProgramsCache, name);
+	if (value == NULL)
+		return FALSE;
+
+	*result = (strcmp (value, "1") == 0);
+
+	return TRUE;
+}
+
+
+/* The results with @save set to FALSE are not written to the disk. */
+void
+_g_programs_cache_insert (const char *name,
+			  gboolean    result,
+			  gboolean    save)
+{
+	g_hash_table_insert (ProgramsCache,
+			     g_strdup (name),
+			     result ? "1" : "0");
+	if (! save) {
+		if (programs_cache_not_saved == NULL)
+			programs_cache_not_saved = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		g_hash_table_add (programs_cache_not_saved, g_strdup (name));
 	}
+	else
+		programs_cache_changed = TRUE;
+}
+
+
+gboolean
+_g_program_is_in_path (const char *filename)
+{
+	char     *str;
+	gboolean  result = FALSE;
+
+	if (_g_programs_cache_lookup (filename, &result))
+		return result;
 
 	str = g_find_program_in_path (filename);
 	if (str != NULL) {
@@ -696,9 +896,7 @@ _g_program_is_in_path (const char *filename)
 		result = TRUE;
 	}
 
-	g_hash_table_insert (ProgramsCache,
-			     g_strdup (filename),
-			     result ? "1" : "0");
+	_g_programs_cache_insert (filename, result, TRUE);
 
 	return result;
 }
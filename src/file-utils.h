@@ -63,6 +63,15 @@ gboolean            _g_file_dir_contains_one_object       (GFile       *file);
 
 /* program */
 
+void                _g_programs_cache_load                (void);
+void                _g_programs_cache_save                (void);
+gboolean            _g_programs_cache_revalidate          (void);
+void                _g_programs_cache_clear               (void);
+gboolean            _g_programs_cache_lookup              (const char *name,
+							   gboolean   *result);
+void                _g_programs_cache_insert              (const char *name,
+							   gboolean    result,
+							   gboolean    save);
 gboolean 	    _g_program_is_in_path		  (const char *filename);
 gboolean 	    _g_program_is_available	          (const char *filename,
 							   gboolean    check);
@@ -166,6 +166,14 @@ window_progress_cb (FrWindow *window,
 }
 
 
+static gboolean
+service_timeout_cb (gpointer user_data)
+{
+	g_application_release (G_APPLICATION (user_data));
+	return FALSE;
+}
+
+
 static void
 handle_method_call (GDBusConnection       *connection,
 		    const char            *sender,
@@ -176,12 +184,14 @@ handle_method_call (GDBusConnection       *connection,
 		    GDBusMethodInvocation *invocation,
 		    gpointer               user_data)
 {
-	fr_update_registered_archives_capabilities ();
+	fr_check_registered_archives_capabilities ();
 
 	if (g_strcmp0 (method_name, "GetSupportedTypes") == 0) {
 		char *action;
 		int  *supported_types = NULL;
 
+		fr_ensure_supported_archive_types ();
+
 		g_variant_get (parameters, "(s)", &action);
 		if (g_strcmp0 (action, "create") == 0) {
 			supported_types = save_type;
@@ -353,6 +363,43 @@ handle_method_call (GDBusConnection       *connection,
 		g_object_unref (archive);
 		g_free (uri);
 	}
+	else if (g_strcmp0 (method_name, "ExtractAllHere") == 0) {
+		char      **archives;
+		gboolean    use_progress_dialog;
+		gboolean    notify;
+		int         i;
+		GtkWidget  *window;
+
+		g_variant_get (parameters, "(^asbb)", &archives, &use_progress_dialog, &notify);
+
+		window = fr_window_new ();
+		fr_window_use_progress_dialog (FR_WINDOW (window), use_progress_dialog);
+		fr_window_set_notify (FR_WINDOW (window), notify);
+
+		g_signal_connect (FR_WINDOW (window), "progress", G_CALLBACK (window_progress_cb), connection);
+		g_signal_connect (FR_WINDOW (window), "ready", G_CALLBACK (window_ready_cb), invocation);
+
+		fr_window_batch_new (FR_WINDOW (window), C_("Window title", "Extract"));
+		for (i = 0; archives[i] != NULL; i++) {
+			GFile *archive;
+
+			archive = g_file_new_for_uri (archives[i]);
+			fr_window_batch__extract_here (FR_WINDOW (window), archive, notify && (archives[i + 1] == NULL));
+
+			g_object_unref (archive);
+		}
+		if (! notify)
+			fr_window_batch_append_action (FR_WINDOW (window), FR_BATCH_ACTION_QUIT, NULL, NULL);
+		fr_window_batch_start (FR_WINDOW (window));
+
+		g_strfreev (archives);
+	}
+
+	/* keep the service alive for a while, to handle the following
+	 * requests without starting a new process. */
+
+	g_application_hold (G_APPLICATION (user_data));
+	g_timeout_add_seconds (SERVICE_TIMEOUT, service_timeout_cb, user_data);
 }
 
 
@@ -407,7 +454,7 @@ on_bus_acquired_for_archive_manager (GDBusConnection *connection,
 							     "/org/gnome/ArchiveManager1",
 							     self->introspection_data->interfaces[0],
 							     &interface_vtable,
-							     NULL,
+							     self,
 							     NULL,  /* user_data_free_func */
 							     &error); /* GError** */
 	if (registration_id == 0) {
@@ -416,14 +463,6 @@ on_bus_acquired_for_archive_manager (GDBusConnection *connection,
 }
 
 
-static gboolean
-service_timeout_cb (gpointer user_data)
-{
-	g_application_release (G_APPLICATION (user_data));
-	return FALSE;
-}
-
-
 static void
 fr_application_register_archive_manager_service (FrApplication *self,
                                                  bool as_service)
@@ -437,6 +476,13 @@ fr_application_register_archive_manager_service (FrApplication *self,
 	if (as_service)
 		g_application_hold (G_APPLICATION (self));
 
+	if (self->introspection_data != NULL) {
+		/* already registered by a previous command line */
+		if (as_service)
+			g_timeout_add_seconds (SERVICE_TIMEOUT, service_timeout_cb, self);
+		return;
+	}
+
 	g_resources_get_info (ORG_GNOME_ARCHIVEMANAGER_XML, 0, &size, NULL, NULL);
 	buffer = g_new (guchar, size + 1);
 	stream = g_resources_open_stream (ORG_GNOME_ARCHIVEMANAGER_XML, 0, NULL);
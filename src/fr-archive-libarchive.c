@@ -20,7 +20,11 @@
  */
 
 #include <config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
@@ -29,10 +33,21 @@
 #include <gio/gio.h>
 #include <archive.h>
 #include <archive_entry.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include "fr-file-data.h"
 #include "file-utils.h"
 #include "fr-error.h"
 #include "fr-archive-libarchive.h"
+#include "fr-trace.h"
 #include "gio-utils.h"
 #include "glib-utils.h"
 #include "typedefs.h"
@@ -74,9 +89,18 @@ _archive_entry_ctx_free(_archive_entry_ctx *entry)
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(_archive_entry_ctx, _archive_entry_ctx_free)
 
 
+typedef struct _GzipIndex GzipIndex;
+#ifdef HAVE_ZLIB
+static void gzip_index_free (GzipIndex *index);
+#endif
+
+
 typedef struct {
-	gssize compressed_size;
-	gssize uncompressed_size;
+	gssize      compressed_size;
+	gssize      uncompressed_size;
+	GzipIndex  *gzip_index;
+	GHashTable *hardlinks;  /* hard link pathname -> target pathname */
+	GList      *last_output;
 } FrArchiveLibarchivePrivate;
 
 
@@ -86,12 +110,18 @@ G_DEFINE_FINAL_TYPE_WITH_PRIVATE (FrArchiveLibarchive, fr_archive_libarchive, FR
 static void
 fr_archive_libarchive_finalize (GObject *object)
 {
-	/*FrArchiveLibarchive *self;*/
-
 	g_return_if_fail (object != NULL);
 	g_return_if_fail (FR_IS_ARCHIVE_LIBARCHIVE (object));
 
-	/*self = FR_ARCHIVE_LIBARCHIVE (object);*/
+	{
+		FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (object));
+#ifdef HAVE_ZLIB
+		gzip_index_free (private->gzip_index);
+#endif
+		if (private->hardlinks != NULL)
+			g_hash_table_unref (private->hardlinks);
+		g_list_free_full (private->last_output, g_free);
+	}
 
 	if (G_OBJECT_CLASS (fr_archive_libarchive_parent_class)->finalize)
 		G_OBJECT_CLASS (fr_archive_libarchive_parent_class)->finalize (object);
@@ -135,6 +165,33 @@ fr_archive_libarchive_get_mime_types (FrArchive *archive)
 }
 
 
+/* Whether libarchive was built with the crypto support required to write
+ * encrypted zip files. */
+static gboolean
+_archive_write_can_encrypt_zip (void)
+{
+#if (ARCHIVE_VERSION_NUMBER >= 3002000)
+	static gsize    initialized = 0;
+	static gboolean can_encrypt = FALSE;
+
+	if (g_once_init_enter (&initialized)) {
+		struct archive *a;
+
+		a = archive_write_new ();
+		archive_write_set_format_zip (a);
+		can_encrypt = (archive_write_set_options (a, "zip:encryption=aes256") == ARCHIVE_OK);
+		archive_write_free (a);
+
+		g_once_init_leave (&initialized, 1);
+	}
+
+	return can_encrypt;
+#else
+	return FALSE;
+#endif
+}
+
+
 static FrArchiveCaps
 fr_archive_libarchive_get_capabilities (FrArchive  *archive,
 					const char *mime_type,
@@ -177,6 +234,8 @@ fr_archive_libarchive_get_capabilities (FrArchive  *archive,
 		}
 		if (!_g_program_is_available ("zip", TRUE)) {
 			capabilities |= FR_ARCHIVE_CAN_WRITE;
+			if (_archive_write_can_encrypt_zip ())
+				capabilities |= FR_ARCHIVE_CAN_ENCRYPT;
 		}
 		return capabilities;
 	}
@@ -228,6 +287,405 @@ fr_archive_libarchive_get_packages (FrArchive  *archive,
 }
 
 
+#ifdef HAVE_ZLIB
+
+
+/* -- GzipIndex -- */
+
+
+/* Access points in the gzip stream of a .tar.gz archive, with the offset
+ * of each entry in the uncompressed tar stream.  Used to extract a few
+ * files without decompressing all the archive from the start, see zran.c
+ * in the zlib examples.  The entry offsets are recorded while listing the
+ * archive, the access points while extracting from the start for the
+ * first time, this way listing an archive doesn't decompress it twice. */
+
+
+#define GZIP_INDEX_WINDOW_SIZE 32768
+#define GZIP_INDEX_MIN_SPAN (16 * 1024 * 1024)
+#define GZIP_INDEX_MAX_POINTS 128
+
+
+typedef struct {
+	gint64 out;    /* uncompressed offset */
+	gint64 in;     /* compressed offset of the first full byte */
+	int    bits;   /* bits of the byte before 'in' to use */
+	guchar window[GZIP_INDEX_WINDOW_SIZE];
+} GzipIndexPoint;
+
+
+struct _GzipIndex {
+	GArray     *points;
+	GHashTable *entry_offsets;
+	goffset     file_size;
+	gboolean    indexed;  /* the access points were searched already */
+};
+
+
+static GzipIndex *
+gzip_index_new (goffset file_size)
+{
+	GzipIndex *index;
+
+	index = g_new0 (GzipIndex, 1);
+	index->points = g_array_new (FALSE, FALSE, sizeof (GzipIndexPoint));
+	index->entry_offsets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	index->file_size = file_size;
+	index->indexed = FALSE;
+
+	return index;
+}
+
+
+static void
+gzip_index_free (GzipIndex *index)
+{
+	if (index == NULL)
+		return;
+	g_array_unref (index->points);
+	g_hash_table_unref (index->entry_offsets);
+	g_free (index);
+}
+
+
+static void
+gzip_index_add_entry (GzipIndex  *index,
+		      const char *pathname,
+		      gint64      offset)
+{
+	gint64 *value;
+
+	if (g_hash_table_contains (index->entry_offsets, pathname))
+		return;
+
+	value = g_new (gint64, 1);
+	*value = offset;
+	g_hash_table_insert (index->entry_offsets, g_strdup (pathname), value);
+}
+
+
+/* Returns the access point to use to extract @file_list, or NULL if the
+ * archive must be read from the start.  @offset is set to the offset of
+ * the first entry to extract. */
+static GzipIndexPoint *
+gzip_index_get_point (GzipIndex *index,
+		      GList     *file_list,
+		      gint64    *offset)
+{
+	GzipIndexPoint *point = NULL;
+	gint64          min_offset = G_MAXINT64;
+	GList          *scan;
+	guint           i;
+
+	if (file_list == NULL)
+		return NULL;
+
+	for (scan = file_list; scan; scan = scan->next) {
+		gint64 *entry_offset;
+
+		entry_offset = g_hash_table_lookup (index->entry_offsets, scan->data);
+		if (entry_offset == NULL)
+			return NULL;
+		min_offset = MIN (min_offset, *entry_offset);
+	}
+
+	for (i = 0; i < index->points->len; i++) {
+		GzipIndexPoint *p = &g_array_index (index->points, GzipIndexPoint, i);
+
+		if (p->out > min_offset)
+			break;
+		point = p;
+	}
+
+	*offset = min_offset;
+
+	return point;
+}
+
+
+/* Adds the access points to an index while the archive is read. */
+typedef struct {
+	GzipIndex *index;
+	z_stream   stream;
+	gboolean   valid;
+	gboolean   finished;
+	gint64     span;
+	gint64     total_in;
+	gint64     total_out;
+	gint64     last;
+	guchar     window[GZIP_INDEX_WINDOW_SIZE];
+} GzipIndexBuilder;
+
+
+static GzipIndexBuilder *
+gzip_index_builder_new (GzipIndex *index,
+			gint64     uncompressed_size)
+{
+	GzipIndexBuilder *builder;
+
+	builder = g_new0 (GzipIndexBuilder, 1);
+	builder->index = index;
+	builder->valid = (inflateInit2 (&builder->stream, 15 + 16) == Z_OK);
+	builder->finished = FALSE;
+	builder->span = MAX (GZIP_INDEX_MIN_SPAN, uncompressed_size / GZIP_INDEX_MAX_POINTS);
+	g_array_set_size (index->points, 0);
+	builder->total_in = 0;
+	builder->total_out = 0;
+	builder->last = 0;
+	builder->stream.next_out = builder->window;
+	builder->stream.avail_out = GZIP_INDEX_WINDOW_SIZE;
+
+	return builder;
+}
+
+
+static void
+gzip_index_builder_free (GzipIndexBuilder *builder)
+{
+	inflateEnd (&builder->stream);
+	g_free (builder);
+}
+
+
+static void
+gzip_index_builder_add_point (GzipIndexBuilder *builder)
+{
+	GzipIndexPoint point;
+	guint          left;
+
+	point.out = builder->total_out;
+	point.in = builder->total_in;
+	point.bits = builder->stream.data_type & 7;
+
+	/* the window is circular, 'left' bytes at the end are the oldest */
+
+	left = builder->stream.avail_out;
+	if (left > 0)
+		memcpy (point.window, builder->window + GZIP_INDEX_WINDOW_SIZE - left, left);
+	if (left < GZIP_INDEX_WINDOW_SIZE)
+		memcpy (point.window + left, builder->window, GZIP_INDEX_WINDOW_SIZE - left);
+
+	g_array_append_val (builder->index->points, point);
+	builder->last = builder->total_out;
+}
+
+
+static void
+gzip_index_builder_feed (GzipIndexBuilder *builder,
+			 const void       *data,
+			 gsize             size)
+{
+	if (! builder->valid || (size == 0))
+		return;
+
+	/* data after the end of the first member, the offsets of the other
+	 * members are not known */
+
+	if (builder->finished) {
+		builder->valid = FALSE;
+		return;
+	}
+
+	builder->stream.next_in = (Bytef *) data;
+	builder->stream.avail_in = size;
+	while (builder->stream.avail_in > 0) {
+		int ret;
+
+		if (builder->stream.avail_out == 0) {
+			builder->stream.next_out = builder->window;
+			builder->stream.avail_out = GZIP_INDEX_WINDOW_SIZE;
+		}
+
+		builder->total_in += builder->stream.avail_in;
+		builder->total_out += builder->stream.avail_out;
+		ret = inflate (&builder->stream, Z_BLOCK);
+		builder->total_in -= builder->stream.avail_in;
+		builder->total_out -= builder->stream.avail_out;
+
+		if (ret == Z_STREAM_END) {
+			builder->finished = TRUE;
+			if (builder->stream.avail_in > 0)
+				builder->valid = FALSE;
+			return;
+		}
+
+		if (ret != Z_OK) {
+			builder->valid = FALSE;
+			return;
+		}
+
+		/* add an access point at the end of a deflate block, but not
+		 * after the last block */
+
+		if ((builder->stream.data_type & 128)
+		    && ! (builder->stream.data_type & 64)
+		    && (builder->total_out - builder->last > builder->span)
+		    && (builder->index->points->len < GZIP_INDEX_MAX_POINTS))
+		{
+			gzip_index_builder_add_point (builder);
+		}
+	}
+}
+
+
+/* Keeps the access points found so far, even if the archive was not read
+ * until the end, and frees the builder. */
+static void
+gzip_index_builder_finish (GzipIndexBuilder *builder)
+{
+	if (! builder->valid)
+		g_array_set_size (builder->index->points, 0);
+	builder->index->indexed = TRUE;
+	gzip_index_builder_free (builder);
+}
+
+
+#endif /* HAVE_ZLIB */
+
+
+#ifdef HAVE_ZSTD
+
+
+/* ZstdReader: decompresses the frames of a zstd stream in parallel, the
+ * decompressed data is returned in the original order.  Only the frames
+ * that declare their content size are decompressed in parallel, each one
+ * in a buffer of that size.  The size of a frame and the total size of the
+ * queued frames, compressed and decompressed, are limited, the stream is
+ * decompressed sequentially from the first frame that doesn't respect the
+ * limits. */
+
+
+#define ZSTD_READER_INPUT_SIZE (1024 * 1024)
+#define ZSTD_READER_MAX_FRAME_SIZE (64 * 1024 * 1024)
+#define ZSTD_READER_MAX_CONTENT_SIZE (32 * 1024 * 1024)
+#define ZSTD_READER_MAX_QUEUED_SIZE (256 * 1024 * 1024)
+#define ZSTD_READER_FRAMES_PER_THREAD 2
+
+
+typedef struct {
+	GBytes     *input;
+	GByteArray *output;
+	gsize       content_size;
+	gsize       queued_size;
+	size_t      result;
+	gboolean    done;
+} ZstdFrame;
+
+
+typedef struct {
+	GThreadPool  *pool;
+	GMutex        mutex;
+	GCond         cond;
+	GQueue       *frames;
+	guint         max_frames;
+	gsize         queued_size;  /* input and content size of the queued frames */
+	ZstdFrame    *current;
+	GByteArray   *input;
+	gsize         input_pos;
+	gboolean      eof;
+	gboolean      first_frame;
+	gboolean      passthrough;
+	gboolean      sequential;
+	ZSTD_DStream *dstream;
+	size_t        dstream_result;
+} ZstdReader;
+
+
+static void
+zstd_frame_free (ZstdFrame *frame)
+{
+	g_bytes_unref (frame->input);
+	if (frame->output != NULL)
+		g_byte_array_unref (frame->output);
+	g_free (frame);
+}
+
+
+static void
+zstd_reader_decompress_frame (gpointer data,
+			      gpointer user_data)
+{
+	ZstdFrame  *frame = data;
+	ZstdReader *reader = user_data;
+	ZSTD_DCtx  *dctx;
+	const void *src;
+	gsize       src_size;
+	size_t      ret;
+
+	/* the output buffer has the declared size, a frame with more data
+	 * fails instead of growing it */
+
+	src = g_bytes_get_data (frame->input, &src_size);
+	frame->output = g_byte_array_sized_new (MAX (frame->content_size, 1));
+	g_byte_array_set_size (frame->output, frame->content_size);
+
+	dctx = ZSTD_createDCtx ();
+	ret = ZSTD_decompressDCtx (dctx, frame->output->data, frame->content_size, src, src_size);
+	ZSTD_freeDCtx (dctx);
+
+	if (! ZSTD_isError (ret)) {
+		g_byte_array_set_size (frame->output, ret);
+		ret = 0;
+	}
+	else
+		g_byte_array_set_size (frame->output, 0);
+
+	g_mutex_lock (&reader->mutex);
+	frame->result = ret;
+	frame->done = TRUE;
+	g_cond_broadcast (&reader->cond);
+	g_mutex_unlock (&reader->mutex);
+}
+
+
+static ZstdReader *
+zstd_reader_new (void)
+{
+	ZstdReader *reader;
+	guint       n_threads;
+
+	n_threads = fr_get_n_threads ();
+
+	reader = g_new0 (ZstdReader, 1);
+	reader->pool = g_thread_pool_new (zstd_reader_decompress_frame, reader, n_threads, FALSE, NULL);
+	g_mutex_init (&reader->mutex);
+	g_cond_init (&reader->cond);
+	reader->frames = g_queue_new ();
+	reader->max_frames = n_threads * ZSTD_READER_FRAMES_PER_THREAD;
+	reader->queued_size = 0;
+	reader->current = NULL;
+	reader->input = g_byte_array_new ();
+	reader->input_pos = 0;
+	reader->eof = FALSE;
+	reader->first_frame = TRUE;
+	reader->passthrough = FALSE;
+	reader->sequential = FALSE;
+	reader->dstream = NULL;
+	reader->dstream_result = 0;
+
+	return reader;
+}
+
+
+static void
+zstd_reader_free (ZstdReader *reader)
+{
+	g_thread_pool_free (reader->pool, TRUE, TRUE);
+	g_queue_free_full (reader->frames, (GDestroyNotify) zstd_frame_free);
+	if (reader->current != NULL)
+		zstd_frame_free (reader->current);
+	g_byte_array_unref (reader->input);
+	if (reader->dstream != NULL)
+		ZSTD_freeDStream (reader->dstream);
+	g_mutex_clear (&reader->mutex);
+	g_cond_clear (&reader->cond);
+	g_free (reader);
+}
+
+
+#endif /* HAVE_ZSTD */
+
+
 /* LoadData */
 
 
@@ -241,7 +699,14 @@ typedef struct {
 	GInputStream       *istream;
 	void               *buffer;
 	gssize              buffer_size;
+	char               *password;
 	GError             *error;
+#ifdef HAVE_ZLIB
+	GzipIndexBuilder   *gzip_index_builder;
+#endif
+#ifdef HAVE_ZSTD
+	ZstdReader         *zstd_reader;
+#endif
 } LoadData;
 
 
@@ -261,6 +726,15 @@ load_data_free (LoadData *load_data)
 	_g_object_unref (load_data->result);
 	_g_object_unref (load_data->istream);
 	g_free (load_data->buffer);
+	g_free (load_data->password);
+#ifdef HAVE_ZLIB
+	if (load_data->gzip_index_builder != NULL)
+		gzip_index_builder_free (load_data->gzip_index_builder);
+#endif
+#ifdef HAVE_ZSTD
+	if (load_data->zstd_reader != NULL)
+		zstd_reader_free (load_data->zstd_reader);
+#endif
 	g_free (load_data);
 }
 
@@ -289,6 +763,20 @@ load_data_open (struct archive *a,
 }
 
 
+static void
+load_data_update_progress (LoadData *load_data,
+			   gssize    bytes)
+{
+	/* update the progress only if listing the content */
+	if (g_simple_async_result_get_source_tag (load_data->result) == fr_archive_list) {
+		FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
+		fr_archive_progress_set_completed_bytes (load_data->archive,
+							 g_seekable_tell (G_SEEKABLE (load_data->istream)));
+		private->compressed_size += bytes;
+	}
+}
+
+
 static ssize_t
 load_data_read (struct archive  *a,
 		void            *client_data,
@@ -307,13 +795,12 @@ load_data_read (struct archive  *a,
 				     load_data->cancellable,
 				     &load_data->error);
 
-	/* update the progress only if listing the content */
-	if (g_simple_async_result_get_source_tag (load_data->result) == fr_archive_list) {
-		FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
-		fr_archive_progress_set_completed_bytes (load_data->archive,
-							 g_seekable_tell (G_SEEKABLE (load_data->istream)));
-		private->compressed_size += bytes;
-	}
+	load_data_update_progress (load_data, bytes);
+
+#ifdef HAVE_ZLIB
+	if ((load_data->gzip_index_builder != NULL) && (bytes > 0))
+		gzip_index_builder_feed (load_data->gzip_index_builder, load_data->buffer, bytes);
+#endif
 
 	return bytes;
 }
@@ -335,6 +822,12 @@ load_data_seek (struct archive *a,
 	if ((load_data->error != NULL) || (load_data->istream == NULL))
 		return -1;
 
+#ifdef HAVE_ZLIB
+	/* the index requires the whole stream to be read in sequence */
+	if (load_data->gzip_index_builder != NULL)
+		load_data->gzip_index_builder->valid = FALSE;
+#endif
+
 	switch (whence) {
 	case SEEK_SET:
 		seektype = G_SEEK_SET;
@@ -404,81 +897,638 @@ load_data_close (struct archive *a,
 }
 
 
-static int
-create_read_object (LoadData        *load_data,
-                    _archive_read_ctx **a)
+#ifdef HAVE_ZSTD
+
+
+/* Appends more compressed data to the input buffer, returns FALSE at the
+ * end of the stream or on error. */
+static gboolean
+zstd_reader_read_input (LoadData *load_data)
 {
-	*a = archive_read_new ();
-	archive_read_support_filter_all (*a);
-	archive_read_support_format_all (*a);
+	ZstdReader *reader = load_data->zstd_reader;
+	guint       old_len;
+	gssize      bytes;
 
-	archive_read_set_open_callback (*a, load_data_open);
-	archive_read_set_read_callback (*a, load_data_read);
-	archive_read_set_close_callback (*a, load_data_close);
-	archive_read_set_seek_callback (*a, load_data_seek);
-	archive_read_set_skip_callback (*a, load_data_skip);
-	archive_read_set_callback_data (*a, load_data);
+	old_len = reader->input->len;
+	g_byte_array_set_size (reader->input, old_len + ZSTD_READER_INPUT_SIZE);
+	bytes = g_input_stream_read (load_data->istream,
+				     reader->input->data + old_len,
+				     ZSTD_READER_INPUT_SIZE,
+				     load_data->cancellable,
+				     &load_data->error);
+	g_byte_array_set_size (reader->input, old_len + MAX (bytes, 0));
+	load_data_update_progress (load_data, bytes);
 
-	return archive_read_open1 (*a);
+	if (bytes <= 0)
+		reader->eof = TRUE;
+
+	return bytes > 0;
 }
 
 
-/* -- list -- */
+static guint32
+_zstd_get_magic (const guchar *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32) data[3] << 24);
+}
 
 
-static goffset
-_g_file_get_size (GFile        *file,
-		  GCancellable *cancellable)
+/* Splits the input in frames and queues them for decompression, stops
+ * when enough frames are waiting.  Falls back to sequential
+ * decompression when the stream cannot be split. */
+static void
+zstd_reader_queue_frames (LoadData *load_data)
 {
-	g_autoptr (GFileInfo) info = NULL;
-	goffset    size;
+	ZstdReader *reader = load_data->zstd_reader;
 
-	info = g_file_query_info (file,
-				  G_FILE_ATTRIBUTE_STANDARD_SIZE,
-				  G_FILE_QUERY_INFO_NONE,
-				  cancellable,
-				  NULL);
-	if (info == NULL)
-		return 0;
+	while ((load_data->error == NULL)
+	       && ! reader->passthrough
+	       && ! reader->sequential
+	       && (g_queue_get_length (reader->frames) < reader->max_frames))
+	{
+		guint32             magic;
+		size_t              frame_size;
+		unsigned long long  content_size;
+		ZstdFrame          *frame;
+
+		/* read the whole frame and, to know if the stream is
+		 * made of a single frame, the start of the next one. */
+
+		if (reader->input->len < 4) {
+			if (! reader->eof) {
+				zstd_reader_read_input (load_data);
+				continue;
+			}
+			if (reader->first_frame && (reader->input->len > 0))
+				reader->passthrough = TRUE;
+			else if (reader->input->len > 0)
+				reader->sequential = TRUE;
+			break;
+		}
 
-	size = g_file_info_get_size (info);
+		magic = _zstd_get_magic (reader->input->data);
+		if (reader->first_frame
+		    && (magic != ZSTD_MAGICNUMBER)
+		    && ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) != ZSTD_MAGIC_SKIPPABLE_START))
+		{
+			/* not a zstd stream, let libarchive handle it */
+			reader->passthrough = TRUE;
+			break;
+		}
 
-	return size;
-}
+		frame_size = ZSTD_findFrameCompressedSize (reader->input->data, reader->input->len);
+		if (ZSTD_isError (frame_size)) {
+			if ((ZSTD_getErrorCode (frame_size) != ZSTD_error_srcSize_wrong)
+			    || reader->eof
+			    || (reader->input->len >= ZSTD_READER_MAX_FRAME_SIZE))
+			{
+				reader->sequential = TRUE;
+				break;
+			}
+			zstd_reader_read_input (load_data);
+			continue;
+		}
 
+		if ((frame_size == reader->input->len) && ! reader->eof) {
+			zstd_reader_read_input (load_data);
+			continue;
+		}
 
-static GError *
-_g_error_new_from_archive_error (const char *s)
-{
-	g_autofree char *msg = NULL;
-	GError *error;
+		if ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START) {
+			g_byte_array_remove_range (reader->input, 0, frame_size);
+			continue;
+		}
 
-	msg = (s != NULL) ? g_locale_to_utf8 (s, -1, NULL, NULL, NULL) : NULL;
-	if (msg == NULL)
-		msg = g_strdup ("Fatal error");
-	error = g_error_new_literal (FR_ERROR, FR_ERROR_COMMAND_ERROR, msg);
+		content_size = ZSTD_getFrameContentSize (reader->input->data, reader->input->len);
+		if ((reader->first_frame && (frame_size == reader->input->len))
+		    || (content_size == ZSTD_CONTENTSIZE_UNKNOWN)
+		    || (content_size == ZSTD_CONTENTSIZE_ERROR)
+		    || (content_size > ZSTD_READER_MAX_CONTENT_SIZE)
+		    || (frame_size > ZSTD_COMPRESSBOUND (content_size)))
+		{
+			/* nothing to gain from a parallel decompression, or the
+			 * memory needed is unknown or too big: decompress the
+			 * rest of the stream with a bounded buffer */
+			reader->sequential = TRUE;
+			break;
+		}
 
-	return error;
+		/* wait for the queued frames to be consumed */
+		if (! g_queue_is_empty (reader->frames) && (reader->queued_size + frame_size + content_size > ZSTD_READER_MAX_QUEUED_SIZE))
+			break;
+
+		frame = g_new0 (ZstdFrame, 1);
+		frame->input = g_bytes_new (reader->input->data, frame_size);
+		frame->output = NULL;
+		frame->content_size = content_size;
+		frame->queued_size = frame_size + content_size;
+		frame->done = FALSE;
+		g_byte_array_remove_range (reader->input, 0, frame_size);
+		reader->first_frame = FALSE;
+		reader->queued_size += frame->queued_size;
+
+		g_queue_push_tail (reader->frames, frame);
+		g_thread_pool_push (reader->pool, frame, NULL);
+	}
 }
 
 
-static void
-list_archive_thread (GSimpleAsyncResult *result,
-		     GObject            *object,
-		     GCancellable       *cancellable)
+static ssize_t
+zstd_reader_read_sequential (LoadData     *load_data,
+			     const void  **buff)
+{
+	ZstdReader     *reader = load_data->zstd_reader;
+	ZSTD_outBuffer  out;
+
+	if (reader->dstream == NULL) {
+		reader->dstream = ZSTD_createDStream ();
+		ZSTD_initDStream (reader->dstream);
+	}
+
+	out.dst = load_data->buffer;
+	out.size = load_data->buffer_size;
+	out.pos = 0;
+
+	while (out.pos == 0) {
+		ZSTD_inBuffer in;
+
+		if ((reader->input_pos == reader->input->len) && ! reader->eof) {
+			g_byte_array_set_size (reader->input, 0);
+			reader->input_pos = 0;
+			zstd_reader_read_input (load_data);
+			if (load_data->error != NULL)
+				return -1;
+		}
+
+		in.src = reader->input->data;
+		in.size = reader->input->len;
+		in.pos = reader->input_pos;
+		reader->dstream_result = ZSTD_decompressStream (reader->dstream, &out, &in);
+		reader->input_pos = in.pos;
+
+		if (ZSTD_isError (reader->dstream_result)) {
+			load_data->error = g_error_new_literal (FR_ERROR, FR_ERROR_COMMAND_ERROR, ZSTD_getErrorName (reader->dstream_result));
+			return -1;
+		}
+
+		if ((out.pos == 0) && reader->eof && (in.pos == in.size)) {
+			if (reader->dstream_result != 0) {
+				load_data->error = g_error_new_literal (FR_ERROR, FR_ERROR_COMMAND_ERROR, "Truncated zstd stream");
+				return -1;
+			}
+			return 0;
+		}
+	}
+
+	*buff = load_data->buffer;
+
+	return out.pos;
+}
+
+
+static ssize_t
+zstd_reader_read (struct archive  *a,
+		  void            *client_data,
+		  const void     **buff)
+{
+	LoadData   *load_data = client_data;
+	ZstdReader *reader = load_data->zstd_reader;
+
+	if (load_data->error != NULL)
+		return -1;
+
+	g_clear_pointer (&reader->current, zstd_frame_free);
+
+	for (;;) {
+		ZstdFrame *frame;
+
+		zstd_reader_queue_frames (load_data);
+		if (load_data->error != NULL)
+			return -1;
+
+		frame = g_queue_pop_head (reader->frames);
+		if (frame == NULL)
+			break;
+		reader->queued_size -= frame->queued_size;
+
+		g_mutex_lock (&reader->mutex);
+		while (! frame->done)
+			g_cond_wait (&reader->cond, &reader->mutex);
+		g_mutex_unlock (&reader->mutex);
+
+		if (frame->result != 0) {
+			load_data->error = g_error_new_literal (FR_ERROR,
+								FR_ERROR_COMMAND_ERROR,
+								ZSTD_isError (frame->result) ? ZSTD_getErrorName (frame->result) : "Truncated zstd frame");
+			zstd_frame_free (frame);
+			return -1;
+		}
+
+		if (frame->output->len > 0) {
+			reader->current = frame;
+			*buff = frame->output->data;
+			return frame->output->len;
+		}
+
+		zstd_frame_free (frame);
+	}
+
+	if (reader->passthrough) {
+		/* return the data read so far as is */
+
+		if (reader->input_pos < reader->input->len) {
+			gssize bytes;
+
+			*buff = reader->input->data + reader->input_pos;
+			bytes = reader->input->len - reader->input_pos;
+			reader->input_pos = reader->input->len;
+
+			return bytes;
+		}
+
+		if (reader->eof)
+			return 0;
+
+		return load_data_read (a, client_data, buff);
+	}
+
+	if (reader->sequential)
+		return zstd_reader_read_sequential (load_data, buff);
+
+	return 0;
+}
+
+
+/* Positions the stream at the start of the rpm payload, skipping the
+ * lead, the signature and the header. */
+static gboolean
+rpm_skip_header (GInputStream *istream,
+		 GCancellable *cancellable)
+{
+	goffset offset = 96;
+	int     i;
+
+	for (i = 0; i < 2; i++) {
+		guchar  bytes[16];
+		gsize   bytes_read;
+		guint32 n_entries;
+		guint32 data_size;
+
+		if (! g_seekable_seek (G_SEEKABLE (istream), offset, G_SEEK_SET, cancellable, NULL)
+		    || ! g_input_stream_read_all (istream, bytes, sizeof (bytes), &bytes_read, cancellable, NULL)
+		    || (bytes_read != sizeof (bytes))
+		    || (bytes[0] != 0x8e) || (bytes[1] != 0xad) || (bytes[2] != 0xe8))
+		{
+			return FALSE;
+		}
+
+		n_entries = ((guint32) bytes[8] << 24) | (bytes[9] << 16) | (bytes[10] << 8) | bytes[11];
+		data_size = ((guint32) bytes[12] << 24) | (bytes[13] << 16) | (bytes[14] << 8) | bytes[15];
+		offset += 16 + 16 * (goffset) n_entries + data_size;
+
+		/* the signature is padded to a multiple of 8 bytes */
+		if (i == 0)
+			offset = (offset + 7) & ~((goffset) 7);
+	}
+
+	return g_seekable_seek (G_SEEKABLE (istream), offset, G_SEEK_SET, cancellable, NULL);
+}
+
+
+static int
+rpm_payload_open (struct archive *a,
+		  void           *client_data)
+{
+	LoadData *load_data = client_data;
+	int       r;
+
+	r = load_data_open (a, client_data);
+	if (r != ARCHIVE_OK)
+		return r;
+
+	if (! rpm_skip_header (load_data->istream, load_data->cancellable)) {
+		/* let the libarchive rpm filter parse the header */
+
+		if (! g_seekable_seek (G_SEEKABLE (load_data->istream), 0, G_SEEK_SET, load_data->cancellable, &load_data->error))
+			return ARCHIVE_FATAL;
+		load_data->zstd_reader->passthrough = TRUE;
+	}
+
+	return ARCHIVE_OK;
+}
+
+
+#endif /* HAVE_ZSTD */
+
+
+static int
+create_read_object (LoadData        *load_data,
+                    _archive_read_ctx **a)
+{
+#ifdef HAVE_ZSTD
+	if (_g_str_equal (fr_archive_get_mime_type (load_data->archive), "application/x-zstd-compressed-tar")
+	    || _g_str_equal (fr_archive_get_mime_type (load_data->archive), "application/x-rpm"))
+	{
+		/* the frames are decompressed by the ZstdReader, the
+		 * data cannot be skipped or seeked.  For rpm packages the
+		 * reader starts from the payload, which is passed as is to
+		 * libarchive when not compressed with zstd. */
+
+		if (load_data->zstd_reader != NULL)
+			zstd_reader_free (load_data->zstd_reader);
+		load_data->zstd_reader = zstd_reader_new ();
+
+		*a = archive_read_new ();
+		archive_read_support_filter_all (*a);
+		archive_read_support_format_all (*a);
+		if (_g_str_equal (fr_archive_get_mime_type (load_data->archive), "application/x-rpm"))
+			archive_read_set_open_callback (*a, rpm_payload_open);
+		else
+			archive_read_set_open_callback (*a, load_data_open);
+		archive_read_set_read_callback (*a, zstd_reader_read);
+		archive_read_set_close_callback (*a, load_data_close);
+		archive_read_set_callback_data (*a, load_data);
+
+		return archive_read_open1 (*a);
+	}
+#endif
+
+	*a = archive_read_new ();
+	archive_read_support_filter_all (*a);
+	archive_read_support_format_all (*a);
+#if (ARCHIVE_VERSION_NUMBER >= 3002000)
+	if (load_data->password != NULL)
+		archive_read_add_passphrase (*a, load_data->password);
+#endif
+
+	archive_read_set_open_callback (*a, load_data_open);
+	archive_read_set_read_callback (*a, load_data_read);
+	archive_read_set_close_callback (*a, load_data_close);
+	archive_read_set_seek_callback (*a, load_data_seek);
+	archive_read_set_skip_callback (*a, load_data_skip);
+	archive_read_set_callback_data (*a, load_data);
+
+	return archive_read_open1 (*a);
+}
+
+
+#ifdef HAVE_ZLIB
+
+
+/* GzipSeekReader: decompresses the archive starting from an access point,
+ * used as input of a tar reader. */
+
+
+typedef struct {
+	LoadData       *load_data;
+	GzipIndexPoint *point;
+	gint64          to_skip;
+	GInputStream   *istream;
+	z_stream        stream;
+	gboolean        stream_initialized;
+	guchar         *in_buffer;
+	guchar         *out_buffer;
+} GzipSeekReader;
+
+
+static int
+gzip_seek_reader_open (struct archive *a,
+		       void           *client_data)
+{
+	GzipSeekReader *reader = client_data;
+	LoadData       *load_data = reader->load_data;
+	GFile          *file;
+
+	file = fr_archive_get_file (load_data->archive);
+	reader->istream = (GInputStream *) g_file_read (file, load_data->cancellable, &load_data->error);
+	if (reader->istream == NULL)
+		return ARCHIVE_FATAL;
+
+	if (! g_seekable_seek (G_SEEKABLE (reader->istream),
+			       reader->point->in - (reader->point->bits ? 1 : 0),
+			       G_SEEK_SET,
+			       load_data->cancellable,
+			       &load_data->error))
+	{
+		return ARCHIVE_FATAL;
+	}
+
+	if (inflateInit2 (&reader->stream, -15) != Z_OK)
+		return ARCHIVE_FATAL;
+	reader->stream_initialized = TRUE;
+
+	if (reader->point->bits) {
+		guchar byte;
+
+		if (g_input_stream_read (reader->istream, &byte, 1, load_data->cancellable, &load_data->error) != 1)
+			return ARCHIVE_FATAL;
+		inflatePrime (&reader->stream, reader->point->bits, byte >> (8 - reader->point->bits));
+	}
+	inflateSetDictionary (&reader->stream, reader->point->window, GZIP_INDEX_WINDOW_SIZE);
+
+	return ARCHIVE_OK;
+}
+
+
+static ssize_t
+gzip_seek_reader_read (struct archive  *a,
+		       void            *client_data,
+		       const void     **buff)
+{
+	GzipSeekReader *reader = client_data;
+	LoadData       *load_data = reader->load_data;
+
+	for (;;) {
+		gsize produced;
+		int   ret = Z_OK;
+
+		reader->stream.next_out = reader->out_buffer;
+		reader->stream.avail_out = BUFFER_SIZE;
+		while (reader->stream.avail_out == BUFFER_SIZE) {
+			if (reader->stream.avail_in == 0) {
+				gssize n;
+
+				n = g_input_stream_read (reader->istream, reader->in_buffer, BUFFER_SIZE, load_data->cancellable, &load_data->error);
+				if (n < 0)
+					return -1;
+				if (n == 0)
+					break;
+				reader->stream.next_in = reader->in_buffer;
+				reader->stream.avail_in = n;
+			}
+
+			ret = inflate (&reader->stream, Z_NO_FLUSH);
+			if (ret == Z_STREAM_END)
+				break;
+			if (ret != Z_OK) {
+				archive_set_error (a, ARCHIVE_ERRNO_MISC, "%s", (reader->stream.msg != NULL) ? reader->stream.msg : "gzip error");
+				return -1;
+			}
+		}
+
+		produced = BUFFER_SIZE - reader->stream.avail_out;
+		if (produced == 0)
+			return 0;
+
+		/* skip the data before the first entry to extract */
+
+		if (reader->to_skip >= (gint64) produced) {
+			reader->to_skip -= produced;
+			continue;
+		}
+
+		*buff = reader->out_buffer + reader->to_skip;
+		produced -= reader->to_skip;
+		reader->to_skip = 0;
+
+		return produced;
+	}
+}
+
+
+static int
+gzip_seek_reader_close (struct archive *a,
+			void           *client_data)
+{
+	GzipSeekReader *reader = client_data;
+
+	if (reader->stream_initialized)
+		inflateEnd (&reader->stream);
+	_g_object_unref (reader->istream);
+	g_free (reader->in_buffer);
+	g_free (reader->out_buffer);
+	g_free (reader);
+
+	return ARCHIVE_OK;
+}
+
+
+static int
+create_gzip_seek_read_object (LoadData            *load_data,
+			      GzipIndexPoint      *point,
+			      gint64               offset,
+			      _archive_read_ctx  **a)
+{
+	GzipSeekReader *reader;
+
+	reader = g_new0 (GzipSeekReader, 1);
+	reader->load_data = load_data;
+	reader->point = point;
+	reader->to_skip = offset - point->out;
+	reader->in_buffer = g_malloc (BUFFER_SIZE);
+	reader->out_buffer = g_malloc (BUFFER_SIZE);
+
+	*a = archive_read_new ();
+	archive_read_support_format_tar (*a);
+
+	return archive_read_open (*a,
+				  reader,
+				  gzip_seek_reader_open,
+				  gzip_seek_reader_read,
+				  gzip_seek_reader_close);
+}
+
+
+#endif /* HAVE_ZLIB */
+
+
+/* -- list -- */
+
+
+static goffset
+_g_file_get_size (GFile        *file,
+		  GCancellable *cancellable)
+{
+	g_autoptr (GFileInfo) info = NULL;
+	goffset    size;
+
+	info = g_file_query_info (file,
+				  G_FILE_ATTRIBUTE_STANDARD_SIZE,
+				  G_FILE_QUERY_INFO_NONE,
+				  cancellable,
+				  NULL);
+	if (info == NULL)
+		return 0;
+
+	size = g_file_info_get_size (info);
+
+	return size;
+}
+
+
+static GError *
+_g_error_new_from_archive_error (const char *s)
+{
+	g_autofree char *msg = NULL;
+	GError *error;
+
+	msg = (s != NULL) ? g_locale_to_utf8 (s, -1, NULL, NULL, NULL) : NULL;
+	if (msg == NULL)
+		msg = g_strdup ("Fatal error");
+	error = g_error_new_literal (FR_ERROR, FR_ERROR_COMMAND_ERROR, msg);
+
+	return error;
+}
+
+
+static void
+_fr_trace_end_archive (gint64      begin,
+		       const char *name,
+		       FrArchive  *archive,
+		       gint64      bytes)
+{
+	g_autofree char *uri = NULL;
+
+	if (begin == 0)
+		return;
+
+	uri = g_file_get_uri (fr_archive_get_file (archive));
+	fr_trace_end (begin, "libarchive", name, uri, bytes);
+}
+
+
+static void
+list_archive_thread (GSimpleAsyncResult *result,
+		     GObject            *object,
+		     GCancellable       *cancellable)
 {
 	g_autoptr (LoadData) load_data = NULL;
 	g_autoptr (_archive_read_ctx) a = NULL;
 	struct archive_entry *entry;
+	goffset               file_size;
 	int                   r;
+	gint64                trace_begin;
+	FrArchiveLibarchivePrivate *private;
+	GHashTable                 *hardlinks;
+#ifdef HAVE_ZLIB
+	GzipIndex                  *gzip_index = NULL;
+#endif
 
+	trace_begin = fr_trace_begin ();
 	load_data = g_simple_async_result_get_op_res_gpointer (result);
 
-	fr_archive_progress_set_total_bytes (load_data->archive,
-					     _g_file_get_size (fr_archive_get_file (load_data->archive), cancellable));
+	file_size = _g_file_get_size (fr_archive_get_file (load_data->archive), cancellable);
+	fr_archive_progress_set_total_bytes (load_data->archive, file_size);
+
+	private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
+	g_clear_pointer (&private->hardlinks, g_hash_table_unref);
+	hardlinks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+#ifdef HAVE_ZLIB
+	/* only the entry offsets here, the access points are searched when
+	 * extracting, see extract_archive_thread */
+	g_clear_pointer (&private->gzip_index, gzip_index_free);
+	if (_g_str_equal (fr_archive_get_mime_type (load_data->archive), "application/x-compressed-tar"))
+		gzip_index = gzip_index_new (file_size);
+#endif
 
 	r = create_read_object (load_data, &a);
 	if (r != ARCHIVE_OK) {
+#ifdef HAVE_ZLIB
+		if (gzip_index != NULL)
+			gzip_index_free (gzip_index);
+#endif
+		g_hash_table_unref (hardlinks);
 		return;
 	}
 
@@ -489,10 +1539,16 @@ list_archive_thread (GSimpleAsyncResult *result,
 		if (g_cancellable_is_cancelled (cancellable))
 			break;
 
+#ifdef HAVE_ZLIB
+		if (gzip_index != NULL)
+			gzip_index_add_entry (gzip_index,
+					      archive_entry_pathname (entry),
+					      archive_read_header_position (a));
+#endif
+
 		file_data = fr_file_data_new ();
 
 		if (archive_entry_size_is_set (entry)) {
-			FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
 			file_data->size = archive_entry_size (entry);
 			private->uncompressed_size += file_data->size;
 		}
@@ -504,6 +1560,8 @@ list_archive_thread (GSimpleAsyncResult *result,
 			file_data->link = g_strdup (archive_entry_symlink (entry));
 
 		pathname = archive_entry_pathname (entry);
+		if (archive_entry_hardlink (entry) != NULL)
+			g_hash_table_insert (hardlinks, g_strdup (pathname), g_strdup (archive_entry_hardlink (entry)));
 		if (*pathname == '/') {
 			file_data->full_path = g_strdup (pathname);
 			file_data->original_path = file_data->full_path;
@@ -540,6 +1598,20 @@ list_archive_thread (GSimpleAsyncResult *result,
 		g_cancellable_set_error_if_cancelled (cancellable, &load_data->error);
 	if (load_data->error != NULL)
 		g_simple_async_result_set_from_error (result, load_data->error);
+
+	if (load_data->error == NULL)
+		private->hardlinks = hardlinks;
+	else
+		g_hash_table_unref (hardlinks);
+
+#ifdef HAVE_ZLIB
+	if ((load_data->error == NULL) && (gzip_index != NULL))
+		private->gzip_index = gzip_index;
+	else if (gzip_index != NULL)
+		gzip_index_free (gzip_index);
+#endif
+
+	_fr_trace_end_archive (trace_begin, "list", load_data->archive, file_size);
 }
 
 
@@ -570,46 +1642,331 @@ fr_archive_libarchive_list (FrArchive           *archive,
 }
 
 
-/* -- extract -- */
+/* -- DestinationScan -- */
 
 
-#define NULL_BUFFER_SIZE (16 * 1024)
+/* Lists the destination folders of the extracted files from a pool of
+ * threads, while the archive is read, so that the overwrite and
+ * skip_older options are checked with a lookup instead of querying each
+ * file on a remote destination. */
+
+
+#define DESTINATION_SCAN_N_THREADS 4
 
 
 typedef struct {
-	LoadData    parent;
-	GList      *file_list;
-	GFile      *destination;
-	char       *base_dir;
-	gboolean    skip_older;
-	gboolean    overwrite;
-	gboolean    junk_paths;
-	GHashTable *files_to_extract;
-	int         n_files_to_extract;
-	GHashTable *usernames;
-	GHashTable *groupnames;
-	char       *null_buffer;
-} ExtractData;
+	GFile      *folder;
+	GHashTable *children;  /* name -> modification time */
+	GError     *error;
+	gboolean    done;
+} ScannedFolder;
 
 
-static void
-extract_data_free (ExtractData *extract_data)
+typedef struct {
+	GThreadPool  *pool;
+	GMutex        mutex;
+	GCond         cond;
+	GCancellable *cancellable;
+	GFile        *destination;
+	GHashTable   *folders;  /* relative path -> ScannedFolder */
+} DestinationScan;
+
+
+/* Removes the empty and "." components, and the trailing slashes. */
+static char *
+_g_path_normalize_relative (const char *path)
 {
-	g_free (extract_data->base_dir);
-	_g_object_unref (extract_data->destination);
-	_g_string_list_free (extract_data->file_list);
-	g_hash_table_unref (extract_data->files_to_extract);
-	g_hash_table_unref (extract_data->usernames);
-	g_hash_table_unref (extract_data->groupnames);
-	g_free (extract_data->null_buffer);
-	load_data_free (LOAD_DATA (extract_data));
+	GString  *normalized;
+	char    **components;
+	int       i;
+
+	normalized = g_string_new ("");
+	components = g_strsplit (path, "/", -1);
+	for (i = 0; components[i] != NULL; i++) {
+		if ((components[i][0] == 0) || (strcmp (components[i], ".") == 0))
+			continue;
+		if (normalized->len > 0)
+			g_string_append_c (normalized, '/');
+		g_string_append (normalized, components[i]);
+	}
+	g_strfreev (components);
+
+	return g_string_free (normalized, FALSE);
 }
 
-G_DEFINE_AUTOPTR_CLEANUP_FUNC (ExtractData, extract_data_free)
 
+/* Splits a normalized path in place, returns the name. */
+static const char *
+_g_path_split_relative (char        *path,
+			const char **folder)
+{
+	char *separator;
 
-static gboolean
-extract_data_get_extraction_requested (ExtractData *extract_data,
+	separator = strrchr (path, '/');
+	if (separator == NULL) {
+		*folder = "";
+		return path;
+	}
+
+	*separator = 0;
+	*folder = path;
+
+	return separator + 1;
+}
+
+
+static void
+scanned_folder_free (ScannedFolder *scanned)
+{
+	g_object_unref (scanned->folder);
+	if (scanned->children != NULL)
+		g_hash_table_unref (scanned->children);
+	_g_error_free (scanned->error);
+	g_free (scanned);
+}
+
+
+static void
+destination_scan_folder (gpointer data,
+			 gpointer user_data)
+{
+	ScannedFolder   *scanned = data;
+	DestinationScan *scan = user_data;
+	GHashTable      *children;
+	GFileEnumerator *enumerator;
+	GError          *error = NULL;
+
+	children = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	enumerator = g_file_enumerate_children (scanned->folder,
+						G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
+						G_FILE_QUERY_INFO_NONE,
+						scan->cancellable,
+						&error);
+	if (enumerator != NULL) {
+		GFileInfo *info;
+
+		while ((info = g_file_enumerator_next_file (enumerator, scan->cancellable, &error)) != NULL) {
+			gint64 *mtime;
+
+			mtime = g_new (gint64, 1);
+			*mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+			g_hash_table_insert (children, g_strdup (g_file_info_get_name (info)), mtime);
+			g_object_unref (info);
+		}
+		g_object_unref (enumerator);
+	}
+
+	/* a missing folder contains no files */
+	if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)
+	    || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY))
+	{
+		g_clear_error (&error);
+	}
+
+	g_mutex_lock (&scan->mutex);
+	scanned->children = children;
+	scanned->error = error;
+	scanned->done = TRUE;
+	g_cond_broadcast (&scan->cond);
+	g_mutex_unlock (&scan->mutex);
+}
+
+
+static DestinationScan *
+destination_scan_new (GFile        *destination,
+		      GCancellable *cancellable)
+{
+	DestinationScan *scan;
+
+	scan = g_new0 (DestinationScan, 1);
+	scan->pool = g_thread_pool_new (destination_scan_folder, scan, DESTINATION_SCAN_N_THREADS, FALSE, NULL);
+	g_mutex_init (&scan->mutex);
+	g_cond_init (&scan->cond);
+	scan->cancellable = _g_object_ref (cancellable);
+	scan->destination = g_object_ref (destination);
+	scan->folders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) scanned_folder_free);
+
+	return scan;
+}
+
+
+static void
+destination_scan_free (DestinationScan *scan)
+{
+	/* drop the folders not scanned yet, wait for the others */
+	g_thread_pool_free (scan->pool, TRUE, TRUE);
+	g_hash_table_unref (scan->folders);
+	g_object_unref (scan->destination);
+	_g_object_unref (scan->cancellable);
+	g_mutex_clear (&scan->mutex);
+	g_cond_clear (&scan->cond);
+	g_free (scan);
+}
+
+
+/* Returns the folder, queued for scanning if new.  Called with the
+ * mutex locked. */
+static ScannedFolder *
+destination_scan_get_folder (DestinationScan *scan,
+			     const char      *folder)
+{
+	ScannedFolder *scanned;
+
+	scanned = g_hash_table_lookup (scan->folders, folder);
+	if (scanned == NULL) {
+		scanned = g_new0 (ScannedFolder, 1);
+		scanned->folder = (folder[0] != 0) ? g_file_resolve_relative_path (scan->destination, folder) : g_object_ref (scan->destination);
+		g_hash_table_insert (scan->folders, g_strdup (folder), scanned);
+		g_thread_pool_push (scan->pool, scanned, NULL);
+	}
+
+	return scanned;
+}
+
+
+/* Queues the folder that contains @relative_path. */
+static void
+destination_scan_add_path (DestinationScan *scan,
+			   const char      *relative_path)
+{
+	g_autofree char *path = NULL;
+	const char      *folder;
+
+	path = _g_path_normalize_relative (relative_path);
+	if (path[0] == 0)
+		return;
+	_g_path_split_relative (path, &folder);
+
+	g_mutex_lock (&scan->mutex);
+	destination_scan_get_folder (scan, folder);
+	g_mutex_unlock (&scan->mutex);
+}
+
+
+/* Sets @exists if @relative_path exists in the destination, waiting for
+ * its folder to be scanned. */
+static gboolean
+destination_scan_lookup (DestinationScan  *scan,
+			 const char       *relative_path,
+			 gboolean         *exists,
+			 gint64           *mtime,
+			 GError          **error)
+{
+	g_autofree char *path = NULL;
+	const char      *folder;
+	const char      *name;
+	ScannedFolder   *scanned;
+	gint64          *child_mtime;
+	gboolean         success = TRUE;
+
+	*exists = FALSE;
+
+	path = _g_path_normalize_relative (relative_path);
+	if (path[0] == 0)
+		return TRUE;
+	name = _g_path_split_relative (path, &folder);
+
+	g_mutex_lock (&scan->mutex);
+	scanned = destination_scan_get_folder (scan, folder);
+	while (! scanned->done)
+		g_cond_wait (&scan->cond, &scan->mutex);
+
+	if (scanned->error != NULL) {
+		if (error != NULL)
+			*error = g_error_copy (scanned->error);
+		success = FALSE;
+	}
+	else {
+		child_mtime = g_hash_table_lookup (scanned->children, name);
+		if (child_mtime != NULL) {
+			*exists = TRUE;
+			*mtime = *child_mtime;
+		}
+	}
+	g_mutex_unlock (&scan->mutex);
+
+	return success;
+}
+
+
+/* Records a file created by the extraction, so that a later entry with
+ * the same name sees it. */
+static void
+destination_scan_add_file (DestinationScan *scan,
+			   const char      *relative_path)
+{
+	g_autofree char *path = NULL;
+	const char      *folder;
+	const char      *name;
+	ScannedFolder   *scanned;
+
+	path = _g_path_normalize_relative (relative_path);
+	if (path[0] == 0)
+		return;
+	name = _g_path_split_relative (path, &folder);
+
+	g_mutex_lock (&scan->mutex);
+	scanned = g_hash_table_lookup (scan->folders, folder);
+	if (scanned != NULL) {
+		while (! scanned->done)
+			g_cond_wait (&scan->cond, &scan->mutex);
+		if (scanned->children != NULL) {
+			gint64 *mtime;
+
+			mtime = g_new (gint64, 1);
+			*mtime = g_get_real_time () / G_USEC_PER_SEC;
+			g_hash_table_insert (scanned->children, g_strdup (name), mtime);
+		}
+	}
+	g_mutex_unlock (&scan->mutex);
+}
+
+
+/* -- extract -- */
+
+
+#define NULL_BUFFER_SIZE (16 * 1024)
+
+
+typedef struct {
+	LoadData         parent;
+	GList           *file_list;
+	GFile           *destination;
+	char            *base_dir;
+	gboolean         skip_older;
+	gboolean         overwrite;
+	gboolean         junk_paths;
+	GHashTable      *files_to_extract;
+	int              n_files_to_extract;
+	GHashTable      *link_targets;  /* target not requested -> requested hard link */
+	GHashTable      *usernames;
+	GHashTable      *groupnames;
+	char            *null_buffer;
+	DestinationScan *destination_scan;
+} ExtractData;
+
+
+static void
+extract_data_free (ExtractData *extract_data)
+{
+	g_free (extract_data->base_dir);
+	_g_object_unref (extract_data->destination);
+	_g_string_list_free (extract_data->file_list);
+	g_hash_table_unref (extract_data->files_to_extract);
+	g_hash_table_unref (extract_data->link_targets);
+	g_hash_table_unref (extract_data->usernames);
+	g_hash_table_unref (extract_data->groupnames);
+	g_free (extract_data->null_buffer);
+	if (extract_data->destination_scan != NULL)
+		destination_scan_free (extract_data->destination_scan);
+	load_data_free (LOAD_DATA (extract_data));
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ExtractData, extract_data_free)
+
+
+static gboolean
+extract_data_get_extraction_requested (ExtractData *extract_data,
 				       const char  *pathname)
 {
 	if (extract_data->file_list != NULL)
@@ -619,11 +1976,57 @@ extract_data_get_extraction_requested (ExtractData *extract_data,
 }
 
 
+static guint32
+extract_data_get_entry_uid (ExtractData          *extract_data,
+			    struct archive_entry *entry)
+{
+	guint32 uid;
+
+	if (archive_entry_uname (entry) == NULL)
+		return 0;
+
+	uid = GPOINTER_TO_INT (g_hash_table_lookup (extract_data->usernames, archive_entry_uname (entry)));
+	if (uid == 0) {
+		struct passwd *pwd = getpwnam (archive_entry_uname (entry));
+		if (pwd != NULL) {
+			uid = pwd->pw_uid;
+			g_hash_table_insert (extract_data->usernames, g_strdup (archive_entry_uname (entry)), GINT_TO_POINTER (uid));
+		}
+	}
+
+	return uid;
+}
+
+
+static guint32
+extract_data_get_entry_gid (ExtractData          *extract_data,
+			    struct archive_entry *entry)
+{
+	guint32 gid;
+
+	if (archive_entry_gname (entry) == NULL)
+		return 0;
+
+	gid = GPOINTER_TO_INT (g_hash_table_lookup (extract_data->groupnames, archive_entry_gname (entry)));
+	if (gid == 0) {
+		struct group *grp = getgrnam (archive_entry_gname (entry));
+		if (grp != NULL) {
+			gid = grp->gr_gid;
+			g_hash_table_insert (extract_data->groupnames, g_strdup (archive_entry_gname (entry)), GINT_TO_POINTER (gid));
+		}
+	}
+
+	return gid;
+}
+
+
 static GFileInfo *
 _g_file_info_create_from_entry (struct archive_entry *entry,
 			        ExtractData          *extract_data)
 {
 	GFileInfo *info;
+	guint32    uid;
+	guint32    gid;
 
 	info = g_file_info_new ();
 
@@ -634,37 +2037,15 @@ _g_file_info_create_from_entry (struct archive_entry *entry,
 
 	/* username */
 
-	if (archive_entry_uname (entry) != NULL) {
-		guint32 uid;
-
-		uid = GPOINTER_TO_INT (g_hash_table_lookup (extract_data->usernames, archive_entry_uname (entry)));
-		if (uid == 0) {
-			struct passwd *pwd = getpwnam (archive_entry_uname (entry));
-			if (pwd != NULL) {
-				uid = pwd->pw_uid;
-				g_hash_table_insert (extract_data->usernames, g_strdup (archive_entry_uname (entry)), GINT_TO_POINTER (uid));
-			}
-		}
-		if (uid != 0)
-			g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, uid);
-	}
+	uid = extract_data_get_entry_uid (extract_data, entry);
+	if (uid != 0)
+		g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_UID, uid);
 
 	/* groupname */
 
-	if (archive_entry_gname (entry) != NULL) {
-		guint32 gid;
-
-		gid = GPOINTER_TO_INT (g_hash_table_lookup (extract_data->groupnames, archive_entry_gname (entry)));
-		if (gid == 0) {
-			struct group *grp = getgrnam (archive_entry_gname (entry));
-			if (grp != NULL) {
-				gid = grp->gr_gid;
-				g_hash_table_insert (extract_data->groupnames, g_strdup (archive_entry_gname (entry)), GINT_TO_POINTER (gid));
-			}
-		}
-		if (gid != 0)
-			g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, gid);
-	}
+	gid = extract_data_get_entry_gid (extract_data, entry);
+	if (gid != 0)
+		g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_GID, gid);
 
 	/* permsissions */
 
@@ -701,11 +2082,14 @@ restore_original_file_attributes (GHashTable    *created_files,
 }
 
 
+/* Leaves a hole when the stream can seek, instead of writing the zeros.
+ * A hole at the end of the file is created by setting the file size. */
 static gboolean
 _g_output_stream_add_padding (ExtractData    *extract_data,
 			      GOutputStream  *ostream,
 			      gssize          target_offset,
 			      gssize          actual_offset,
+			      gboolean        end_of_file,
 			      GCancellable   *cancellable,
 			      GError        **error)
 {
@@ -713,6 +2097,16 @@ _g_output_stream_add_padding (ExtractData    *extract_data,
 	gsize    count;
 	gsize    bytes_written;
 
+	if (G_IS_SEEKABLE (ostream)) {
+		GSeekable *seekable = G_SEEKABLE (ostream);
+
+		if (end_of_file && g_seekable_can_truncate (seekable))
+			return g_seekable_truncate (seekable, target_offset, cancellable, error);
+
+		if (! end_of_file && g_seekable_can_seek (seekable))
+			return g_seekable_seek (seekable, target_offset - actual_offset, G_SEEK_CUR, cancellable, error);
+	}
+
 	if (extract_data->null_buffer == NULL)
 		extract_data->null_buffer = g_malloc0 (NULL_BUFFER_SIZE);
 
@@ -771,390 +2165,2462 @@ _g_file_contains_symlinks_in_path (const char *relative_path,
 
 
 static void
-extract_archive_thread (GSimpleAsyncResult *result,
-			GObject            *object,
-			GCancellable       *cancellable)
+_g_byte_array_fill_hole (GByteArray *data,
+			 int64_t     offset)
 {
-	g_autoptr (ExtractData) extract_data = NULL;
-	LoadData             *load_data;
-	g_autoptr (GHashTable) checked_folders = NULL;
-	g_autoptr (GHashTable) created_files = NULL;
-	g_autoptr (GHashTable) folders_created_during_extraction = NULL;
-	g_autoptr (GHashTable) symlinks = NULL;
-	g_autoptr (_archive_read_ctx) a = NULL;
-	struct archive_entry *entry;
-	int                   r;
-
-	extract_data = g_simple_async_result_get_op_res_gpointer (result);
-	load_data = LOAD_DATA (extract_data);
+	guint old_len;
 
-	r = create_read_object (load_data, &a);
-	if (r != ARCHIVE_OK) {
+	if (offset <= (int64_t) data->len)
 		return;
+
+	old_len = data->len;
+	g_byte_array_set_size (data, offset);
+	memset (data->data + old_len, 0, offset - old_len);
+}
+
+
+/* Reads the data of the current entry, filling the holes with zeros. */
+static GBytes *
+_archive_read_entry_data (struct archive  *a,
+			  GError         **error)
+{
+	GByteArray *data;
+	const void *buffer;
+	size_t      buffer_size;
+	int64_t     target_offset = 0;
+	int         r;
+
+	data = g_byte_array_new ();
+	while ((r = archive_read_data_block (a, &buffer, &buffer_size, &target_offset)) == ARCHIVE_OK) {
+		_g_byte_array_fill_hole (data, target_offset);
+		g_byte_array_append (data, buffer, buffer_size);
 	}
 
-	checked_folders = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
-	created_files = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, g_object_unref);
-	folders_created_during_extraction = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
-	symlinks = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
-	fr_archive_progress_set_total_files (load_data->archive, extract_data->n_files_to_extract);
+	if (r != ARCHIVE_EOF) {
+		*error = _g_error_new_from_archive_error (archive_error_string (a));
+		g_byte_array_unref (data);
+		return NULL;
+	}
+	_g_byte_array_fill_hole (data, target_offset);
 
-	while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
-		const char    *pathname;
-		g_autofree char * fullpath = NULL;
-		const char    *relative_path;
-		g_autoptr (GFile) file = NULL;
-		g_autoptr (GFile) parent = NULL;
-		g_autoptr (GOutputStream) ostream = NULL;
-		const void    *buffer;
-		size_t         buffer_size;
-		int64_t target_offset = 0;
-		int64_t actual_offset = 0;
-		GError        *local_error = NULL;
-		__LA_MODE_T    filetype;
+	return g_byte_array_free_to_bytes (data);
+}
 
-		if (g_cancellable_is_cancelled (cancellable))
-			break;
 
-		pathname = archive_entry_pathname (entry);
-		if (! extract_data_get_extraction_requested (extract_data, pathname)) {
-			archive_read_data_skip (a);
-			continue;
-		}
+/* -- LocalWriter -- */
 
-		fullpath = (*pathname == '/') ? g_strdup (pathname) : g_strconcat ("/", pathname, NULL);
-		relative_path = _g_path_get_relative_basename_safe (fullpath, extract_data->base_dir, extract_data->junk_paths);
-		if (relative_path == NULL) {
-			fr_archive_progress_inc_completed_files (load_data->archive, 1);
-			fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
-			archive_read_data_skip (a);
-			continue;
-		}
 
-		/* Symlinks in parents are dangerous as it can easily happen
-		 * that files are written outside of the destination. The tar
-		 * cmd fails to extract such archives with ENOTDIR. Let's skip
-		 * those files here for sure. This is most probably malicious,
-		 * or corrupted archive.
-		 */
-		if (_g_file_contains_symlinks_in_path (relative_path, extract_data->destination, symlinks)) {
-			g_warning ("Skipping '%s' file as it has symlink in parents.", relative_path);
-			fr_archive_progress_inc_completed_files (load_data->archive, 1);
-			fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
-			archive_read_data_skip (a);
-			continue;
-		}
+/* Creates the files of a local destination relative to directory
+ * descriptors: the folders are opened one component at a time without
+ * following symlinks, and the attributes are set on the open file, so no
+ * path is resolved again at the end of the extraction. */
 
-		file = g_file_get_child (extract_data->destination, relative_path);
 
-		/* honor the skip_older and overwrite options */
+typedef enum {
+	LOCAL_ENTRY_EXTRACTED,
+	LOCAL_ENTRY_SKIPPED,   /* not overwritten */
+	LOCAL_ENTRY_IGNORED,   /* symlink in parents */
+	LOCAL_ENTRY_ERROR
+} LocalEntryResult;
 
-		if ((g_hash_table_lookup (folders_created_during_extraction, file) == NULL)
-		    && (extract_data->skip_older || ! extract_data->overwrite))
-		{
-			g_autoptr (GFileInfo) info = NULL;
-
-			info = g_file_query_info (file,
-						  G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," G_FILE_ATTRIBUTE_TIME_MODIFIED,
-						  G_FILE_QUERY_INFO_NONE,
-						  cancellable,
-						  &local_error);
-			if (info != NULL) {
-				gboolean skip = FALSE;
 
-				if (! extract_data->overwrite) {
-					skip = TRUE;
-				}
-				else if (extract_data->skip_older) {
-					GTimeVal modification_time;
+static GError *
+_g_error_new_from_errno (int errsv)
+{
+	return g_error_new_literal (G_IO_ERROR, g_io_error_from_errno (errsv), g_strerror (errsv));
+}
 
-					g_file_info_get_modification_time (info, &modification_time);
-					if (archive_entry_mtime (entry) < modification_time.tv_sec)
-						skip = TRUE;
-				}
 
-				if (skip) {
-					archive_read_data_skip (a);
-					fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
+/* Creates a new file, an existing file is removed first so that its
+ * other hard links and the target of a symlink are left untouched. */
+static int
+_local_file_create (int         folder_fd,
+		    const char *name,
+		    gboolean    truncate)
+{
+	int fd;
 
-					if ((extract_data->file_list != NULL) && (--extract_data->n_files_to_extract == 0)) {
-						r = ARCHIVE_EOF;
-						break;
-					}
+	if (truncate)
+		return openat (folder_fd, name, O_WRONLY | O_TRUNC | O_NOFOLLOW | O_CLOEXEC);
 
-					continue;
-				}
-			}
-			else {
-				if (! g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
-					load_data->error = local_error;
-					break;
-				}
-				g_clear_error (&local_error);
-			}
+	fd = openat (folder_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if ((fd < 0) && (errno == EEXIST) && (unlinkat (folder_fd, name, 0) == 0))
+		fd = openat (folder_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+	return fd;
+}
+
+
+static gboolean
+_fd_write_all (int          fd,
+	       const char  *data,
+	       gsize        size,
+	       GError     **error)
+{
+	while (size > 0) {
+		ssize_t n = write (fd, data, size);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			*error = _g_error_new_from_errno (errno);
+			return FALSE;
 		}
 
-		fr_archive_progress_inc_completed_files (load_data->archive, 1);
+		data += n;
+		size -= n;
+	}
 
-		/* create the file parents */
+	return TRUE;
+}
 
-		parent = g_file_get_parent (file);
 
-		if ((parent != NULL)
-		    && (g_hash_table_lookup (checked_folders, parent) == NULL)
-		    && ! g_file_query_exists (parent, cancellable))
-		{
-			if (! _g_file_make_directory_with_parents (parent,
+/* Whether the owner of a file created by this process must be changed to
+ * match @uid and @gid, zero means not set.  Only root can change the
+ * owner, in that case the group is not changed either. */
+static gboolean
+_local_file_needs_chown (guint32 uid,
+			 guint32 gid,
+			 uid_t   euid,
+			 gid_t   egid)
+{
+	if ((uid != 0) && (uid != euid))
+		return euid == 0;
+
+	return (gid != 0) && (gid != egid);
+}
+
+
+#ifdef HAVE_LIBURING
+
+
+/* Small files are written with io_uring: the unlink of the existing
+ * file, the open, write and close of a batch of files are queued as
+ * linked requests and submitted with a single system call.  Only the
+ * files that openat can create with the final permissions and owner are
+ * queued. */
+
+
+#define URING_WRITER_MAX_FILE_SIZE (64 * 1024)
+#define URING_WRITER_BATCH_SIZE 64
+
+
+typedef enum {
+	URING_OP_UNLINK,
+	URING_OP_OPEN,
+	URING_OP_WRITE,
+	URING_OP_CLOSE,
+	URING_N_OPS
+} UringOp;
+
+
+typedef struct {
+	char            *path;
+	const char      *name;
+	int              folder_fd;
+	GBytes          *content;
+	mode_t           mode;
+	gboolean         mtime_set;
+	struct timespec  mtime;
+	int              n_requests;
+	int              result;
+} UringWrite;
+
+
+typedef struct {
+	struct io_uring  ring;
+	FrArchive       *archive;
+	mode_t           umask;
+	uid_t            euid;
+	gid_t            egid;
+	UringWrite       writes[URING_WRITER_BATCH_SIZE];
+	int              n_writes;
+	int              n_requests;
+	GHashTable      *pending_paths;
+} UringWriter;
+
+
+/* Reads the umask without changing it, umask() is not thread safe. */
+static gboolean
+_get_process_umask (mode_t *mask)
+{
+	g_autofree char *status = NULL;
+	const char      *line;
+
+	if (! g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+		return FALSE;
+
+	line = strstr (status, "\nUmask:");
+	if (line == NULL)
+		return FALSE;
+
+	*mask = strtoul (line + strlen ("\nUmask:"), NULL, 8) & 0777;
+
+	return TRUE;
+}
+
+
+static UringWriter *
+uring_writer_new (FrArchive *archive)
+{
+	UringWriter *writer;
+	mode_t       mask;
+
+	if (! _get_process_umask (&mask))
+		return NULL;
+
+	writer = g_new0 (UringWriter, 1);
+	if (io_uring_queue_init (URING_WRITER_BATCH_SIZE * URING_N_OPS, &writer->ring, 0) < 0) {
+		g_free (writer);
+		return NULL;
+	}
+
+	/* the files are opened as direct descriptors, one slot per write */
+	if (io_uring_register_files_sparse (&writer->ring, URING_WRITER_BATCH_SIZE) < 0) {
+		io_uring_queue_exit (&writer->ring);
+		g_free (writer);
+		return NULL;
+	}
+
+	writer->archive = archive;
+	writer->umask = mask;
+	writer->euid = geteuid ();
+	writer->egid = getegid ();
+	writer->n_writes = 0;
+	writer->n_requests = 0;
+	writer->pending_paths = g_hash_table_new (g_str_hash, g_str_equal);
+
+	return writer;
+}
+
+
+static void
+uring_write_clear (UringWrite *uring_write)
+{
+	g_free (uring_write->path);
+	uring_write->path = NULL;
+	g_bytes_unref (uring_write->content);
+	uring_write->content = NULL;
+}
+
+
+static void
+uring_writer_free (UringWriter *writer)
+{
+	int i;
+
+	/* the queued requests were never submitted */
+	for (i = 0; i < writer->n_writes; i++)
+		uring_write_clear (&writer->writes[i]);
+	g_hash_table_unref (writer->pending_paths);
+	io_uring_queue_exit (&writer->ring);
+	g_free (writer);
+}
+
+
+static gboolean
+uring_writer_can_write (UringWriter          *writer,
+			struct archive_entry *entry,
+			guint32               uid,
+			guint32               gid)
+{
+	mode_t mode = archive_entry_mode (entry);
+
+	if (! archive_entry_size_is_set (entry) || (archive_entry_size (entry) > URING_WRITER_MAX_FILE_SIZE))
+		return FALSE;
+
+	/* openat applies the umask and cannot set the special bits, the
+	 * synchronous path sets all of them with fchmod */
+	if (((mode & 0777 & writer->umask) != 0) || ((mode & 07000) != 0))
+		return FALSE;
+
+	/* only the synchronous path changes the owner */
+	return ! _local_file_needs_chown (uid, gid, writer->euid, writer->egid);
+}
+
+
+static gboolean
+uring_writer_is_pending (UringWriter *writer,
+			 const char  *path)
+{
+	return g_hash_table_contains (writer->pending_paths, path);
+}
+
+
+static gboolean
+uring_writer_is_full (UringWriter *writer)
+{
+	return writer->n_writes == URING_WRITER_BATCH_SIZE;
+}
+
+
+/* Writes a file whose requests failed, for example because it could not
+ * be removed, the same way the synchronous path does. */
+static gboolean
+uring_write_retry (UringWrite  *uring_write,
+		   GError     **error)
+{
+	const char *data;
+	gsize       size;
+	int         fd;
+
+	fd = _local_file_create (uring_write->folder_fd, uring_write->name, FALSE);
+	if (fd < 0) {
+		*error = _g_error_new_from_errno (errno);
+		return FALSE;
+	}
+
+	data = g_bytes_get_data (uring_write->content, &size);
+	if (! _fd_write_all (fd, data, size, error)) {
+		close (fd);
+		return FALSE;
+	}
+
+	fchmod (fd, uring_write->mode);
+	if (uring_write->mtime_set) {
+		struct timespec times[2];
+
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1] = uring_write->mtime;
+		futimens (fd, times);
+	}
+
+	if (close (fd) != 0) {
+		*error = _g_error_new_from_errno (errno);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/* Submits the queued requests and waits for all of them to complete. */
+static gboolean
+uring_writer_flush (UringWriter  *writer,
+		    GError      **error)
+{
+	int n_completions;
+	int r;
+	int i;
+
+	if (writer->n_writes == 0)
+		return TRUE;
+
+	r = io_uring_submit (&writer->ring);
+	if (r < 0) {
+		*error = _g_error_new_from_errno (-r);
+		return FALSE;
+	}
+
+	n_completions = writer->n_requests;
+	while (n_completions > 0) {
+		struct io_uring_cqe *cqe;
+		guint                user_data;
+		UringWrite          *uring_write;
+		UringOp              op;
+
+		r = io_uring_wait_cqe (&writer->ring, &cqe);
+		if (r == -EINTR)
+			continue;
+		if (r < 0) {
+			*error = _g_error_new_from_errno (-r);
+			return FALSE;
+		}
+
+		user_data = GPOINTER_TO_UINT (io_uring_cqe_get_data (cqe));
+		uring_write = &writer->writes[user_data / URING_N_OPS];
+		op = user_data % URING_N_OPS;
+
+		/* keep the first error, the close of a file that could not be
+		 * opened always fails.  The unlink fails when the file doesn't
+		 * exist, and if it fails for another reason the open fails as
+		 * well. */
+		if ((uring_write->result == 0) && (op != URING_OP_UNLINK)) {
+			if (cqe->res < 0)
+				uring_write->result = cqe->res;
+			else if ((op == URING_OP_WRITE) && ((gsize) cqe->res != g_bytes_get_size (uring_write->content)))
+				uring_write->result = -EIO;
+		}
+
+		io_uring_cqe_seen (&writer->ring, cqe);
+		n_completions--;
+
+		/* the close is the last request of a file */
+		if ((op == URING_OP_CLOSE) && (uring_write->result == 0)) {
+			if (uring_write->mtime_set) {
+				struct timespec times[2];
+
+				times[0].tv_sec = 0;
+				times[0].tv_nsec = UTIME_OMIT;
+				times[1] = uring_write->mtime;
+				utimensat (uring_write->folder_fd, uring_write->name, times, AT_SYMLINK_NOFOLLOW);
+			}
+			fr_archive_progress_inc_completed_files (writer->archive, 1);
+		}
+	}
+
+	for (i = 0; i < writer->n_writes; i++) {
+		UringWrite *uring_write = &writer->writes[i];
+
+		if (uring_write->result != 0) {
+			if (*error == NULL)
+				uring_write_retry (uring_write, error);
+			fr_archive_progress_inc_completed_files (writer->archive, 1);
+		}
+		uring_write_clear (uring_write);
+	}
+	writer->n_writes = 0;
+	writer->n_requests = 0;
+	g_hash_table_remove_all (writer->pending_paths);
+
+	return (*error == NULL);
+}
+
+
+/* Queues the creation of @path, @folder_fd must stay open until the
+ * next flush.  The batch must not be full.  If @replace is TRUE the
+ * existing file is removed first, as _local_file_create does. */
+static void
+uring_writer_write (UringWriter          *writer,
+		    int                   folder_fd,
+		    const char           *path,
+		    GBytes               *content,
+		    struct archive_entry *entry,
+		    gboolean              replace)
+{
+	UringWrite          *uring_write;
+	struct io_uring_sqe *sqe;
+	guint                index;
+	const char          *separator;
+	const void          *data;
+	gsize                size;
+
+	index = writer->n_writes++;
+	uring_write = &writer->writes[index];
+	uring_write->path = g_strdup (path);
+	separator = strrchr (uring_write->path, '/');
+	uring_write->name = (separator != NULL) ? separator + 1 : uring_write->path;
+	uring_write->folder_fd = folder_fd;
+	uring_write->content = g_bytes_ref (content);
+	uring_write->mode = archive_entry_mode (entry) & 0777;
+	uring_write->mtime_set = archive_entry_mtime_is_set (entry);
+	uring_write->mtime.tv_sec = archive_entry_mtime (entry);
+	uring_write->mtime.tv_nsec = archive_entry_mtime_nsec (entry);
+	uring_write->n_requests = replace ? URING_N_OPS : URING_N_OPS - 1;
+	uring_write->result = 0;
+	writer->n_requests += uring_write->n_requests;
+	g_hash_table_add (writer->pending_paths, uring_write->path);
+
+	data = g_bytes_get_data (content, &size);
+
+	if (replace) {
+		sqe = io_uring_get_sqe (&writer->ring);
+		io_uring_prep_unlinkat (sqe, folder_fd, uring_write->name, 0);
+		io_uring_sqe_set_data (sqe, GUINT_TO_POINTER (index * URING_N_OPS + URING_OP_UNLINK));
+		sqe->flags |= IOSQE_IO_HARDLINK; /* open even if the file doesn't exist */
+	}
+
+	/* direct descriptors don't accept O_CLOEXEC */
+	sqe = io_uring_get_sqe (&writer->ring);
+	io_uring_prep_openat_direct (sqe, folder_fd, uring_write->name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, uring_write->mode, index);
+	io_uring_sqe_set_data (sqe, GUINT_TO_POINTER (index * URING_N_OPS + URING_OP_OPEN));
+	sqe->flags |= IOSQE_IO_LINK;
+
+	sqe = io_uring_get_sqe (&writer->ring);
+	io_uring_prep_write (sqe, index, data, size, 0);
+	io_uring_sqe_set_data (sqe, GUINT_TO_POINTER (index * URING_N_OPS + URING_OP_WRITE));
+	sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK; /* close even if the write fails */
+
+	sqe = io_uring_get_sqe (&writer->ring);
+	io_uring_prep_close_direct (sqe, index);
+	io_uring_sqe_set_data (sqe, GUINT_TO_POINTER (index * URING_N_OPS + URING_OP_CLOSE));
+}
+
+
+#endif /* HAVE_LIBURING */
+
+
+typedef struct {
+	int          root_fd;
+	char        *folder;
+	int          folder_fd;
+	GHashTable  *created_folders;
+#ifdef HAVE_LIBURING
+	UringWriter *uring;
+	GArray      *retired_fds;
+#endif
+} LocalWriter;
+
+
+static LocalWriter *
+local_writer_new (GFile     *destination,
+		  FrArchive *archive)
+{
+	LocalWriter     *writer;
+	g_autofree char *path = NULL;
+	int              root_fd;
+
+	path = g_file_get_path (destination);
+	if (path == NULL)
+		return NULL;
+
+	root_fd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root_fd < 0)
+		return NULL;
+
+	writer = g_new0 (LocalWriter, 1);
+	writer->root_fd = root_fd;
+	writer->folder = NULL;
+	writer->folder_fd = -1;
+	writer->created_folders = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+#ifdef HAVE_LIBURING
+	writer->uring = uring_writer_new (archive);
+	writer->retired_fds = g_array_new (FALSE, FALSE, sizeof (int));
+#endif
+
+	return writer;
+}
+
+
+static void
+local_writer_close_retired_fds (LocalWriter *writer)
+{
+#ifdef HAVE_LIBURING
+	guint i;
+
+	for (i = 0; i < writer->retired_fds->len; i++)
+		close (g_array_index (writer->retired_fds, int, i));
+	g_array_set_size (writer->retired_fds, 0);
+#endif
+}
+
+
+/* Closes @fd, or keeps it open until the queued writes that use it are
+ * completed. */
+static void
+local_writer_retire_fd (LocalWriter *writer,
+			int          fd)
+{
+#ifdef HAVE_LIBURING
+	if ((writer->uring != NULL) && (writer->uring->n_writes > 0)) {
+		g_array_append_val (writer->retired_fds, fd);
+		return;
+	}
+#endif
+	close (fd);
+}
+
+
+/* Completes the queued writes. */
+static gboolean
+local_writer_flush (LocalWriter  *writer,
+		    GError      **error)
+{
+	gboolean success = TRUE;
+
+#ifdef HAVE_LIBURING
+	if (writer->uring != NULL)
+		success = uring_writer_flush (writer->uring, error);
+#endif
+	local_writer_close_retired_fds (writer);
+
+	return success;
+}
+
+
+static void
+local_writer_free (LocalWriter *writer)
+{
+#ifdef HAVE_LIBURING
+	if (writer->uring != NULL)
+		uring_writer_free (writer->uring);
+	local_writer_close_retired_fds (writer);
+	g_array_unref (writer->retired_fds);
+#endif
+	if (writer->folder_fd >= 0)
+		close (writer->folder_fd);
+	close (writer->root_fd);
+	g_free (writer->folder);
+	g_hash_table_unref (writer->created_folders);
+	g_free (writer);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LocalWriter, local_writer_free)
+
+
+/* Opens @folder one component at a time without following symlinks,
+ * creating the missing folders if @create is TRUE.  Returns -1 and sets
+ * @symlink_found if a component of the path is a symlink.  The returned
+ * descriptor must be closed by the caller, unless it is the root. */
+static int
+local_writer_open_folder (LocalWriter  *writer,
+			  const char   *folder,
+			  gboolean      create,
+			  gboolean     *symlink_found,
+			  GError      **error)
+{
+	char  **components;
+	gsize   prefix_len;
+	int     fd;
+	int     i;
+
+	if (folder[0] == 0)
+		return writer->root_fd;
+
+	fd = writer->root_fd;
+	prefix_len = 0;
+	components = g_strsplit (folder, "/", -1);
+	for (i = 0; components[i] != NULL; i++) {
+		int next_fd;
+
+		prefix_len += ((i > 0) ? 1 : 0) + strlen (components[i]);
+		next_fd = openat (fd, components[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		if ((next_fd < 0) && (errno == ENOENT) && create) {
+			if (mkdirat (fd, components[i], 0777) == 0)
+				g_hash_table_add (writer->created_folders, g_strndup (folder, prefix_len));
+			next_fd = openat (fd, components[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		}
+
+		if (next_fd < 0) {
+			int         errsv = errno;
+			struct stat st;
+
+			if ((errsv == ENOTDIR)
+			    && (fstatat (fd, components[i], &st, AT_SYMLINK_NOFOLLOW) == 0)
+			    && S_ISLNK (st.st_mode))
+			{
+				*symlink_found = TRUE;
+			}
+			else
+				*error = _g_error_new_from_errno (errsv);
+
+			if (fd != writer->root_fd)
+				close (fd);
+			g_strfreev (components);
+			return -1;
+		}
+
+		if (fd != writer->root_fd)
+			close (fd);
+		fd = next_fd;
+	}
+	g_strfreev (components);
+
+	return fd;
+}
+
+
+/* Returns a descriptor of @folder, owned by the writer, creating the
+ * missing folders.  Returns -1 and sets @symlink_found if a component of
+ * the path is a symlink. */
+static int
+local_writer_get_folder (LocalWriter  *writer,
+			 const char   *folder,
+			 gboolean     *symlink_found,
+			 GError      **error)
+{
+	int fd;
+
+	if (folder[0] == 0)
+		return writer->root_fd;
+
+	if (g_strcmp0 (folder, writer->folder) == 0)
+		return writer->folder_fd;
+
+	fd = local_writer_open_folder (writer, folder, TRUE, symlink_found, error);
+	if (fd < 0)
+		return -1;
+
+	if (writer->folder_fd >= 0)
+		local_writer_retire_fd (writer, writer->folder_fd);
+	g_free (writer->folder);
+	writer->folder = g_strdup (folder);
+	writer->folder_fd = fd;
+
+	return fd;
+}
+
+
+static gboolean
+_archive_read_data_to_fd (struct archive  *a,
+			  int              fd,
+			  FrArchive       *archive,
+			  GError         **error)
+{
+	const void *buffer;
+	size_t      buffer_size;
+	int64_t     target_offset = 0;
+	int64_t     actual_offset = 0;
+	int         r;
+
+	while ((r = archive_read_data_block (a, &buffer, &buffer_size, &target_offset)) == ARCHIVE_OK) {
+		if (target_offset > actual_offset) {
+			if (lseek (fd, target_offset, SEEK_SET) < 0) {
+				*error = _g_error_new_from_errno (errno);
+				return FALSE;
+			}
+			fr_archive_progress_inc_completed_bytes (archive, target_offset - actual_offset);
+			actual_offset = target_offset;
+		}
+
+		if (! _fd_write_all (fd, buffer, buffer_size, error))
+			return FALSE;
+
+		actual_offset += buffer_size;
+		fr_archive_progress_inc_completed_bytes (archive, buffer_size);
+	}
+
+	if (r != ARCHIVE_EOF) {
+		*error = _g_error_new_from_archive_error (archive_error_string (a));
+		return FALSE;
+	}
+
+	if ((target_offset > actual_offset) && (ftruncate (fd, target_offset) != 0)) {
+		*error = _g_error_new_from_errno (errno);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void
+_local_file_set_attributes_from_entry (int                   fd,
+				       struct archive_entry *entry,
+				       ExtractData          *extract_data)
+{
+	guint32 uid;
+	guint32 gid;
+
+	/* as with the GIO attributes, failing to change the owner is not an error */
+
+	uid = extract_data_get_entry_uid (extract_data, entry);
+	gid = extract_data_get_entry_gid (extract_data, entry);
+	if (_local_file_needs_chown (uid, gid, geteuid (), getegid ())
+	    && (fchown (fd, (uid != 0) ? (uid_t) uid : (uid_t) -1, (gid != 0) ? (gid_t) gid : (gid_t) -1) != 0))
+	{
+		g_debug ("Could not change the owner of '%s': %s", archive_entry_pathname (entry), g_strerror (errno));
+	}
+
+	fchmod (fd, archive_entry_mode (entry) & 07777);
+
+	if (archive_entry_mtime_is_set (entry)) {
+		struct timespec times[2];
+
+		times[0].tv_sec = 0;
+		times[0].tv_nsec = UTIME_OMIT;
+		times[1].tv_sec = archive_entry_mtime (entry);
+		times[1].tv_nsec = archive_entry_mtime_nsec (entry);
+		futimens (fd, times);
+	}
+}
+
+
+static LocalEntryResult
+local_writer_extract_entry (LocalWriter           *writer,
+			    struct archive        *a,
+			    struct archive_entry  *entry,
+			    const char            *relative_path,
+			    ExtractData           *extract_data,
+			    GHashTable            *created_files,
+			    GError               **error)
+{
+	FrArchive       *archive = LOAD_DATA (extract_data)->archive;
+	g_autofree char *path = NULL;
+	g_autofree char *folder_path = NULL;
+	const char      *folder;
+	const char      *name;
+	const char      *separator;
+	gboolean         created_during_extraction;
+	gboolean         symlink_found = FALSE;
+	int              folder_fd;
+	__LA_MODE_T      filetype;
+	const char      *linkname;
+	gboolean         linked = FALSE;
+	int              fd;
+
+	path = _g_path_normalize_relative (relative_path);
+	if (path[0] == 0) {
+		/* the destination itself */
+		fr_archive_progress_inc_completed_files (archive, 1);
+		archive_read_data_skip (a);
+		return LOCAL_ENTRY_EXTRACTED;
+	}
+
+#ifdef HAVE_LIBURING
+	/* a queued file must be created before it can be checked or replaced */
+	if ((writer->uring != NULL) && uring_writer_is_pending (writer->uring, path) && ! local_writer_flush (writer, error))
+		return LOCAL_ENTRY_ERROR;
+#endif
+
+	created_during_extraction = g_hash_table_contains (writer->created_folders, path);
+
+	separator = strrchr (path, '/');
+	if (separator != NULL) {
+		folder_path = g_strndup (path, separator - path);
+		folder = folder_path;
+		name = separator + 1;
+	}
+	else {
+		folder = "";
+		name = path;
+	}
+
+	folder_fd = local_writer_get_folder (writer, folder, &symlink_found, error);
+	if (folder_fd < 0)
+		return symlink_found ? LOCAL_ENTRY_IGNORED : LOCAL_ENTRY_ERROR;
+
+	/* honor the skip_older and overwrite options */
+
+	if (! created_during_extraction && (extract_data->skip_older || ! extract_data->overwrite)) {
+		struct stat st;
+
+		if (fstatat (folder_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+			if (! extract_data->overwrite)
+				return LOCAL_ENTRY_SKIPPED;
+			if (extract_data->skip_older && (archive_entry_mtime (entry) < st.st_mtime))
+				return LOCAL_ENTRY_SKIPPED;
+		}
+		else if (errno != ENOENT) {
+			*error = _g_error_new_from_errno (errno);
+			return LOCAL_ENTRY_ERROR;
+		}
+	}
+
+	filetype = archive_entry_filetype (entry);
+	linkname = archive_entry_hardlink (entry);
+
+#ifdef HAVE_LIBURING
+	if ((writer->uring != NULL)
+	    && (filetype == AE_IFREG)
+	    && (linkname == NULL)
+	    && uring_writer_can_write (writer->uring,
+				       entry,
+				       extract_data_get_entry_uid (extract_data, entry),
+				       extract_data_get_entry_gid (extract_data, entry)))
+	{
+		g_autoptr (GBytes) content = NULL;
+
+		if (uring_writer_is_full (writer->uring) && ! local_writer_flush (writer, error))
+			return LOCAL_ENTRY_ERROR;
+
+		content = _archive_read_entry_data (a, error);
+		if (content == NULL)
+			return LOCAL_ENTRY_ERROR;
+
+		/* the file is counted when the write is completed.  A file
+		 * in a folder created by the extraction cannot exist yet */
+		fr_archive_progress_inc_completed_bytes (archive, g_bytes_get_size (content));
+		uring_writer_write (writer->uring,
+				    folder_fd,
+				    path,
+				    content,
+				    entry,
+				    ! g_hash_table_contains (writer->created_folders, folder));
+
+		return LOCAL_ENTRY_EXTRACTED;
+	}
+#endif
+
+	fr_archive_progress_inc_completed_files (archive, 1);
+
+	if (linkname != NULL) {
+		g_autofree char *link_fullpath = NULL;
+		const char      *link_relative_path;
+		g_autofree char *link_path = NULL;
+		const char      *link_folder;
+		const char      *link_name;
+		gboolean         link_symlink_found = FALSE;
+		int              link_folder_fd;
+		int              r;
+
+		link_fullpath = (*linkname == '/') ? g_strdup (linkname) : g_strconcat ("/", linkname, NULL);
+		link_relative_path = _g_path_get_relative_basename_safe (link_fullpath, extract_data->base_dir, extract_data->junk_paths);
+		if (link_relative_path == NULL) {
+			archive_read_data_skip (a);
+			return LOCAL_ENTRY_EXTRACTED;
+		}
+
+		link_path = _g_path_normalize_relative (link_relative_path);
+		if (link_path[0] == 0) {
+			archive_read_data_skip (a);
+			return LOCAL_ENTRY_EXTRACTED;
+		}
+		link_name = _g_path_split_relative (link_path, &link_folder);
+
+		/* the target can be a queued file */
+		if (! local_writer_flush (writer, error))
+			return LOCAL_ENTRY_ERROR;
+
+		/* reach the target without following the symlinks, as the
+		 * destination folder */
+
+		link_folder_fd = local_writer_open_folder (writer, link_folder, FALSE, &link_symlink_found, error);
+		if (link_folder_fd < 0) {
+			if (! link_symlink_found)
+				return LOCAL_ENTRY_ERROR;
+			g_warning ("Skipping '%s' file as its link target has symlink in parents.", relative_path);
+			archive_read_data_skip (a);
+			return LOCAL_ENTRY_EXTRACTED;
+		}
+
+		r = linkat (link_folder_fd, link_name, folder_fd, name, 0);
+		if (link_folder_fd != writer->root_fd)
+			close (link_folder_fd);
+
+		if (r != 0) {
+			*error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED, "Could not create the hard link %s", relative_path);
+			return LOCAL_ENTRY_ERROR;
+		}
+
+		linked = TRUE;
+		if (archive_entry_size_is_set (entry) && (archive_entry_size (entry) > 0))
+			filetype = AE_IFREG; /* treat as a regular file to save the data */
+	}
+
+	switch (filetype) {
+	case AE_IFDIR:
+		if (mkdirat (folder_fd, name, 0777) == 0) {
+			g_hash_table_insert (created_files, g_file_resolve_relative_path (extract_data->destination, relative_path), _g_file_info_create_from_entry (entry, extract_data));
+		}
+		else {
+			struct stat st;
+
+			if (errno != EEXIST) {
+				*error = _g_error_new_from_errno (errno);
+				return LOCAL_ENTRY_ERROR;
+			}
+
+			/* never change the attributes of a symlink target */
+			if ((fstatat (folder_fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISDIR (st.st_mode))
+				g_hash_table_insert (created_files, g_file_resolve_relative_path (extract_data->destination, relative_path), _g_file_info_create_from_entry (entry, extract_data));
+		}
+		archive_read_data_skip (a);
+		break;
+
+	case AE_IFREG:
+		fd = _local_file_create (folder_fd, name, linked);
+		if (fd < 0) {
+			*error = _g_error_new_from_errno (errno);
+			return LOCAL_ENTRY_ERROR;
+		}
+
+		if (! _archive_read_data_to_fd (a, fd, archive, error)) {
+			close (fd);
+			return LOCAL_ENTRY_ERROR;
+		}
+
+		_local_file_set_attributes_from_entry (fd, entry, extract_data);
+
+		if (close (fd) != 0) {
+			*error = _g_error_new_from_errno (errno);
+			return LOCAL_ENTRY_ERROR;
+		}
+		break;
+
+	case AE_IFLNK:
+		if ((symlinkat (archive_entry_symlink (entry), folder_fd, name) != 0)
+		    && ((errno != EEXIST)
+			|| (unlinkat (folder_fd, name, 0) != 0)
+			|| (symlinkat (archive_entry_symlink (entry), folder_fd, name) != 0)))
+		{
+			*error = _g_error_new_from_errno (errno);
+			return LOCAL_ENTRY_ERROR;
+		}
+		archive_read_data_skip (a);
+		break;
+
+	default:
+		archive_read_data_skip (a);
+		break;
+	}
+
+	return LOCAL_ENTRY_EXTRACTED;
+}
+
+
+/* -- RemoteWriter -- */
+
+
+/* Writes the small files to a remote destination from a pool of threads,
+ * this way the extraction doesn't wait for a network round trip after
+ * each file.  Bigger files are streamed by the extraction thread. */
+
+
+#define REMOTE_WRITER_MAX_FILE_SIZE (1024 * 1024)
+#define REMOTE_WRITER_N_THREADS 8
+#define REMOTE_WRITER_MAX_PENDING (REMOTE_WRITER_N_THREADS * 2)
+
+
+typedef struct {
+	GThreadPool  *pool;
+	GMutex        mutex;
+	GCond         cond;
+	GCancellable *cancellable;
+	GHashTable   *pending_files;
+	GError       *error;
+} RemoteWriter;
+
+
+typedef struct {
+	GFile  *file;
+	GBytes *content;
+} RemoteWrite;
+
+
+static void
+remote_writer_write_file (gpointer data,
+			  gpointer user_data)
+{
+	RemoteWrite  *remote_write = data;
+	RemoteWriter *writer = user_data;
+	GError       *error = NULL;
+	gboolean      skip;
+
+	g_mutex_lock (&writer->mutex);
+	skip = (writer->error != NULL);
+	g_mutex_unlock (&writer->mutex);
+
+	if (! skip)
+		g_file_replace_contents (remote_write->file,
+					 g_bytes_get_data (remote_write->content, NULL),
+					 g_bytes_get_size (remote_write->content),
+					 NULL,
+					 FALSE,
+					 G_FILE_CREATE_REPLACE_DESTINATION,
+					 NULL,
+					 writer->cancellable,
+					 &error);
+
+	g_mutex_lock (&writer->mutex);
+	if ((error != NULL) && (writer->error == NULL))
+		writer->error = g_error_copy (error);
+	g_hash_table_remove (writer->pending_files, remote_write->file);
+	g_cond_broadcast (&writer->cond);
+	g_mutex_unlock (&writer->mutex);
+
+	_g_error_free (error);
+	g_object_unref (remote_write->file);
+	g_bytes_unref (remote_write->content);
+	g_free (remote_write);
+}
+
+
+static RemoteWriter *
+remote_writer_new (GCancellable *cancellable)
+{
+	RemoteWriter *writer;
+
+	writer = g_new0 (RemoteWriter, 1);
+	writer->pool = g_thread_pool_new (remote_writer_write_file, writer, REMOTE_WRITER_N_THREADS, FALSE, NULL);
+	g_mutex_init (&writer->mutex);
+	g_cond_init (&writer->cond);
+	writer->cancellable = _g_object_ref (cancellable);
+	writer->pending_files = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
+	writer->error = NULL;
+
+	return writer;
+}
+
+
+/* Waits for the pending writes and returns the first error. */
+static gboolean
+remote_writer_flush (RemoteWriter  *writer,
+		     GError       **error)
+{
+	gboolean success;
+
+	g_mutex_lock (&writer->mutex);
+	while (g_hash_table_size (writer->pending_files) > 0)
+		g_cond_wait (&writer->cond, &writer->mutex);
+	success = (writer->error == NULL);
+	if (! success && (error != NULL))
+		*error = g_error_copy (writer->error);
+	g_mutex_unlock (&writer->mutex);
+
+	return success;
+}
+
+
+static void
+remote_writer_free (RemoteWriter *writer)
+{
+	g_mutex_lock (&writer->mutex);
+	if (writer->error == NULL)
+		writer->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED, "");
+	g_mutex_unlock (&writer->mutex);
+
+	/* the queued files are skipped because of the error set above */
+	g_thread_pool_free (writer->pool, FALSE, TRUE);
+	g_hash_table_unref (writer->pending_files);
+	_g_object_unref (writer->cancellable);
+	_g_error_free (writer->error);
+	g_mutex_clear (&writer->mutex);
+	g_cond_clear (&writer->cond);
+	g_free (writer);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (RemoteWriter, remote_writer_free)
+
+
+/* Waits for a previous write of @file to finish, used when an archive
+ * contains the same file more than once. */
+static void
+remote_writer_wait_for_file (RemoteWriter *writer,
+			     GFile        *file)
+{
+	g_mutex_lock (&writer->mutex);
+	while (g_hash_table_contains (writer->pending_files, file))
+		g_cond_wait (&writer->cond, &writer->mutex);
+	g_mutex_unlock (&writer->mutex);
+}
+
+
+static gboolean
+remote_writer_write (RemoteWriter  *writer,
+		     GFile         *file,
+		     GBytes        *content,
+		     GError       **error)
+{
+	RemoteWrite *remote_write;
+
+	g_mutex_lock (&writer->mutex);
+	while ((writer->error == NULL) && (g_hash_table_size (writer->pending_files) >= REMOTE_WRITER_MAX_PENDING))
+		g_cond_wait (&writer->cond, &writer->mutex);
+	if (writer->error != NULL) {
+		if (error != NULL)
+			*error = g_error_copy (writer->error);
+		g_mutex_unlock (&writer->mutex);
+		return FALSE;
+	}
+	g_hash_table_add (writer->pending_files, g_object_ref (file));
+	g_mutex_unlock (&writer->mutex);
+
+	remote_write = g_new0 (RemoteWrite, 1);
+	remote_write->file = g_object_ref (file);
+	remote_write->content = g_bytes_ref (content);
+	g_thread_pool_push (writer->pool, remote_write, NULL);
+
+	return TRUE;
+}
+
+
+static void
+extract_archive_thread (GSimpleAsyncResult *result,
+			GObject            *object,
+			GCancellable       *cancellable)
+{
+	g_autoptr (ExtractData) extract_data = NULL;
+	LoadData             *load_data;
+	g_autoptr (GHashTable) checked_folders = NULL;
+	g_autoptr (GHashTable) created_files = NULL;
+	g_autoptr (GHashTable) folders_created_during_extraction = NULL;
+	g_autoptr (GHashTable) symlinks = NULL;
+	g_autoptr (_archive_read_ctx) a = NULL;
+	g_autoptr (RemoteWriter) remote_writer = NULL;
+	g_autoptr (LocalWriter) local_writer = NULL;
+	struct archive_entry *entry;
+	int                   r;
+	gint64                trace_begin;
+
+	trace_begin = fr_trace_begin ();
+	extract_data = g_simple_async_result_get_op_res_gpointer (result);
+	load_data = LOAD_DATA (extract_data);
+
+#ifdef HAVE_ZLIB
+	{
+		FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
+		GzipIndexPoint *point = NULL;
+		gint64          offset = 0;
+
+		/* start from the access point nearest to the files to extract */
+
+		if ((private->gzip_index != NULL)
+		    && (private->gzip_index->file_size == _g_file_get_size (fr_archive_get_file (load_data->archive), cancellable)))
+		{
+			g_autoptr (GList) files = NULL;
+
+			/* the hard link targets are read as well */
+			files = g_list_concat (g_hash_table_get_keys (extract_data->link_targets), g_list_copy (extract_data->file_list));
+			point = gzip_index_get_point (private->gzip_index, (extract_data->file_list != NULL) ? files : NULL, &offset);
+
+			/* search the access points while extracting from the
+			 * start for the first time, the following selective
+			 * extractions can use them */
+
+			if ((point == NULL)
+			    && (extract_data->file_list != NULL)
+			    && ! private->gzip_index->indexed)
+			{
+				load_data->gzip_index_builder = gzip_index_builder_new (private->gzip_index, private->uncompressed_size);
+			}
+		}
+
+		if (point != NULL)
+			r = create_gzip_seek_read_object (load_data, point, offset, &a);
+		else
+			r = create_read_object (load_data, &a);
+	}
+#else
+	r = create_read_object (load_data, &a);
+#endif
+	if (r != ARCHIVE_OK) {
+		return;
+	}
+
+	if (g_file_is_native (extract_data->destination))
+		local_writer = local_writer_new (extract_data->destination, load_data->archive);
+	else
+		remote_writer = remote_writer_new (cancellable);
+
+	checked_folders = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
+	created_files = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, g_object_unref);
+	folders_created_during_extraction = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
+	symlinks = g_hash_table_new_full (g_file_hash, (GEqualFunc) g_file_equal, g_object_unref, NULL);
+	fr_archive_progress_set_total_files (load_data->archive, extract_data->n_files_to_extract);
+
+	while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
+		const char    *pathname;
+		g_autofree char * fullpath = NULL;
+		const char    *relative_path;
+		g_autoptr (GFile) file = NULL;
+		g_autoptr (GFile) parent = NULL;
+		g_autoptr (GOutputStream) ostream = NULL;
+		const void    *buffer;
+		size_t         buffer_size;
+		int64_t target_offset = 0;
+		int64_t actual_offset = 0;
+		GError        *local_error = NULL;
+		__LA_MODE_T    filetype;
+		gint64         entry_trace_begin;
+
+		if (g_cancellable_is_cancelled (cancellable))
+			break;
+
+		pathname = archive_entry_pathname (entry);
+		if (! extract_data_get_extraction_requested (extract_data, pathname)) {
+			const char *link_pathname = g_hash_table_lookup (extract_data->link_targets, pathname);
+
+			if (link_pathname == NULL) {
+				archive_read_data_skip (a);
+				continue;
+			}
+			archive_entry_set_pathname (entry, link_pathname);
+			pathname = archive_entry_pathname (entry);
+		}
+		else if (archive_entry_hardlink (entry) != NULL) {
+			const char *link_pathname = g_hash_table_lookup (extract_data->link_targets, archive_entry_hardlink (entry));
+
+			if (g_strcmp0 (link_pathname, pathname) == 0) {
+				/* already extracted with the data of the target */
+				archive_read_data_skip (a);
+				fr_archive_progress_inc_completed_files (load_data->archive, 1);
+				if (--extract_data->n_files_to_extract == 0) {
+					r = ARCHIVE_EOF;
+					break;
+				}
+				continue;
+			}
+			if (link_pathname != NULL)
+				archive_entry_set_hardlink (entry, link_pathname);
+		}
+
+		fullpath = (*pathname == '/') ? g_strdup (pathname) : g_strconcat ("/", pathname, NULL);
+		relative_path = _g_path_get_relative_basename_safe (fullpath, extract_data->base_dir, extract_data->junk_paths);
+		if (relative_path == NULL) {
+			fr_archive_progress_inc_completed_files (load_data->archive, 1);
+			fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
+			archive_read_data_skip (a);
+			continue;
+		}
+
+		if (local_writer != NULL) {
+			LocalEntryResult result;
+
+			entry_trace_begin = fr_trace_begin ();
+			result = local_writer_extract_entry (local_writer, a, entry, relative_path, extract_data, created_files, &load_data->error);
+			fr_trace_end (entry_trace_begin, "extract", "entry", relative_path, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : -1);
+			if (result == LOCAL_ENTRY_ERROR)
+				break;
+
+			if (result == LOCAL_ENTRY_IGNORED) {
+				g_warning ("Skipping '%s' file as it has symlink in parents.", relative_path);
+				fr_archive_progress_inc_completed_files (load_data->archive, 1);
+			}
+
+			if (result != LOCAL_ENTRY_EXTRACTED) {
+				fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
+				archive_read_data_skip (a);
+				if (result == LOCAL_ENTRY_IGNORED)
+					continue;
+			}
+
+			if ((extract_data->file_list != NULL) && (--extract_data->n_files_to_extract == 0)) {
+				r = ARCHIVE_EOF;
+				break;
+			}
+
+			continue;
+		}
+
+		/* Symlinks in parents are dangerous as it can easily happen
+		 * that files are written outside of the destination. The tar
+		 * cmd fails to extract such archives with ENOTDIR. Let's skip
+		 * those files here for sure. This is most probably malicious,
+		 * or corrupted archive.
+		 */
+		if (_g_file_contains_symlinks_in_path (relative_path, extract_data->destination, symlinks)) {
+			g_warning ("Skipping '%s' file as it has symlink in parents.", relative_path);
+			fr_archive_progress_inc_completed_files (load_data->archive, 1);
+			fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
+			archive_read_data_skip (a);
+			continue;
+		}
+
+		file = g_file_get_child (extract_data->destination, relative_path);
+		if (remote_writer != NULL)
+			remote_writer_wait_for_file (remote_writer, file);
+
+		/* honor the skip_older and overwrite options */
+
+		if ((g_hash_table_lookup (folders_created_during_extraction, file) == NULL)
+		    && (extract_data->skip_older || ! extract_data->overwrite))
+		{
+			gboolean exists = FALSE;
+			gint64   mtime = 0;
+
+			if (extract_data->destination_scan == NULL)
+				extract_data->destination_scan = destination_scan_new (extract_data->destination, cancellable);
+
+			if (! destination_scan_lookup (extract_data->destination_scan, relative_path, &exists, &mtime, &load_data->error))
+				break;
+
+			if (exists) {
+				gboolean skip = FALSE;
+
+				if (! extract_data->overwrite) {
+					skip = TRUE;
+				}
+				else if (extract_data->skip_older) {
+					if (archive_entry_mtime (entry) < mtime)
+						skip = TRUE;
+				}
+
+				if (skip) {
+					archive_read_data_skip (a);
+					fr_archive_progress_inc_completed_bytes (load_data->archive, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : 0);
+
+					if ((extract_data->file_list != NULL) && (--extract_data->n_files_to_extract == 0)) {
+						r = ARCHIVE_EOF;
+						break;
+					}
+
+					continue;
+				}
+			}
+		}
+
+		fr_archive_progress_inc_completed_files (load_data->archive, 1);
+
+		/* create the file parents */
+
+		parent = g_file_get_parent (file);
+
+		if ((parent != NULL)
+		    && (g_hash_table_lookup (checked_folders, parent) == NULL)
+		    && ! g_file_query_exists (parent, cancellable))
+		{
+			if (! _g_file_make_directory_with_parents (parent,
 								   folders_created_during_extraction,
 								   cancellable,
 								   &local_error))
 			{
-				if (! g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-					load_data->error = local_error;
-				else
-					g_clear_error (&local_error);
+				if (! g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+					load_data->error = local_error;
+				else
+					g_clear_error (&local_error);
+			}
+
+			if (load_data->error == NULL) {
+				GFile *grandparent;
+
+				grandparent = g_object_ref (parent);
+				while (grandparent != NULL) {
+					if (g_hash_table_lookup (checked_folders, grandparent) == NULL)
+						g_hash_table_insert (checked_folders, grandparent, GINT_TO_POINTER (1));
+					grandparent = g_file_get_parent (grandparent);
+				}
+			}
+		}
+
+		/* create the file */
+
+		filetype = archive_entry_filetype (entry);
+		entry_trace_begin = fr_trace_begin ();
+
+		if (load_data->error == NULL) {
+			const char  *linkname;
+
+			linkname = archive_entry_hardlink (entry);
+			if (linkname != NULL) {
+				g_autofree char *link_fullpath = NULL;
+				const char *relative_path;
+				g_autoptr (GFile) link_file = NULL;
+				g_autofree char *oldname = NULL;
+				g_autofree char *newname = NULL;
+				int          r;
+
+				link_fullpath = (*linkname == '/') ? g_strdup (linkname) : g_strconcat ("/", linkname, NULL);
+				relative_path = _g_path_get_relative_basename_safe (link_fullpath, extract_data->base_dir, extract_data->junk_paths);
+				if (relative_path == NULL) {
+					archive_read_data_skip (a);
+					continue;
+				}
+
+				link_file = g_file_get_child (extract_data->destination, relative_path);
+				oldname = g_file_get_path (link_file);
+				newname = g_file_get_path (file);
+
+				if ((oldname != NULL) && (newname != NULL))
+					r = link (oldname, newname);
+				else
+					r = -1;
+
+				if (r == 0) {
+					__LA_INT64_T filesize;
+
+					if (archive_entry_size_is_set (entry))
+						filesize = archive_entry_size (entry);
+					else
+						filesize = -1;
+
+					if (filesize > 0)
+						filetype = AE_IFREG; /* treat as a regular file to save the data */
+				}
+				else {
+					g_autofree char *uri = g_file_get_uri (file);
+					g_autofree char *msg = g_strdup_printf ("Could not create the hard link %s", uri);
+					load_data->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, msg);
+				}
+			}
+		}
+
+		if (load_data->error == NULL) {
+			switch (filetype) {
+			case AE_IFDIR:
+				if (! g_file_make_directory (file, cancellable, &local_error)) {
+					if (! g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
+						load_data->error = g_error_copy (local_error);
+					g_clear_error (&local_error);
+				}
+				if (load_data->error == NULL)
+					g_hash_table_insert (created_files, g_object_ref (file), _g_file_info_create_from_entry (entry, extract_data));
+				archive_read_data_skip (a);
+				break;
+
+			case AE_IFREG:
+				if ((remote_writer != NULL)
+				    && archive_entry_size_is_set (entry)
+				    && (archive_entry_size (entry) <= REMOTE_WRITER_MAX_FILE_SIZE))
+				{
+					g_autoptr (GBytes) content = NULL;
+
+					content = _archive_read_entry_data (a, &load_data->error);
+					if (content == NULL)
+						break;
+
+					fr_archive_progress_inc_completed_bytes (load_data->archive, g_bytes_get_size (content));
+					if (remote_writer_write (remote_writer, file, content, &load_data->error))
+						g_hash_table_insert (created_files, g_object_ref (file), _g_file_info_create_from_entry (entry, extract_data));
+					break;
+				}
+
+				ostream = (GOutputStream *) g_file_replace (file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, cancellable, &load_data->error);
+				if (ostream == NULL)
+					break;
+
+				while ((r = archive_read_data_block (a, &buffer, &buffer_size, &target_offset)) == ARCHIVE_OK) {
+					gsize bytes_written;
+
+					if (target_offset > actual_offset) {
+						if (! _g_output_stream_add_padding (extract_data, ostream, target_offset, actual_offset, FALSE, cancellable, &load_data->error))
+							break;
+						fr_archive_progress_inc_completed_bytes (load_data->archive, target_offset - actual_offset);
+						actual_offset = target_offset;
+					}
+
+					if (! g_output_stream_write_all (ostream, buffer, buffer_size, &bytes_written, cancellable, &load_data->error))
+						break;
+
+					actual_offset += bytes_written;
+					fr_archive_progress_inc_completed_bytes (load_data->archive, bytes_written);
+				}
+
+				if ((r == ARCHIVE_EOF) && (target_offset > actual_offset))
+					_g_output_stream_add_padding (extract_data, ostream, target_offset, actual_offset, TRUE, cancellable, &load_data->error);
+
+				if (r != ARCHIVE_EOF)
+					load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
+				else
+					g_hash_table_insert (created_files, g_object_ref (file), _g_file_info_create_from_entry (entry, extract_data));
+				break;
+
+			case AE_IFLNK:
+				if (! g_file_make_symbolic_link (file, archive_entry_symlink (entry), cancellable, &local_error)) {
+					if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+						g_clear_error (&local_error);
+						if (g_file_delete (file, cancellable, &local_error)) {
+							g_clear_error (&local_error);
+							if (! g_file_make_symbolic_link (file, archive_entry_symlink (entry), cancellable, &local_error))
+								load_data->error = g_error_copy (local_error);
+						}
+						else
+							load_data->error = g_error_copy (local_error);
+					}
+					else
+						load_data->error = g_error_copy (local_error);
+					g_clear_error (&local_error);
+				}
+				if (load_data->error == NULL)
+					g_hash_table_add (symlinks, g_object_ref (file));
+				archive_read_data_skip (a);
+				break;
+
+			default:
+				archive_read_data_skip (a);
+				break;
+			}
+		}
+
+		fr_trace_end (entry_trace_begin, "extract", "entry", relative_path, archive_entry_size_is_set (entry) ? archive_entry_size (entry) : -1);
+
+		if (load_data->error != NULL)
+			break;
+
+		if (extract_data->destination_scan != NULL)
+			destination_scan_add_file (extract_data->destination_scan, relative_path);
+
+		if ((extract_data->file_list != NULL) && (--extract_data->n_files_to_extract == 0)) {
+			r = ARCHIVE_EOF;
+			break;
+		}
+	}
+
+#ifdef HAVE_ZLIB
+	/* the access points found before stopping are valid as well */
+	if (load_data->gzip_index_builder != NULL) {
+		gzip_index_builder_finish (load_data->gzip_index_builder);
+		load_data->gzip_index_builder = NULL;
+	}
+#endif
+
+	if ((local_writer != NULL) && (load_data->error == NULL)) {
+		gint64 flush_trace_begin = fr_trace_begin ();
+		local_writer_flush (local_writer, &load_data->error);
+		fr_trace_end (flush_trace_begin, "extract", "flush", NULL, -1);
+	}
+	if ((remote_writer != NULL) && (load_data->error == NULL)) {
+		gint64 flush_trace_begin = fr_trace_begin ();
+		remote_writer_flush (remote_writer, &load_data->error);
+		fr_trace_end (flush_trace_begin, "extract", "flush", NULL, -1);
+	}
+	if (load_data->error == NULL) {
+		gint64 attributes_trace_begin = fr_trace_begin ();
+		restore_original_file_attributes (created_files, cancellable);
+		fr_trace_end (attributes_trace_begin, "extract", "restore-attributes", NULL, -1);
+	}
+
+	if ((load_data->error == NULL) && (r != ARCHIVE_EOF))
+		load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
+	if (load_data->error == NULL)
+		g_cancellable_set_error_if_cancelled (cancellable, &load_data->error);
+	if (load_data->error != NULL)
+		g_simple_async_result_set_from_error (result, load_data->error);
+
+	_fr_trace_end_archive (trace_begin, "extract", load_data->archive, -1);
+}
+
+
+static void
+fr_archive_libarchive_extract_files (FrArchive           *archive,
+				     GList               *file_list,
+				     GFile               *destination,
+				     const char          *base_dir,
+				     gboolean             skip_older,
+				     gboolean             overwrite,
+				     gboolean             junk_paths,
+				     const char          *password,
+				     GCancellable        *cancellable,
+				     GAsyncReadyCallback  callback,
+				     gpointer             user_data)
+{
+	FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (archive));
+	ExtractData *extract_data;
+	LoadData    *load_data;
+	GList       *scan;
+
+	extract_data = g_new0 (ExtractData, 1);
+
+	load_data = LOAD_DATA (extract_data);
+	load_data->archive = g_object_ref (archive);
+	load_data->cancellable = _g_object_ref (cancellable);
+	load_data->result = g_simple_async_result_new (G_OBJECT (archive),
+						       callback,
+						       user_data,
+						       fr_archive_extract);
+	load_data->buffer_size = BUFFER_SIZE;
+	load_data->buffer = g_new (char, load_data->buffer_size);
+
+	extract_data->file_list = _g_string_list_dup (file_list);
+	extract_data->destination = g_object_ref (destination);
+	extract_data->base_dir = g_strdup (base_dir);
+	extract_data->skip_older = skip_older;
+	extract_data->overwrite = overwrite;
+	extract_data->junk_paths = junk_paths;
+	extract_data->files_to_extract = g_hash_table_new (g_str_hash, g_str_equal);
+	extract_data->n_files_to_extract = 0;
+	extract_data->usernames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	extract_data->groupnames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	for (scan = extract_data->file_list; scan; scan = scan->next) {
+		g_hash_table_insert (extract_data->files_to_extract, scan->data, GINT_TO_POINTER (1));
+		extract_data->n_files_to_extract++;
+	}
+
+	/* the data of a hard link is stored with its target, when the target
+	 * is not requested it's extracted with the name of the first link */
+
+	extract_data->link_targets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	if ((extract_data->file_list != NULL) && (private->hardlinks != NULL)) {
+		for (scan = extract_data->file_list; scan; scan = scan->next) {
+			char *target = g_hash_table_lookup (private->hardlinks, scan->data);
+
+			if ((target != NULL)
+			    && (g_hash_table_lookup (extract_data->files_to_extract, target) == NULL)
+			    && (g_hash_table_lookup (extract_data->link_targets, target) == NULL))
+			{
+				g_hash_table_insert (extract_data->link_targets, g_strdup (target), scan->data);
+				extract_data->n_files_to_extract++;
 			}
+		}
+	}
 
-			if (load_data->error == NULL) {
-				GFile *grandparent;
+	/* start listing the destination folders while the archive is read,
+	 * local destinations are checked with a fstatat for each file */
 
-				grandparent = g_object_ref (parent);
-				while (grandparent != NULL) {
-					if (g_hash_table_lookup (checked_folders, grandparent) == NULL)
-						g_hash_table_insert (checked_folders, grandparent, GINT_TO_POINTER (1));
-					grandparent = g_file_get_parent (grandparent);
-				}
+	if ((skip_older || ! overwrite) && ! g_file_is_native (destination)) {
+		extract_data->destination_scan = destination_scan_new (destination, cancellable);
+
+		if (extract_data->file_list != NULL) {
+			for (scan = extract_data->file_list; scan; scan = scan->next) {
+				g_autofree char *fullpath = g_strconcat ("/", (char *) scan->data, NULL);
+				const char      *relative_path;
+
+				relative_path = _g_path_get_relative_basename_safe (fullpath, base_dir, junk_paths);
+				if (relative_path != NULL)
+					destination_scan_add_path (extract_data->destination_scan, relative_path);
 			}
 		}
+		else {
+			guint i;
 
-		/* create the file */
+			for (i = 0; i < archive->files->len; i++) {
+				FrFileData *file_data = g_ptr_array_index (archive->files, i);
+				const char *relative_path;
 
-		filetype = archive_entry_filetype (entry);
+				relative_path = _g_path_get_relative_basename_safe (file_data->full_path, base_dir, junk_paths);
+				if (relative_path != NULL)
+					destination_scan_add_path (extract_data->destination_scan, relative_path);
+			}
+		}
+	}
 
-		if (load_data->error == NULL) {
-			const char  *linkname;
+	g_simple_async_result_set_op_res_gpointer (load_data->result, extract_data, NULL);
+	g_simple_async_result_run_in_thread (load_data->result,
+					     extract_archive_thread,
+					     G_PRIORITY_DEFAULT,
+					     cancellable);
+}
 
-			linkname = archive_entry_hardlink (entry);
-			if (linkname != NULL) {
-				g_autofree char *link_fullpath = NULL;
-				const char *relative_path;
-				g_autoptr (GFile) link_file = NULL;
-				g_autofree char *oldname = NULL;
-				g_autofree char *newname = NULL;
-				int          r;
 
-				link_fullpath = (*linkname == '/') ? g_strdup (linkname) : g_strconcat ("/", linkname, NULL);
-				relative_path = _g_path_get_relative_basename_safe (link_fullpath, extract_data->base_dir, extract_data->junk_paths);
-				if (relative_path == NULL) {
-					archive_read_data_skip (a);
-					continue;
-				}
+/* -- test_integrity -- */
 
-				link_file = g_file_get_child (extract_data->destination, relative_path);
-				oldname = g_file_get_path (link_file);
-				newname = g_file_get_path (file);
 
-				if ((oldname != NULL) && (newname != NULL))
-					r = link (oldname, newname);
-				else
-					r = -1;
+#define TEST_MAX_WORKERS 8
 
-				if (r == 0) {
-					__LA_INT64_T filesize;
 
-					if (archive_entry_size_is_set (entry))
-						filesize = archive_entry_size (entry);
-					else
-						filesize = -1;
+typedef struct {
+	FrArchive          *archive;
+	GCancellable       *cancellable;
+	GSimpleAsyncResult *result;
+	char               *password;
+	int                 n_workers;
+	GMutex              mutex;
+	GList              *output;
+	int                 n_files;
+	int                 n_damaged;
+	goffset             tested_bytes;
+	GError             *error;
+} TestData;
 
-					if (filesize > 0)
-						filetype = AE_IFREG; /* treat as a regular file to save the data */
-				}
-				else {
-					g_autofree char *uri = g_file_get_uri (file);
-					g_autofree char *msg = g_strdup_printf ("Could not create the hard link %s", uri);
-					load_data->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_FAILED, msg);
-				}
-			}
+
+typedef struct {
+	TestData *test_data;
+	int       worker;
+} TestWorker;
+
+
+static void
+test_data_free (TestData *test_data)
+{
+	_g_object_unref (test_data->archive);
+	_g_object_unref (test_data->cancellable);
+	_g_object_unref (test_data->result);
+	g_free (test_data->password);
+	g_mutex_clear (&test_data->mutex);
+	g_list_free_full (test_data->output, g_free);
+	if (test_data->error != NULL)
+		g_error_free (test_data->error);
+	g_free (test_data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TestData, test_data_free)
+
+
+static void
+test_data_add_failure (TestData   *test_data,
+		       const char *pathname,
+		       const char *message)
+{
+	if (message == NULL)
+		message = "Fatal error";
+
+	g_mutex_lock (&test_data->mutex);
+	test_data->n_damaged++;
+	if (pathname != NULL)
+		test_data->output = g_list_prepend (test_data->output, g_strdup_printf ("%s: %s", pathname, message));
+	else
+		test_data->output = g_list_prepend (test_data->output, g_strdup (message));
+	g_mutex_unlock (&test_data->mutex);
+}
+
+
+/* Reads the data of the entries assigned to the worker and discards it,
+ * the format readers verify the checksums while decoding.  The other
+ * entries are skipped, which is a seek for the seekable formats. */
+static gpointer
+test_worker_run (gpointer user_data)
+{
+	TestWorker *worker = user_data;
+	TestData   *test_data = worker->test_data;
+	g_autoptr (LoadData) load_data = NULL;
+	g_autoptr (_archive_read_ctx) a = NULL;
+	struct archive_entry *entry;
+	int                   n_files = 0;
+	int                   index = 0;
+	int                   r;
+	gboolean              data_error = FALSE;
+	gint64                trace_begin;
+	gint64                tested_bytes = 0;
+
+	trace_begin = fr_trace_begin ();
+	load_data = g_new0 (LoadData, 1);
+	load_data_init (load_data);
+	load_data->archive = g_object_ref (test_data->archive);
+	load_data->cancellable = _g_object_ref (test_data->cancellable);
+	load_data->result = g_object_ref (test_data->result);
+	load_data->password = g_strdup (test_data->password);
+
+	r = create_read_object (load_data, &a);
+	if (r != ARCHIVE_OK) {
+		g_mutex_lock (&test_data->mutex);
+		if (test_data->error == NULL) {
+			if (load_data->error != NULL)
+				test_data->error = g_error_copy (load_data->error);
+			else
+				test_data->error = _g_error_new_from_archive_error (archive_error_string (a));
 		}
+		g_mutex_unlock (&test_data->mutex);
+		return NULL;
+	}
 
-		if (load_data->error == NULL) {
-			switch (filetype) {
-			case AE_IFDIR:
-				if (! g_file_make_directory (file, cancellable, &local_error)) {
-					if (! g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS))
-						load_data->error = g_error_copy (local_error);
-					g_clear_error (&local_error);
-				}
-				if (load_data->error == NULL)
-					g_hash_table_insert (created_files, g_object_ref (file), _g_file_info_create_from_entry (entry, extract_data));
-				archive_read_data_skip (a);
+	while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK) {
+		const void *buffer;
+		size_t      buffer_size;
+		int64_t     offset;
+
+		if (g_cancellable_is_cancelled (test_data->cancellable))
+			break;
+
+		if (index++ % test_data->n_workers != worker->worker) {
+			archive_read_data_skip (a);
+			continue;
+		}
+
+		n_files++;
+		while ((r = archive_read_data_block (a, &buffer, &buffer_size, &offset)) == ARCHIVE_OK) {
+			tested_bytes += buffer_size;
+			g_mutex_lock (&test_data->mutex);
+			test_data->tested_bytes += buffer_size;
+			fr_archive_progress_inc_completed_bytes (test_data->archive, buffer_size);
+			g_mutex_unlock (&test_data->mutex);
+		}
+
+		if (r != ARCHIVE_EOF) {
+			test_data_add_failure (test_data, archive_entry_pathname (entry), archive_error_string (a));
+			if (r == ARCHIVE_FATAL) {
+				data_error = TRUE;
 				break;
+			}
+		}
+	}
+
+	/* every worker reads the same headers, report their errors once.  A
+	 * fatal error in the data was already reported with the file name. */
+
+	if ((r != ARCHIVE_EOF)
+	    && ! data_error
+	    && (worker->worker == 0)
+	    && (load_data->error == NULL)
+	    && ! g_cancellable_is_cancelled (test_data->cancellable))
+	{
+		test_data_add_failure (test_data, NULL, archive_error_string (a));
+	}
+
+	g_mutex_lock (&test_data->mutex);
+	test_data->n_files += n_files;
+	if ((test_data->error == NULL) && (load_data->error != NULL))
+		test_data->error = g_error_copy (load_data->error);
+	g_mutex_unlock (&test_data->mutex);
+
+	fr_trace_end (trace_begin, "test", "worker", NULL, tested_bytes);
+
+	return NULL;
+}
+
+
+static void
+test_archive_thread (GSimpleAsyncResult *result,
+		     GObject            *object,
+		     GCancellable       *cancellable)
+{
+	g_autoptr (TestData) test_data = NULL;
+	FrArchiveLibarchivePrivate *private;
+	TestWorker  workers[TEST_MAX_WORKERS];
+	GThread    *threads[TEST_MAX_WORKERS];
+	gint64      start_time;
+	gint64      trace_begin;
+	double      elapsed;
+	char       *size;
+	char       *speed;
+	int         i;
+
+	test_data = g_simple_async_result_get_op_res_gpointer (result);
+	private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (test_data->archive));
+
+	fr_archive_progress_set_total_bytes (test_data->archive, private->uncompressed_size);
+	start_time = g_get_monotonic_time ();
+	trace_begin = fr_trace_begin ();
+
+	for (i = 0; i < test_data->n_workers; i++) {
+		workers[i].test_data = test_data;
+		workers[i].worker = i;
+		if (i > 0)
+			threads[i] = g_thread_new ("fr-test", test_worker_run, &workers[i]);
+	}
+	test_worker_run (&workers[0]);
+	for (i = 1; i < test_data->n_workers; i++)
+		g_thread_join (threads[i]);
+	_fr_trace_end_archive (trace_begin, "test", test_data->archive, test_data->tested_bytes);
+
+	elapsed = (g_get_monotonic_time () - start_time) / (double) G_USEC_PER_SEC;
+	size = g_format_size (test_data->tested_bytes);
+	speed = g_format_size ((elapsed > 0) ? (guint64) (test_data->tested_bytes / elapsed) : 0);
+
+	test_data->output = g_list_sort (test_data->output, (GCompareFunc) g_strcmp0);
+	test_data->output = g_list_append (test_data->output,
+					   g_strdup_printf (_("Tested %d files, %s in %.1f seconds (%s/s)"),
+							    test_data->n_files,
+							    size,
+							    elapsed,
+							    speed));
+	g_free (speed);
+	g_free (size);
+
+	g_list_free_full (private->last_output, g_free);
+	private->last_output = test_data->output;
+	test_data->output = NULL;
+
+	if ((test_data->error == NULL) && (test_data->n_damaged > 0))
+		test_data->error = g_error_new (FR_ERROR,
+						FR_ERROR_COMMAND_ERROR,
+						ngettext ("%d error found", "%d errors found", test_data->n_damaged),
+						test_data->n_damaged);
+	if (test_data->error == NULL)
+		g_cancellable_set_error_if_cancelled (cancellable, &test_data->error);
+	if (test_data->error != NULL)
+		g_simple_async_result_set_from_error (result, test_data->error);
+}
+
+
+static void
+fr_archive_libarchive_test_integrity (FrArchive           *archive,
+				      const char          *password,
+				      GCancellable        *cancellable,
+				      GAsyncReadyCallback  callback,
+				      gpointer             user_data)
+{
+	TestData *test_data;
+
+	test_data = g_new0 (TestData, 1);
+	g_mutex_init (&test_data->mutex);
+	test_data->archive = g_object_ref (archive);
+	test_data->cancellable = _g_object_ref (cancellable);
+	test_data->result = g_simple_async_result_new (G_OBJECT (archive),
+						       callback,
+						       user_data,
+						       fr_archive_test);
+	test_data->password = g_strdup (password);
+
+	/* the entries of a zip archive can be reached with a seek, test
+	 * them in parallel; the other formats must be decoded in order. */
+
+	test_data->n_workers = 1;
+	if (_g_str_equal (fr_archive_get_mime_type (archive), "application/zip")
+	    || _g_str_equal (fr_archive_get_mime_type (archive), "application/x-cbz")
+	    || _g_str_equal (fr_archive_get_mime_type (archive), "application/epub+zip"))
+	{
+		test_data->n_workers = CLAMP (fr_get_n_threads (), 1, TEST_MAX_WORKERS);
+	}
+
+	fr_archive_set_stoppable (archive, TRUE);
+
+	g_simple_async_result_set_op_res_gpointer (test_data->result, test_data, NULL);
+	g_simple_async_result_run_in_thread (test_data->result,
+					     test_archive_thread,
+					     G_PRIORITY_DEFAULT,
+					     cancellable);
+}
+
+
+GList *
+fr_archive_libarchive_get_last_output (FrArchiveLibarchive *self)
+{
+	FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (self);
+
+	return private->last_output;
+}
+
+
+/* --  AddFile -- */
+
+
+typedef struct {
+	GFile     *file;
+	char      *pathname;
+	GFileInfo *info;         /* FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY, if already queried */
+	GBytes    *content;      /* loaded in advance by the FilePrefetcher */
+	gboolean   prefetched;
+} AddFile;
+
+
+static AddFile *
+add_file_new (GFile      *file,
+	      const char *archive_pathname,
+	      GFileInfo  *info)
+{
+	AddFile *add_file;
+
+	add_file = g_new0 (AddFile, 1);
+	add_file->file = g_object_ref (file);
+	add_file->pathname = g_strdup (archive_pathname);
+	add_file->info = _g_object_ref (info);
+	add_file->content = NULL;
+	add_file->prefetched = FALSE;
+
+	return add_file;
+}
+
+
+static void
+add_file_free (AddFile *add_file)
+{
+	g_object_unref (add_file->file);
+	g_free (add_file->pathname);
+	_g_object_unref (add_file->info);
+	if (add_file->content != NULL)
+		g_bytes_unref (add_file->content);
+	g_free (add_file);
+}
+
+
+/* -- FilePrefetcher -- */
+
+
+/* The archive is written by a single thread, in a deterministic order, but
+ * the content of the small files that will be written next is loaded in
+ * parallel, this way reading many small files doesn't stall the
+ * compressor.  Bigger files are read by the writer as usual. */
+
+
+#define PREFETCH_MAX_FILE_SIZE (1024 * 1024)
+#define PREFETCH_FILES_PER_THREAD 8
+
+
+typedef struct {
+	GThreadPool  *pool;
+	GMutex        mutex;
+	GCond         cond;
+	GCancellable *cancellable;
+	gboolean      follow_links;
+	guint         window;      /* maximum number of files loaded in advance */
+	GHashTable   *inodes;      /* the files with more links, if stored as hard links */
+} FilePrefetcher;
+
+
+/* Returns whether another link to the file of @info was already loaded,
+ * the other links are written as hard links without data. */
+static gboolean
+file_prefetcher_inode_seen (FilePrefetcher *prefetcher,
+			    GFileInfo      *info)
+{
+	g_autofree char *key = NULL;
+	gboolean         seen;
+
+	if ((prefetcher->inodes == NULL)
+	    || (g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_NLINK) <= 1))
+	{
+		return FALSE;
+	}
+
+	key = g_strdup_printf ("%u:%" G_GUINT64_FORMAT,
+			       g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE),
+			       g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE));
+
+	g_mutex_lock (&prefetcher->mutex);
+	seen = g_hash_table_contains (prefetcher->inodes, key);
+	if (! seen)
+		g_hash_table_add (prefetcher->inodes, g_steal_pointer (&key));
+	g_mutex_unlock (&prefetcher->mutex);
+
+	return seen;
+}
+
+
+static void
+file_prefetcher_load_file (gpointer data,
+			   gpointer user_data)
+{
+	AddFile               *add_file = data;
+	FilePrefetcher        *prefetcher = user_data;
+	g_autoptr (GFileInfo)  info = NULL;
+	GBytes                *content = NULL;
+
+	/* the info is kept for the writer, this way the file is queried
+	 * only once. */
+
+	if (add_file->info != NULL)
+		info = g_object_ref (add_file->info);
+	else if (! g_cancellable_is_cancelled (prefetcher->cancellable))
+		info = g_file_query_info (add_file->file,
+					  FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY,
+					  (! prefetcher->follow_links ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : 0),
+					  prefetcher->cancellable,
+					  NULL);
+
+	if ((info != NULL)
+	    && (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR)
+	    && (g_file_info_get_size (info) <= PREFETCH_MAX_FILE_SIZE)
+	    && ! file_prefetcher_inode_seen (prefetcher, info))
+	{
+		char  *buffer;
+		gsize  size;
+
+		if (g_file_load_contents (add_file->file, prefetcher->cancellable, &buffer, &size, NULL, NULL))
+			content = g_bytes_new_take (buffer, size);
+	}
+
+	g_mutex_lock (&prefetcher->mutex);
+	if (add_file->info == NULL)
+		add_file->info = g_steal_pointer (&info);
+	add_file->content = content;
+	add_file->prefetched = TRUE;
+	g_cond_broadcast (&prefetcher->cond);
+	g_mutex_unlock (&prefetcher->mutex);
+}
+
+
+static FilePrefetcher *
+file_prefetcher_new (gboolean      follow_links,
+		     gboolean      hardlinks,
+		     GCancellable *cancellable)
+{
+	FilePrefetcher *prefetcher;
+	guint           n_threads;
+
+	n_threads = fr_get_n_threads ();
+
+	prefetcher = g_new0 (FilePrefetcher, 1);
+	prefetcher->pool = g_thread_pool_new (file_prefetcher_load_file, prefetcher, n_threads, FALSE, NULL);
+	g_mutex_init (&prefetcher->mutex);
+	g_cond_init (&prefetcher->cond);
+	prefetcher->cancellable = _g_object_ref (cancellable);
+	prefetcher->follow_links = follow_links;
+	prefetcher->window = n_threads * PREFETCH_FILES_PER_THREAD;
+	prefetcher->inodes = hardlinks ? g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL) : NULL;
+
+	return prefetcher;
+}
+
+
+static void
+file_prefetcher_free (FilePrefetcher *prefetcher)
+{
+	/* discard the files not loaded yet and wait for the running jobs */
+	g_thread_pool_free (prefetcher->pool, TRUE, TRUE);
+	g_mutex_clear (&prefetcher->mutex);
+	g_cond_clear (&prefetcher->cond);
+	_g_object_unref (prefetcher->cancellable);
+	if (prefetcher->inodes != NULL)
+		g_hash_table_unref (prefetcher->inodes);
+	g_free (prefetcher);
+}
+
+
+/* Schedules the loading of @add_file, the files are loaded in the order
+ * they are added. */
+static void
+file_prefetcher_add (FilePrefetcher *prefetcher,
+		     AddFile        *add_file)
+{
+	g_thread_pool_push (prefetcher->pool, add_file, NULL);
+}
+
+
+/* Waits for @add_file to be loaded. */
+static void
+file_prefetcher_wait (FilePrefetcher *prefetcher,
+		      AddFile        *add_file)
+{
+	g_mutex_lock (&prefetcher->mutex);
+	while (! add_file->prefetched)
+		g_cond_wait (&prefetcher->cond, &prefetcher->mutex);
+	g_mutex_unlock (&prefetcher->mutex);
+}
+
+
+/* Releases the content of @add_file after it has been written. */
+static void
+file_prefetcher_done (FilePrefetcher *prefetcher,
+		      AddFile        *add_file)
+{
+	if (add_file->content != NULL) {
+		g_bytes_unref (add_file->content);
+		add_file->content = NULL;
+	}
+}
 
-			case AE_IFREG:
-				ostream = (GOutputStream *) g_file_replace (file, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, cancellable, &load_data->error);
-				if (ostream == NULL)
-					break;
 
-				while ((r = archive_read_data_block (a, &buffer, &buffer_size, &target_offset)) == ARCHIVE_OK) {
-					gsize bytes_written;
+#ifdef HAVE_ZLIB
 
-					if (target_offset > actual_offset) {
-						if (! _g_output_stream_add_padding (extract_data, ostream, target_offset, actual_offset, cancellable, &load_data->error))
-							break;
-						fr_archive_progress_inc_completed_bytes (load_data->archive, target_offset - actual_offset);
-						actual_offset = target_offset;
-					}
 
-					if (! g_output_stream_write_all (ostream, buffer, buffer_size, &bytes_written, cancellable, &load_data->error))
-						break;
+/* -- GzipWriter -- */
 
-					actual_offset += bytes_written;
-					fr_archive_progress_inc_completed_bytes (load_data->archive, bytes_written);
-				}
 
-				if ((r == ARCHIVE_EOF) && (target_offset > actual_offset))
-					_g_output_stream_add_padding (extract_data, ostream, target_offset, actual_offset, cancellable, &load_data->error);
+/* Compresses a gzip stream using all the processors: the data is split in
+ * blocks compressed in parallel, each block is a raw deflate stream primed
+ * with the end of the previous block and terminated by a sync flush, so
+ * the blocks can be joined in a single standard gzip member. */
 
-				if (r != ARCHIVE_EOF)
-					load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
-				else
-					g_hash_table_insert (created_files, g_object_ref (file), _g_file_info_create_from_entry (entry, extract_data));
-				break;
 
-			case AE_IFLNK:
-				if (! g_file_make_symbolic_link (file, archive_entry_symlink (entry), cancellable, &local_error)) {
-					if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
-						g_clear_error (&local_error);
-						if (g_file_delete (file, cancellable, &local_error)) {
-							g_clear_error (&local_error);
-							if (! g_file_make_symbolic_link (file, archive_entry_symlink (entry), cancellable, &local_error))
-								load_data->error = g_error_copy (local_error);
-						}
-						else
-							load_data->error = g_error_copy (local_error);
-					}
-					else
-						load_data->error = g_error_copy (local_error);
-					g_clear_error (&local_error);
-				}
-				if (load_data->error == NULL)
-					g_hash_table_add (symlinks, g_object_ref (file));
-				archive_read_data_skip (a);
-				break;
+#define GZIP_BLOCK_SIZE (256 * 1024)
+#define GZIP_DICTIONARY_SIZE (32 * 1024)
+#define GZIP_BLOCKS_PER_THREAD 2
+#define GZIP_OS_UNIX 3
 
-			default:
-				archive_read_data_skip (a);
-				break;
+
+typedef struct {
+	GBytes     *input;
+	GBytes     *dictionary;
+	gboolean    last;
+	int         level;
+	GByteArray *output;
+	gulong      crc;
+	gboolean    done;
+} GzipBlock;
+
+
+static void
+gzip_block_free (GzipBlock *block)
+{
+	g_bytes_unref (block->input);
+	if (block->dictionary != NULL)
+		g_bytes_unref (block->dictionary);
+	if (block->output != NULL)
+		g_byte_array_unref (block->output);
+	g_free (block);
+}
+
+
+typedef struct {
+	GThreadPool *pool;
+	GMutex       mutex;
+	GCond        cond;
+	GQueue      *blocks;
+	guint        max_blocks;
+	int          level;
+	GByteArray  *buffer;
+	GBytes      *previous_input;
+	gulong       crc;
+	guint32      size;
+	gboolean     header_written;
+} GzipWriter;
+
+
+static void
+gzip_writer_compress_block (gpointer data,
+			    gpointer user_data)
+{
+	GzipBlock    *block = data;
+	GzipWriter   *writer = user_data;
+	z_stream      stream = { 0 };
+	const guchar *input;
+	gsize         input_size;
+	int           flush;
+	int           ret;
+
+	input = g_bytes_get_data (block->input, &input_size);
+	flush = block->last ? Z_FINISH : Z_SYNC_FLUSH;
+	block->output = g_byte_array_new ();
+	block->crc = crc32 (0L, input, input_size);
+
+	ret = deflateInit2 (&stream, block->level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	if (ret == Z_OK) {
+		if (block->dictionary != NULL) {
+			const guchar *dictionary;
+			gsize         dictionary_size;
+
+			dictionary = g_bytes_get_data (block->dictionary, &dictionary_size);
+			if (dictionary_size > GZIP_DICTIONARY_SIZE) {
+				dictionary += dictionary_size - GZIP_DICTIONARY_SIZE;
+				dictionary_size = GZIP_DICTIONARY_SIZE;
 			}
+			deflateSetDictionary (&stream, dictionary, dictionary_size);
 		}
 
-		if (load_data->error != NULL)
-			break;
+		stream.next_in = (Bytef *) input;
+		stream.avail_in = input_size;
+		g_byte_array_set_size (block->output, deflateBound (&stream, input_size) + 16);
+		stream.next_out = block->output->data;
+		stream.avail_out = block->output->len;
 
-		if ((extract_data->file_list != NULL) && (--extract_data->n_files_to_extract == 0)) {
-			r = ARCHIVE_EOF;
-			break;
+		for (;;) {
+			ret = deflate (&stream, flush);
+			if ((ret == Z_STREAM_ERROR) || (ret == Z_STREAM_END))
+				break;
+			if (stream.avail_out != 0)
+				break;
+
+			/* the output buffer is full, make it bigger */
+
+			g_byte_array_set_size (block->output, block->output->len * 2);
+			stream.next_out = block->output->data + stream.total_out;
+			stream.avail_out = block->output->len - stream.total_out;
 		}
+		g_byte_array_set_size (block->output, stream.total_out);
+		deflateEnd (&stream);
 	}
 
-	if (load_data->error == NULL)
-		restore_original_file_attributes (created_files, cancellable);
+	if ((ret != Z_OK) && (ret != Z_STREAM_END)) {
+		g_byte_array_unref (block->output);
+		block->output = NULL;
+	}
 
-	if ((load_data->error == NULL) && (r != ARCHIVE_EOF))
-		load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
-	if (load_data->error == NULL)
-		g_cancellable_set_error_if_cancelled (cancellable, &load_data->error);
-	if (load_data->error != NULL)
-		g_simple_async_result_set_from_error (result, load_data->error);
+	g_mutex_lock (&writer->mutex);
+	block->done = TRUE;
+	g_cond_broadcast (&writer->cond);
+	g_mutex_unlock (&writer->mutex);
+}
+
+
+static GzipWriter *
+gzip_writer_new (int level)
+{
+	GzipWriter *writer;
+	guint       n_threads;
+
+	n_threads = fr_get_n_threads ();
+
+	writer = g_new0 (GzipWriter, 1);
+	writer->pool = g_thread_pool_new (gzip_writer_compress_block, writer, n_threads, FALSE, NULL);
+	g_mutex_init (&writer->mutex);
+	g_cond_init (&writer->cond);
+	writer->blocks = g_queue_new ();
+	writer->max_blocks = n_threads * GZIP_BLOCKS_PER_THREAD;
+	writer->level = level;
+	writer->buffer = g_byte_array_sized_new (GZIP_BLOCK_SIZE);
+	writer->previous_input = NULL;
+	writer->crc = crc32 (0L, Z_NULL, 0);
+	writer->size = 0;
+	writer->header_written = FALSE;
+
+	return writer;
 }
 
 
 static void
-fr_archive_libarchive_extract_files (FrArchive           *archive,
-				     GList               *file_list,
-				     GFile               *destination,
-				     const char          *base_dir,
-				     gboolean             skip_older,
-				     gboolean             overwrite,
-				     gboolean             junk_paths,
-				     const char          *password,
-				     GCancellable        *cancellable,
-				     GAsyncReadyCallback  callback,
-				     gpointer             user_data)
+gzip_writer_free (GzipWriter *writer)
 {
-	ExtractData *extract_data;
-	LoadData    *load_data;
-	GList       *scan;
+	g_thread_pool_free (writer->pool, TRUE, TRUE);
+	g_queue_free_full (writer->blocks, (GDestroyNotify) gzip_block_free);
+	g_byte_array_unref (writer->buffer);
+	if (writer->previous_input != NULL)
+		g_bytes_unref (writer->previous_input);
+	g_mutex_clear (&writer->mutex);
+	g_cond_clear (&writer->cond);
+	g_free (writer);
+}
 
-	extract_data = g_new0 (ExtractData, 1);
 
-	load_data = LOAD_DATA (extract_data);
-	load_data->archive = g_object_ref (archive);
-	load_data->cancellable = _g_object_ref (cancellable);
-	load_data->result = g_simple_async_result_new (G_OBJECT (archive),
-						       callback,
-						       user_data,
-						       fr_archive_extract);
-	load_data->buffer_size = BUFFER_SIZE;
-	load_data->buffer = g_new (char, load_data->buffer_size);
+static void
+_gzip_writer_put_uint32 (guchar  *buffer,
+			 guint32  value)
+{
+	buffer[0] = value & 0xff;
+	buffer[1] = (value >> 8) & 0xff;
+	buffer[2] = (value >> 16) & 0xff;
+	buffer[3] = (value >> 24) & 0xff;
+}
 
-	extract_data->file_list = _g_string_list_dup (file_list);
-	extract_data->destination = g_object_ref (destination);
-	extract_data->base_dir = g_strdup (base_dir);
-	extract_data->skip_older = skip_older;
-	extract_data->overwrite = overwrite;
-	extract_data->junk_paths = junk_paths;
-	extract_data->files_to_extract = g_hash_table_new (g_str_hash, g_str_equal);
-	extract_data->n_files_to_extract = 0;
-	extract_data->usernames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-	extract_data->groupnames = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-	for (scan = extract_data->file_list; scan; scan = scan->next) {
-		g_hash_table_insert (extract_data->files_to_extract, scan->data, GINT_TO_POINTER (1));
-		extract_data->n_files_to_extract++;
+/* Writes the first block of the queue, waiting for it to be compressed. */
+static gboolean
+gzip_writer_write_next_block (GzipWriter     *writer,
+			      GOutputStream  *ostream,
+			      GCancellable   *cancellable,
+			      GError        **error)
+{
+	GzipBlock *block;
+	gboolean   success;
+
+	if (! writer->header_written) {
+		guchar header[10] = { 0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, GZIP_OS_UNIX };
+
+		if (! g_output_stream_write_all (ostream, header, sizeof (header), NULL, cancellable, error))
+			return FALSE;
+		writer->header_written = TRUE;
 	}
 
-	g_simple_async_result_set_op_res_gpointer (load_data->result, extract_data, NULL);
-	g_simple_async_result_run_in_thread (load_data->result,
-					     extract_archive_thread,
-					     G_PRIORITY_DEFAULT,
-					     cancellable);
+	block = g_queue_pop_head (writer->blocks);
+
+	g_mutex_lock (&writer->mutex);
+	while (! block->done)
+		g_cond_wait (&writer->cond, &writer->mutex);
+	g_mutex_unlock (&writer->mutex);
+
+	if (block->output == NULL) {
+		g_set_error_literal (error, FR_ERROR, FR_ERROR_COMMAND_ERROR, "gzip compression failed");
+		gzip_block_free (block);
+		return FALSE;
+	}
+
+	writer->crc = crc32_combine (writer->crc, block->crc, g_bytes_get_size (block->input));
+	writer->size += g_bytes_get_size (block->input);
+	success = g_output_stream_write_all (ostream, block->output->data, block->output->len, NULL, cancellable, error);
+	gzip_block_free (block);
+
+	return success;
 }
 
 
-/* --  AddFile -- */
+static gboolean
+gzip_writer_push_block (GzipWriter     *writer,
+			gboolean        last,
+			GOutputStream  *ostream,
+			GCancellable   *cancellable,
+			GError        **error)
+{
+	GzipBlock *block;
 
+	block = g_new0 (GzipBlock, 1);
+	block->input = g_byte_array_free_to_bytes (writer->buffer);
+	block->dictionary = writer->previous_input;
+	block->last = last;
+	block->level = writer->level;
+	block->output = NULL;
+	block->done = FALSE;
 
-typedef struct {
-	GFile *file;
-	char  *pathname;
-} AddFile;
+	writer->buffer = g_byte_array_sized_new (GZIP_BLOCK_SIZE);
+	writer->previous_input = g_bytes_ref (block->input);
 
+	g_queue_push_tail (writer->blocks, block);
+	g_thread_pool_push (writer->pool, block, NULL);
 
-static AddFile *
-add_file_new (GFile      *file,
-	      const char *archive_pathname)
+	/* limit the memory used by the blocks waiting to be written */
+
+	while (g_queue_get_length (writer->blocks) > writer->max_blocks)
+		if (! gzip_writer_write_next_block (writer, ostream, cancellable, error))
+			return FALSE;
+
+	return TRUE;
+}
+
+
+static gboolean
+gzip_writer_write (GzipWriter     *writer,
+		   const void     *buffer,
+		   gsize           size,
+		   GOutputStream  *ostream,
+		   GCancellable   *cancellable,
+		   GError        **error)
 {
-	AddFile *add_file;
+	const guchar *data = buffer;
 
-	add_file = g_new (AddFile, 1);
-	add_file->file = g_object_ref (file);
-	add_file->pathname = g_strdup (archive_pathname);
+	while (size > 0) {
+		gsize n;
 
-	return add_file;
+		n = MIN (size, GZIP_BLOCK_SIZE - writer->buffer->len);
+		g_byte_array_append (writer->buffer, data, n);
+		data += n;
+		size -= n;
+
+		if ((writer->buffer->len == GZIP_BLOCK_SIZE)
+		    && ! gzip_writer_push_block (writer, FALSE, ostream, cancellable, error))
+		{
+			return FALSE;
+		}
+	}
+
+	return TRUE;
 }
 
 
-static void
-add_file_free (AddFile *add_file)
+static gboolean
+gzip_writer_close (GzipWriter     *writer,
+		   GOutputStream  *ostream,
+		   GCancellable   *cancellable,
+		   GError        **error)
 {
-	g_object_unref (add_file->file);
-	g_free (add_file->pathname);
-	g_free (add_file);
+	guchar trailer[8];
+
+	if (! gzip_writer_push_block (writer, TRUE, ostream, cancellable, error))
+		return FALSE;
+
+	while (! g_queue_is_empty (writer->blocks))
+		if (! gzip_writer_write_next_block (writer, ostream, cancellable, error))
+			return FALSE;
+
+	_gzip_writer_put_uint32 (trailer, writer->crc);
+	_gzip_writer_put_uint32 (trailer + 4, writer->size);
+
+	return g_output_stream_write_all (ostream, trailer, sizeof (trailer), NULL, cancellable, error);
 }
 
 
+#endif /* HAVE_ZLIB */
+
+
 /* -- _fr_archive_libarchive_save -- */
 
 
@@ -1184,6 +4650,7 @@ struct _SaveData {
 	gboolean         encrypt_header;
 	FrCompression    compression;
 	guint            volume_size;
+	gboolean         discard;  /* don't create the archive */
 	void            *buffer;
 	gsize            buffer_size;
 	SaveDataFunc     begin_operation;
@@ -1192,6 +4659,10 @@ struct _SaveData {
 	gpointer         user_data;
 	GDestroyNotify   user_data_notify;
 	struct archive  *b;
+	struct archive_entry_linkresolver *link_resolver;
+#ifdef HAVE_ZLIB
+	GzipWriter      *gzip_writer;
+#endif
 };
 
 
@@ -1211,6 +4682,12 @@ save_data_free (SaveData *save_data)
 {
 	if (save_data->user_data_notify != NULL)
 		save_data->user_data_notify (save_data->user_data);
+#ifdef HAVE_ZLIB
+	if (save_data->gzip_writer != NULL)
+		gzip_writer_free (save_data->gzip_writer);
+#endif
+	if (save_data->link_resolver != NULL)
+		archive_entry_linkresolver_free (save_data->link_resolver);
 	g_free (save_data->buffer);
 	g_free (save_data->password);
 	g_hash_table_unref (save_data->groupnames);
@@ -1258,6 +4735,11 @@ save_data_write (struct archive *a,
 	if (load_data->error != NULL)
 		return -1;
 
+#ifdef HAVE_ZLIB
+	if (save_data->gzip_writer != NULL)
+		return gzip_writer_write (save_data->gzip_writer, buff, n, save_data->ostream, load_data->cancellable, &load_data->error) ? (ssize_t) n : -1;
+#endif
+
 	return g_output_stream_write (save_data->ostream, buff, n, load_data->cancellable, &load_data->error);
 }
 
@@ -1272,6 +4754,11 @@ save_data_close (struct archive *a,
 	if (save_data->ostream != NULL) {
 		GError *error = NULL;
 
+#ifdef HAVE_ZLIB
+		if ((save_data->gzip_writer != NULL) && (load_data->error == NULL))
+			gzip_writer_close (save_data->gzip_writer, save_data->ostream, load_data->cancellable, &load_data->error);
+#endif
+
 		g_output_stream_close (save_data->ostream, load_data->cancellable, &error);
 		if (load_data->error == NULL && error != NULL)
 			load_data->error = g_error_copy (error);
@@ -1279,7 +4766,14 @@ save_data_close (struct archive *a,
 		_g_error_free (error);
 	}
 
-	if (load_data->error == NULL)
+#ifdef HAVE_ZLIB
+	if (load_data->error == NULL) {
+		FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
+		g_clear_pointer (&private->gzip_index, gzip_index_free);
+	}
+#endif
+
+	if ((load_data->error == NULL) && ! save_data->discard)
 		g_file_move (save_data->tmp_file,
 			     fr_archive_get_file (load_data->archive),
 			     G_FILE_COPY_OVERWRITE | G_FILE_COPY_TARGET_DEFAULT_PERMS,
@@ -1294,6 +4788,9 @@ save_data_close (struct archive *a,
 }
 
 
+#define ZSTD_WRITER_FRAME_SIZE 8388608 /* 8 MiB */
+
+
 static void
 _archive_write_set_format_from_context (struct archive *a,
 					SaveData       *save_data)
@@ -1363,6 +4860,15 @@ _archive_write_set_format_from_context (struct archive *a,
 	else if (_g_str_equal (mime_type, "application/zip")
 	    || _g_str_equal (mime_type, "application/x-cbz")) {
 		archive_write_set_format_zip (a);
+#if (ARCHIVE_VERSION_NUMBER >= 3002000)
+		if ((save_data->password != NULL) && (*save_data->password != 0)) {
+			if ((archive_write_set_options (a, "zip:encryption=aes256") != ARCHIVE_OK)
+			    || (archive_write_set_passphrase (a, save_data->password) != ARCHIVE_OK))
+			{
+				LOAD_DATA (save_data)->error = _g_error_new_from_archive_error (archive_error_string (a));
+			}
+		}
+#endif
 	}
 
 	/* set the filter */
@@ -1378,6 +4884,11 @@ _archive_write_set_format_from_context (struct archive *a,
 			archive_write_add_filter_compress (a);
 			break;
 		case ARCHIVE_FILTER_GZIP:
+#ifdef HAVE_ZLIB
+			/* compressed in parallel by the GzipWriter, see below */
+			if (fr_get_n_threads () > 1)
+				break;
+#endif
 			archive_write_add_filter_gzip (a);
 			break;
 		case ARCHIVE_FILTER_LRZIP:
@@ -1442,18 +4953,41 @@ _archive_write_set_format_from_context (struct archive *a,
 				break;
 			}
 		}
+
+#ifdef HAVE_ZLIB
+		if ((archive_filter == ARCHIVE_FILTER_GZIP) && (fr_get_n_threads () > 1)) {
+			save_data->gzip_writer = gzip_writer_new ((compression_level != NULL) ? (int) g_ascii_strtoll (compression_level, NULL, 10) : Z_DEFAULT_COMPRESSION);
+			return;
+		}
+#endif
+
 		if (compression_level != NULL)
 			archive_write_set_filter_option (a, NULL, "compression-level", compression_level);
 
 		/* set the amount of threads */
 
 		if (archive_filter == ARCHIVE_FILTER_XZ) {
-			archive_write_set_filter_option (a, NULL, "threads", fr_get_thread_count());
+			char *n_threads;
+
+			/* always use the multi-threaded encoder: it splits the
+			 * stream in independently decodable blocks, the
+			 * single-threaded one writes a single block. */
+			n_threads = g_strdup_printf ("%u", MAX (fr_get_n_threads (), 2));
+			archive_write_set_filter_option (a, NULL, "threads", n_threads);
+			g_free (n_threads);
 		}
 #if (ARCHIVE_VERSION_NUMBER >= 3006000)
 		if (archive_filter == ARCHIVE_FILTER_ZSTD) {
 			archive_write_set_filter_option (a, NULL, "threads", fr_get_thread_count());
 		}
+#endif
+#if (ARCHIVE_VERSION_NUMBER >= 3007000)
+		if (archive_filter == ARCHIVE_FILTER_ZSTD) {
+			/* start a new frame every ZSTD_WRITER_FRAME_SIZE bytes of
+			 * input, so that the archive can be decoded in parallel
+			 * or from the middle. */
+			archive_write_set_filter_option (a, NULL, "max-frame-in", G_STRINGIFY (ZSTD_WRITER_FRAME_SIZE));
+		}
 #endif
 	}
 }
@@ -1535,24 +5069,125 @@ _archive_entry_copy_file_info (struct archive_entry *entry,
 	if (username != NULL)
 		archive_entry_set_uname (entry, username);
 
-	/* groupname */
+	/* groupname */
+
+	id = archive_entry_gid (entry);
+	groupname = g_hash_table_lookup (save_data->groupnames, &id);
+	if (groupname == NULL) {
+		struct group *grp = getgrgid (id);
+		if (grp != NULL) {
+			groupname = g_strdup (grp->gr_name);
+			g_hash_table_insert (save_data->groupnames, _g_int64_pointer_new (id), groupname);
+		}
+	}
+	if (groupname != NULL)
+		archive_entry_set_gname (entry, groupname);
+
+	return TRUE;
+}
+
+
+#ifdef SEEK_HOLE
+
+
+typedef struct {
+	goffset offset;
+	goffset length;
+} DataRegion;
+
+
+/* Returns the regions of a sparse file that contain data, or NULL if the
+ * file is not sparse or the holes cannot be detected. */
+static GArray *
+_g_file_get_data_regions (GFile     *file,
+			  GFileInfo *info)
+{
+	g_autofree char *path = NULL;
+	GArray          *regions;
+	goffset          size;
+	off_t            data;
+	off_t            hole;
+	int              fd;
+
+	size = g_file_info_get_size (info);
+	if (! g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS)
+	    || (g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_BLOCKS) * 512 >= (guint64) size))
+	{
+		return NULL;
+	}
+
+	path = g_file_get_path (file);
+	if (path == NULL)
+		return NULL;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	regions = g_array_new (FALSE, FALSE, sizeof (DataRegion));
+	hole = 0;
+	while (hole < size) {
+		DataRegion region;
+
+		data = lseek (fd, hole, SEEK_DATA);
+		if ((data < 0) && (errno == ENXIO)) /* only a hole until the end */
+			break;
+		if (data >= 0)
+			hole = lseek (fd, data, SEEK_HOLE);
+		if ((data < 0) || (hole < 0)) {
+			g_clear_pointer (&regions, g_array_unref);
+			break;
+		}
+
+		region.offset = data;
+		region.length = MIN (hole, size) - data;
+		if (region.length > 0)
+			g_array_append_val (regions, region);
+	}
+	close (fd);
+
+	if ((regions != NULL) && (regions->len == 0))
+		g_clear_pointer (&regions, g_array_unref);
+
+	return regions;
+}
+
+
+#define HOLE_BLOCK_SIZE (1024 * 1024)
+
+
+/* Only the tar writer stores the sparse map of an entry, the other
+ * formats store the holes as zeros. */
+static gboolean
+_archive_write_supports_sparse (struct archive *b)
+{
+	return (archive_format (b) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_TAR;
+}
+
+
+/* Passes a hole of @size bytes to the writer.  libarchive has no call to
+ * skip data: when the entry has a sparse map the tar writer consumes the
+ * bytes of the holes without reading or storing them, the other writers
+ * store them as zeros.  The zeros are never written to, so the block
+ * doesn't use any memory until a writer reads it. */
+static void
+_archive_write_hole (struct archive *b,
+		     goffset         size)
+{
+	static char zeros[HOLE_BLOCK_SIZE];
+
+	while (size > 0) {
+		gsize count = MIN (size, HOLE_BLOCK_SIZE);
 
-	id = archive_entry_gid (entry);
-	groupname = g_hash_table_lookup (save_data->groupnames, &id);
-	if (groupname == NULL) {
-		struct group *grp = getgrgid (id);
-		if (grp != NULL) {
-			groupname = g_strdup (grp->gr_name);
-			g_hash_table_insert (save_data->groupnames, _g_int64_pointer_new (id), groupname);
-		}
+		archive_write_data (b, zeros, count);
+		size -= count;
 	}
-	if (groupname != NULL)
-		archive_entry_set_gname (entry, groupname);
-
-	return TRUE;
 }
 
 
+#endif
+
+
 static WriteAction
 _archive_write_file (struct archive       *b,
 		     SaveData             *save_data,
@@ -1564,15 +5199,20 @@ _archive_write_file (struct archive       *b,
 	LoadData             *load_data = LOAD_DATA (save_data);
 	g_autoptr (GFileInfo) info = NULL;
 	g_autoptr (_archive_entry_ctx) w_entry = NULL;
+	g_autoptr (GArray)    regions = NULL;
 	int                   rb;
+	gint64                trace_begin;
 
 	/* write the file header */
 
-	info = g_file_query_info (add_file->file,
-				  FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY,
-				  (! follow_link ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : 0),
-				  cancellable,
-				  &load_data->error);
+	if (add_file->info != NULL)
+		info = g_object_ref (add_file->info);
+	else
+		info = g_file_query_info (add_file->file,
+					  FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY,
+					  (! follow_link ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : 0),
+					  cancellable,
+					  &load_data->error);
 	if (info == NULL)
 		return WRITE_ACTION_ABORT;
 
@@ -1588,11 +5228,102 @@ _archive_write_file (struct archive       *b,
 	}
 
 	archive_entry_set_pathname (w_entry, add_file->pathname);
+
+	/* the other links to a file already added are stored as hard links,
+	 * without reading the data again */
+
+	if ((save_data->link_resolver != NULL) && (archive_entry_nlink (w_entry) > 1)) {
+		struct archive_entry *spare = NULL;
+
+		archive_entry_linkify (save_data->link_resolver, &w_entry, &spare);
+		if (spare != NULL)
+			archive_entry_free (spare);
+	}
+
+#ifdef SEEK_HOLE
+	/* store only the data of sparse files */
+
+	if ((g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR)
+	    && (add_file->content == NULL)
+	    && (archive_entry_hardlink (w_entry) == NULL))
+	{
+		regions = _g_file_get_data_regions (add_file->file, info);
+	}
+	if ((regions != NULL) && _archive_write_supports_sparse (b)) {
+		for (guint i = 0; i < regions->len; i++) {
+			DataRegion *region = &g_array_index (regions, DataRegion, i);
+			archive_entry_sparse_add_entry (w_entry, region->offset, region->length);
+		}
+	}
+#endif
+
+	trace_begin = fr_trace_begin ();
 	rb = archive_write_header (b, w_entry);
 
 	/* write the file data */
 
-	if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR) {
+	if (archive_entry_hardlink (w_entry) != NULL) {
+		fr_archive_progress_inc_completed_bytes (load_data->archive, g_file_info_get_size (info));
+	}
+	else if ((g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR)
+		 && (add_file->content != NULL)
+	    && (g_bytes_get_size (add_file->content) == (gsize) g_file_info_get_size (info)))
+	{
+		gconstpointer data;
+		gsize         size;
+
+		data = g_bytes_get_data (add_file->content, &size);
+		if (size > 0)
+			archive_write_data (b, data, size);
+		fr_archive_progress_inc_completed_bytes (load_data->archive, size);
+	}
+#ifdef SEEK_HOLE
+	else if (regions != NULL) {
+		g_autoptr (GInputStream) istream = NULL;
+
+		/* read only the data regions */
+
+		istream = (GInputStream *) g_file_read (add_file->file, cancellable, &load_data->error);
+		if (istream != NULL) {
+			goffset offset = 0;
+
+			for (guint i = 0; (load_data->error == NULL) && (i < regions->len); i++) {
+				DataRegion *region = &g_array_index (regions, DataRegion, i);
+				goffset     remaining;
+
+				_archive_write_hole (b, region->offset - offset);
+				fr_archive_progress_inc_completed_bytes (load_data->archive, region->offset - offset);
+
+				if (! g_seekable_seek (G_SEEKABLE (istream), region->offset, G_SEEK_SET, cancellable, &load_data->error))
+					break;
+
+				remaining = region->length;
+				while (remaining > 0) {
+					gssize bytes_read;
+
+					bytes_read = g_input_stream_read (istream, save_data->buffer, MIN (remaining, save_data->buffer_size), cancellable, &load_data->error);
+					if (bytes_read < 0)
+						break;
+					if (bytes_read == 0) {
+						/* the sparse map was already written */
+						load_data->error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED, "The file %s changed while it was being read", add_file->pathname);
+						break;
+					}
+					archive_write_data (b, save_data->buffer, bytes_read);
+					fr_archive_progress_inc_completed_bytes (load_data->archive, bytes_read);
+					remaining -= bytes_read;
+				}
+				offset = region->offset + region->length - remaining;
+			}
+
+			if (load_data->error == NULL) {
+				_archive_write_hole (b, g_file_info_get_size (info) - offset);
+				fr_archive_progress_inc_completed_bytes (load_data->archive, g_file_info_get_size (info) - offset);
+			}
+		}
+	}
+#endif
+	else if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR) {
 		g_autoptr (GInputStream) istream = NULL;
 
 		istream = (GInputStream *) g_file_read (add_file->file, cancellable, &load_data->error);
@@ -1607,6 +5338,7 @@ _archive_write_file (struct archive       *b,
 	}
 
 	rb = archive_write_finish_entry (b);
+	fr_trace_end (trace_begin, "save", "entry", add_file->pathname, g_file_info_get_size (info));
 
 	if ((load_data->error == NULL) && (rb <= ARCHIVE_FAILED))
 		load_data->error = g_error_new_literal (FR_ERROR, FR_ERROR_COMMAND_ERROR, archive_error_string (b));
@@ -1626,12 +5358,19 @@ save_archive_thread (GSimpleAsyncResult *result,
 	g_autoptr (_archive_write_ctx) b = NULL;
 	struct archive_entry *r_entry;
 	int                   ra = ARCHIVE_OK, rb = ARCHIVE_OK;
+	gint64                trace_begin;
+	gint64                close_trace_begin;
 
+	trace_begin = fr_trace_begin ();
 	save_data = g_simple_async_result_get_op_res_gpointer (result);
 	load_data = LOAD_DATA (save_data);
 
 	save_data->b = b = archive_write_new ();
 	_archive_write_set_format_from_context (b, save_data);
+	if ((archive_format (b) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_TAR) {
+		save_data->link_resolver = archive_entry_linkresolver_new ();
+		archive_entry_linkresolver_set_strategy (save_data->link_resolver, archive_format (b));
+	}
 	archive_write_open (b, save_data, save_data_open, save_data_write, save_data_close);
 	archive_write_set_bytes_in_last_block (b, 1);
 
@@ -1692,7 +5431,9 @@ save_archive_thread (GSimpleAsyncResult *result,
 	if (save_data->end_operation != NULL)
 		save_data->end_operation (save_data, save_data->user_data);
 
+	close_trace_begin = fr_trace_begin ();
 	rb = archive_write_close (b);
+	fr_trace_end (close_trace_begin, "save", "close", NULL, -1);
 
 	if ((load_data->error == NULL) && (ra != ARCHIVE_EOF))
 		load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
@@ -1702,6 +5443,8 @@ save_archive_thread (GSimpleAsyncResult *result,
 		g_cancellable_set_error_if_cancelled (cancellable, &load_data->error);
 	if (load_data->error != NULL)
 		g_simple_async_result_set_from_error (result, load_data->error);
+
+	_fr_trace_end_archive (trace_begin, "save", load_data->archive, -1);
 }
 
 
@@ -1750,6 +5493,74 @@ _fr_archive_libarchive_save (FrArchive          *archive,
 }
 
 
+/* Returns the next file to write, or NULL if there are no more files.  When
+ * @wait is FALSE returns NULL if the next file is not available yet. */
+typedef AddFile * (*AddFileNextFunc) (gpointer user_data,
+				      gboolean wait);
+
+
+/* Writes the files returned by @next_file in order, the content of the
+ * files that follow is loaded in advance by a FilePrefetcher.
+ * @add_file_notify, if not NULL, is called on each file after use. */
+static void
+_archive_write_files (SaveData        *save_data,
+		      gboolean         follow_links,
+		      AddFileNextFunc  next_file,
+		      GDestroyNotify   add_file_notify,
+		      gpointer         user_data)
+{
+	LoadData       *load_data = LOAD_DATA (save_data);
+	FilePrefetcher *prefetcher;
+	GQueue          pending = G_QUEUE_INIT;  /* added to the prefetcher, not written yet */
+	AddFile        *add_file;
+
+	prefetcher = file_prefetcher_new (follow_links, save_data->link_resolver != NULL, load_data->cancellable);
+	while (load_data->error == NULL) {
+		WriteAction action;
+
+		if (g_cancellable_is_cancelled (load_data->cancellable))
+			break;
+
+		/* keep the prefetcher busy, wait only when there is nothing
+		 * else to write */
+
+		while ((pending.length < prefetcher->window)
+		       && ((add_file = next_file (user_data, g_queue_is_empty (&pending))) != NULL))
+		{
+			g_queue_push_tail (&pending, add_file);
+			file_prefetcher_add (prefetcher, add_file);
+		}
+
+		add_file = g_queue_pop_head (&pending);
+		if (add_file == NULL)
+			break;
+
+		file_prefetcher_wait (prefetcher, add_file);
+		action = _archive_write_file (save_data->b,
+					      save_data,
+					      add_file,
+					      follow_links,
+					      NULL,
+					      load_data->cancellable);
+		file_prefetcher_done (prefetcher, add_file);
+		if (add_file_notify != NULL)
+			add_file_notify (add_file);
+
+		if (action == WRITE_ACTION_ABORT)
+			break;
+
+		fr_archive_progress_inc_completed_files (load_data->archive, 1);
+	}
+
+	/* the loading jobs still running use the pending files */
+
+	file_prefetcher_free (prefetcher);
+	if (add_file_notify != NULL)
+		g_queue_foreach (&pending, (GFunc) add_file_notify, NULL);
+	g_queue_clear (&pending);
+}
+
+
 /* -- add_files -- */
 
 
@@ -1795,6 +5606,8 @@ _add_files_begin (SaveData *save_data,
 		g_autoptr (GList) files_to_add = NULL;
 		GList *scan;
 
+		/* keep the info for the writer, to query each file once */
+
 		files_to_add = g_hash_table_get_values (add_data->files_to_add);
 		for (scan = files_to_add; scan; scan = scan->next) {
 			AddFile *add_file = scan->data;
@@ -1802,123 +5615,414 @@ _add_files_begin (SaveData *save_data,
 			if (g_cancellable_is_cancelled (load_data->cancellable))
 				break;
 
-			load_data->archive->files_to_add_size += _g_file_get_size (add_file->file, load_data->cancellable);
+			if (add_file->info == NULL)
+				add_file->info = g_file_query_info (add_file->file,
+								    FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY,
+								    (! add_data->follow_links ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : 0),
+								    load_data->cancellable,
+								    NULL);
+			if ((add_file->info != NULL) && (g_file_info_get_file_type (add_file->info) == G_FILE_TYPE_REGULAR))
+				load_data->archive->files_to_add_size += g_file_info_get_size (add_file->info);
 		}
 	}
 
-	FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
-	fr_archive_progress_set_total_bytes (load_data->archive, private->uncompressed_size + load_data->archive->files_to_add_size);
+	FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (load_data->archive));
+	fr_archive_progress_set_total_bytes (load_data->archive, private->uncompressed_size + load_data->archive->files_to_add_size);
+}
+
+
+static WriteAction
+_add_files_entry_action (SaveData             *save_data,
+			 struct archive_entry *w_entry,
+			 gpointer              user_data)
+{
+	AddData     *add_data = user_data;
+	LoadData    *load_data = LOAD_DATA (save_data);
+	WriteAction  action;
+	const char  *pathname;
+	AddFile     *add_file;
+
+	action = WRITE_ACTION_WRITE_ENTRY;
+	pathname = archive_entry_pathname (w_entry);
+	add_file = g_hash_table_lookup (add_data->files_to_add, pathname);
+	if (add_file != NULL) {
+		action = _archive_write_file (save_data->b,
+					      save_data,
+					      add_file,
+					      add_data->follow_links,
+					      w_entry,
+					      load_data->cancellable);
+		fr_archive_progress_inc_completed_files (load_data->archive, 1);
+		add_data->n_files_to_add--;
+		g_hash_table_remove (add_data->files_to_add, pathname);
+	}
+
+	return action;
+}
+
+
+static AddFile *
+_add_files_next_file (gpointer user_data,
+		      gboolean wait)
+{
+	GList   **next = user_data;
+	AddFile  *add_file;
+
+	if (*next == NULL)
+		return NULL;
+
+	add_file = (*next)->data;
+	*next = (*next)->next;
+
+	return add_file;
+}
+
+
+static void
+_add_files_end (SaveData *save_data,
+		gpointer  user_data)
+{
+	AddData  *add_data = user_data;
+	LoadData *load_data = LOAD_DATA (save_data);
+	g_autoptr (GList) remaining_files = NULL;
+	GList    *next;
+
+	/* allow to add files to a new archive */
+
+	if (g_error_matches (load_data->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		g_clear_error (&load_data->error);
+
+	/* add the files that weren't present in the archive already, the
+	 * files are owned by the files_to_add table */
+
+	remaining_files = g_hash_table_get_values (add_data->files_to_add);
+	next = remaining_files;
+	_archive_write_files (save_data,
+			      add_data->follow_links,
+			      _add_files_next_file,
+			      NULL,
+			      &next);
+}
+
+
+static void
+fr_archive_libarchive_add_files (FrArchive           *archive,
+				 GList               *file_list,
+				 GFile               *base_dir,
+				 const char          *dest_dir,
+				 gboolean             update,
+				 gboolean             follow_links,
+				 const char          *password,
+				 gboolean             encrypt_header,
+				 FrCompression        compression,
+				 guint                volume_size,
+				 GCancellable        *cancellable,
+				 GAsyncReadyCallback  callback,
+				 gpointer             user_data)
+{
+	AddData *add_data;
+	GList   *scan;
+
+	g_return_if_fail (base_dir != NULL);
+
+	add_data = add_data_new ();
+	add_data->follow_links = follow_links;
+
+	if (dest_dir != NULL)
+		dest_dir = (dest_dir[0] == '/' ? dest_dir + 1 : dest_dir);
+	else
+		dest_dir = "";
+
+	for (scan = file_list; scan; scan = scan->next) {
+		GFile *file = G_FILE (scan->data);
+		g_autofree char *relative_pathname = g_file_get_relative_path (base_dir, file);
+		g_autofree char *archive_pathname = g_build_filename (dest_dir, relative_pathname, NULL);
+		g_hash_table_insert (add_data->files_to_add,
+				     g_strdup (archive_pathname),
+				     add_file_new (file, archive_pathname, NULL));
+		add_data->n_files_to_add++;
+	}
+
+	_fr_archive_libarchive_save (archive,
+				     update,
+				     password,
+				     encrypt_header,
+				     compression,
+				     volume_size,
+				     cancellable,
+				     g_simple_async_result_new (G_OBJECT (archive),
+				     				callback,
+				     				user_data,
+				     				fr_archive_add_files),
+				     _add_files_begin,
+				     _add_files_end,
+				     _add_files_entry_action,
+				     add_data,
+				     (GDestroyNotify) add_data_free);
+}
+
+
+/* -- scan_and_add_files -- */
+
+
+/* Maximum number of scanned files waiting to be written, this keeps the
+ * memory usage bounded regardless of the size of the tree. */
+#define SCAN_QUEUE_MAX_LENGTH 1024
+
+
+typedef struct {
+	FrArchive           *archive;
+	GList               *file_list;
+	FileListFlags        scan_flags;
+	FilterMatchCallback  directory_filter_func;
+	FilterMatchCallback  file_filter_func;
+	gpointer             filter_data;
+	GDestroyNotify       filter_data_notify;
+	GFile               *base_dir;
+	char                *dest_dir;
+	gboolean             follow_links;
+	gboolean             reuse_info; /* the scanner follows the links as the writer */
+	GCancellable        *cancellable;
+	GThread             *scan_thread;
+
+	/* the queue shared by the scanner and the writer */
+
+	GMutex               mutex;
+	GCond                cond;
+	GQueue               queue;      /* AddFile queue */
+	gboolean             scan_done;
+	gboolean             write_done;
+	GError              *scan_error;
+	int                  n_files;    /* files found by the scanner */
+} ScanAddData;
+
+
+static void
+scan_add_data_free (ScanAddData *scan_data)
+{
+	if (scan_data->scan_thread != NULL) {
+		g_mutex_lock (&scan_data->mutex);
+		scan_data->write_done = TRUE;
+		g_cond_broadcast (&scan_data->cond);
+		g_mutex_unlock (&scan_data->mutex);
+		g_thread_join (scan_data->scan_thread);
+	}
+
+	g_queue_foreach (&scan_data->queue, (GFunc) add_file_free, NULL);
+	g_queue_clear (&scan_data->queue);
+	g_mutex_clear (&scan_data->mutex);
+	g_cond_clear (&scan_data->cond);
+	_g_error_free (scan_data->scan_error);
+	if (scan_data->filter_data_notify != NULL)
+		scan_data->filter_data_notify (scan_data->filter_data);
+	_g_object_unref (scan_data->cancellable);
+	g_free (scan_data->dest_dir);
+	_g_object_unref (scan_data->base_dir);
+	_g_object_list_unref (scan_data->file_list);
+	g_free (scan_data);
+}
+
+
+static gboolean
+scan_add_data_push_file_cb (GFile     *file,
+			    GFileInfo *info,
+			    gpointer   user_data)
+{
+	ScanAddData     *scan_data = user_data;
+	g_autofree char *relative_pathname = NULL;
+	g_autofree char *archive_pathname = NULL;
+	gboolean         write_done;
+
+	switch (g_file_info_get_file_type (info)) {
+	case G_FILE_TYPE_REGULAR:
+	case G_FILE_TYPE_DIRECTORY:
+	case G_FILE_TYPE_SYMBOLIC_LINK:
+		break;
+	default: /* ignore any other type */
+		return TRUE;
+	}
+
+	if (! scan_data->archive->propAddCanStoreFolders && (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY))
+		return TRUE;
+
+	relative_pathname = g_file_get_relative_path (scan_data->base_dir, file);
+	if (relative_pathname == NULL)
+		return TRUE;
+	archive_pathname = g_build_filename (scan_data->dest_dir, relative_pathname, NULL);
+
+	g_mutex_lock (&scan_data->mutex);
+	while (! scan_data->write_done && (scan_data->queue.length >= SCAN_QUEUE_MAX_LENGTH))
+		g_cond_wait (&scan_data->cond, &scan_data->mutex);
+	write_done = scan_data->write_done;
+	if (! write_done) {
+		g_queue_push_tail (&scan_data->queue, add_file_new (file, archive_pathname, scan_data->reuse_info ? info : NULL));
+		scan_data->n_files++;
+		g_cond_broadcast (&scan_data->cond);
+	}
+	g_mutex_unlock (&scan_data->mutex);
+
+	if (write_done)
+		return FALSE;
+
+	fr_archive_progress_inc_total_files (scan_data->archive, 1);
+	if (g_file_info_get_file_type (info) == G_FILE_TYPE_REGULAR)
+		fr_archive_progress_inc_total_bytes (scan_data->archive, g_file_info_get_size (info));
+
+	return TRUE;
+}
+
+
+static gpointer
+scan_files_thread (gpointer user_data)
+{
+	ScanAddData *scan_data = user_data;
+	GError      *error = NULL;
+
+	_g_file_list_foreach_info (scan_data->file_list,
+				   scan_data->scan_flags,
+				   FILE_ATTRIBUTES_NEEDED_BY_ARCHIVE_ENTRY,
+				   scan_data->cancellable,
+				   scan_data->directory_filter_func,
+				   scan_data->file_filter_func,
+				   scan_data->filter_data,
+				   scan_add_data_push_file_cb,
+				   scan_data,
+				   &error);
+
+	g_mutex_lock (&scan_data->mutex);
+	scan_data->scan_done = TRUE;
+	scan_data->scan_error = error;
+	g_cond_broadcast (&scan_data->cond);
+	g_mutex_unlock (&scan_data->mutex);
+
+	return NULL;
+}
+
+
+static AddFile *
+scan_add_data_pop_file (gpointer user_data,
+			gboolean wait)
+{
+	ScanAddData *scan_data = user_data;
+	AddFile     *add_file;
+
+	g_mutex_lock (&scan_data->mutex);
+	while (wait && ! scan_data->scan_done && g_queue_is_empty (&scan_data->queue))
+		g_cond_wait (&scan_data->cond, &scan_data->mutex);
+	add_file = g_queue_pop_head (&scan_data->queue);
+	g_cond_broadcast (&scan_data->cond);
+	g_mutex_unlock (&scan_data->mutex);
+
+	return add_file;
 }
 
 
-static WriteAction
-_add_files_entry_action (SaveData             *save_data,
-			 struct archive_entry *w_entry,
-			 gpointer              user_data)
+static void
+_scan_and_add_files_begin (SaveData *save_data,
+			   gpointer  user_data)
 {
-	AddData     *add_data = user_data;
+	ScanAddData *scan_data = user_data;
 	LoadData    *load_data = LOAD_DATA (save_data);
-	WriteAction  action;
-	const char  *pathname;
-	AddFile     *add_file;
 
-	action = WRITE_ACTION_WRITE_ENTRY;
-	pathname = archive_entry_pathname (w_entry);
-	add_file = g_hash_table_lookup (add_data->files_to_add, pathname);
-	if (add_file != NULL) {
-		action = _archive_write_file (save_data->b,
-					      save_data,
-					      add_file,
-					      add_data->follow_links,
-					      w_entry,
-					      load_data->cancellable);
-		fr_archive_progress_inc_completed_files (load_data->archive, 1);
-		add_data->n_files_to_add--;
-		g_hash_table_remove (add_data->files_to_add, pathname);
-	}
+	/* the totals are updated by the scanner */
 
-	return action;
+	fr_archive_progress_set_total_files (load_data->archive, 0);
+	fr_archive_progress_set_total_bytes (load_data->archive, 0);
+
+	scan_data->scan_thread = g_thread_new ("fr-scan-files", scan_files_thread, scan_data);
 }
 
 
 static void
-_add_files_end (SaveData *save_data,
-		gpointer  user_data)
+_scan_and_add_files_end (SaveData *save_data,
+			 gpointer  user_data)
 {
-	AddData  *add_data = user_data;
-	LoadData *load_data = LOAD_DATA (save_data);
-	g_autoptr (GList) remaining_files = NULL;
-	GList    *scan;
+	ScanAddData *scan_data = user_data;
+	LoadData    *load_data = LOAD_DATA (save_data);
 
-	/* allow to add files to a new archive */
+	/* the archive doesn't exist yet */
 
 	if (g_error_matches (load_data->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
 		g_clear_error (&load_data->error);
 
-	/* add the files that weren't present in the archive already */
+	/* write the files while the scanner is still looking for more */
 
-	remaining_files = g_hash_table_get_values (add_data->files_to_add);
-	for (scan = remaining_files; (load_data->error == NULL) && scan; scan = scan->next) {
-		AddFile *add_file = scan->data;
+	_archive_write_files (save_data,
+			      scan_data->follow_links,
+			      scan_add_data_pop_file,
+			      (GDestroyNotify) add_file_free,
+			      scan_data);
 
-		if (g_cancellable_is_cancelled (load_data->cancellable))
-			break;
+	/* stop the scanner if the writer terminated earlier */
 
-		if (_archive_write_file (save_data->b,
-					 save_data,
-					 add_file,
-					 add_data->follow_links,
-					 NULL,
-					 load_data->cancellable) == WRITE_ACTION_ABORT)
-		{
-			break;
-		}
+	g_mutex_lock (&scan_data->mutex);
+	scan_data->write_done = TRUE;
+	g_cond_broadcast (&scan_data->cond);
+	g_mutex_unlock (&scan_data->mutex);
 
-		fr_archive_progress_inc_completed_files (load_data->archive, 1);
+	g_thread_join (scan_data->scan_thread);
+	scan_data->scan_thread = NULL;
+
+	if ((load_data->error == NULL) && (scan_data->scan_error != NULL)) {
+		load_data->error = scan_data->scan_error;
+		scan_data->scan_error = NULL;
 	}
+
+	/* nothing to add, as when the file list is read before adding the
+	 * files, the archive is not created */
+
+	if ((load_data->error == NULL) && (scan_data->n_files == 0))
+		save_data->discard = TRUE;
 }
 
 
 static void
-fr_archive_libarchive_add_files (FrArchive           *archive,
-				 GList               *file_list,
-				 GFile               *base_dir,
-				 const char          *dest_dir,
-				 gboolean             update,
-				 gboolean             follow_links,
-				 const char          *password,
-				 gboolean             encrypt_header,
-				 FrCompression        compression,
-				 guint                volume_size,
-				 GCancellable        *cancellable,
-				 GAsyncReadyCallback  callback,
-				 gpointer             user_data)
+fr_archive_libarchive_scan_and_add_files (FrArchive           *archive,
+					  GList               *file_list,
+					  FileListFlags        scan_flags,
+					  FilterMatchCallback  directory_filter_func,
+					  FilterMatchCallback  file_filter_func,
+					  gpointer             filter_data,
+					  GDestroyNotify       filter_data_notify,
+					  GFile               *base_dir,
+					  const char          *dest_dir,
+					  gboolean             follow_links,
+					  const char          *password,
+					  gboolean             encrypt_header,
+					  FrCompression        compression,
+					  guint                volume_size,
+					  GCancellable        *cancellable,
+					  GAsyncReadyCallback  callback,
+					  gpointer             user_data)
 {
-	AddData *add_data;
-	GList   *scan;
+	ScanAddData *scan_data;
 
 	g_return_if_fail (base_dir != NULL);
 
-	add_data = add_data_new ();
-	add_data->follow_links = follow_links;
-
 	if (dest_dir != NULL)
 		dest_dir = (dest_dir[0] == '/' ? dest_dir + 1 : dest_dir);
 	else
 		dest_dir = "";
 
-	for (scan = file_list; scan; scan = scan->next) {
-		GFile *file = G_FILE (scan->data);
-		g_autofree char *relative_pathname = g_file_get_relative_path (base_dir, file);
-		g_autofree char *archive_pathname = g_build_filename (dest_dir, relative_pathname, NULL);
-		g_hash_table_insert (add_data->files_to_add,
-				     g_strdup (archive_pathname),
-				     add_file_new (file, archive_pathname));
-		add_data->n_files_to_add++;
-	}
+	scan_data = g_new0 (ScanAddData, 1);
+	scan_data->archive = archive;
+	scan_data->file_list = _g_object_list_ref (file_list);
+	scan_data->scan_flags = scan_flags;
+	scan_data->directory_filter_func = directory_filter_func;
+	scan_data->file_filter_func = file_filter_func;
+	scan_data->filter_data = filter_data;
+	scan_data->filter_data_notify = filter_data_notify;
+	scan_data->base_dir = g_object_ref (base_dir);
+	scan_data->dest_dir = g_strdup (dest_dir);
+	scan_data->follow_links = follow_links;
+	scan_data->reuse_info = (((scan_flags & FILE_LIST_NO_FOLLOW_LINKS) != 0) == ! follow_links);
+	scan_data->cancellable = _g_object_ref (cancellable);
+	g_mutex_init (&scan_data->mutex);
+	g_cond_init (&scan_data->cond);
+	g_queue_init (&scan_data->queue);
 
 	_fr_archive_libarchive_save (archive,
-				     update,
+				     FALSE,
 				     password,
 				     encrypt_header,
 				     compression,
@@ -1928,11 +6032,11 @@ fr_archive_libarchive_add_files (FrArchive           *archive,
 				     				callback,
 				     				user_data,
 				     				fr_archive_add_files),
-				     _add_files_begin,
-				     _add_files_end,
-				     _add_files_entry_action,
-				     add_data,
-				     (GDestroyNotify) add_data_free);
+				     _scan_and_add_files_begin,
+				     _scan_and_add_files_end,
+				     NULL,
+				     scan_data,
+				     (GDestroyNotify) scan_add_data_free);
 }
 
 
@@ -1943,6 +6047,7 @@ typedef struct {
 	GHashTable *files_to_remove;
 	gboolean    remove_all_files;
 	int         n_files_to_remove;
+	GHashTable *moved_targets;  /* removed target -> hard link that takes its data */
 } RemoveData;
 
 
@@ -1951,6 +6056,8 @@ remove_data_free (RemoveData *remove_data)
 {
 	if (remove_data->files_to_remove != NULL)
 		g_hash_table_unref (remove_data->files_to_remove);
+	if (remove_data->moved_targets != NULL)
+		g_hash_table_unref (remove_data->moved_targets);
 	g_free (remove_data);
 }
 
@@ -1984,10 +6091,26 @@ _remove_files_entry_action (SaveData             *save_data,
 	action = WRITE_ACTION_WRITE_ENTRY;
 	pathname = archive_entry_pathname (w_entry);
 	if (g_hash_table_lookup (remove_data->files_to_remove, pathname) != NULL) {
-		action = WRITE_ACTION_SKIP_ENTRY;
+		const char *link_pathname = g_hash_table_lookup (remove_data->moved_targets, pathname);
+
 		remove_data->n_files_to_remove--;
 		fr_archive_progress_inc_completed_files (load_data->archive, 1);
 		g_hash_table_remove (remove_data->files_to_remove, pathname);
+
+		/* the data of the other links is stored with the first one */
+
+		if (link_pathname != NULL)
+			archive_entry_set_pathname (w_entry, link_pathname);
+		else
+			action = WRITE_ACTION_SKIP_ENTRY;
+	}
+	else if (archive_entry_hardlink (w_entry) != NULL) {
+		const char *link_pathname = g_hash_table_lookup (remove_data->moved_targets, archive_entry_hardlink (w_entry));
+
+		if (g_strcmp0 (link_pathname, pathname) == 0)
+			action = WRITE_ACTION_SKIP_ENTRY;  /* already written with the data */
+		else if (link_pathname != NULL)
+			archive_entry_set_hardlink (w_entry, link_pathname);
 	}
 
 	return action;
@@ -2002,6 +6125,7 @@ fr_archive_libarchive_remove_files (FrArchive           *archive,
 				    GAsyncReadyCallback  callback,
 				    gpointer             user_data)
 {
+	FrArchiveLibarchivePrivate *private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (archive));
 	RemoveData *remove_data;
 	GList      *scan;
 
@@ -2014,6 +6138,32 @@ fr_archive_libarchive_remove_files (FrArchive           *archive,
 			g_hash_table_insert (remove_data->files_to_remove, g_strdup (scan->data), GINT_TO_POINTER (1));
 			remove_data->n_files_to_remove++;
 		}
+
+		/* when a hard link target is removed its data goes to one of
+		 * the links that are kept, the other links point to it.  The
+		 * target comes before the links in the archive, so the data
+		 * is still written before every link. */
+
+		remove_data->moved_targets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+		if (private->hardlinks != NULL) {
+			guint i;
+
+			for (i = 0; i < archive->files->len; i++) {
+				FrFileData *file_data = g_ptr_array_index (archive->files, i);
+				const char *target;
+
+				if (g_hash_table_lookup (remove_data->files_to_remove, file_data->original_path) != NULL)
+					continue;
+
+				target = g_hash_table_lookup (private->hardlinks, file_data->original_path);
+				if ((target != NULL)
+				    && (g_hash_table_lookup (remove_data->files_to_remove, target) != NULL)
+				    && (g_hash_table_lookup (remove_data->moved_targets, target) == NULL))
+				{
+					g_hash_table_insert (remove_data->moved_targets, g_strdup (target), g_strdup (file_data->original_path));
+				}
+			}
+		}
 	}
 	else
 		remove_data->n_files_to_remove = archive->files->len;
@@ -2037,6 +6187,344 @@ fr_archive_libarchive_remove_files (FrArchive           *archive,
 }
 
 
+/* -- fr_archive_libarchive_add_archive -- */
+
+
+typedef struct {
+	FrArchive *source;
+	char      *source_password;
+} AddArchiveData;
+
+
+static AddArchiveData *
+add_archive_data_new (FrArchive  *source,
+		      const char *source_password)
+{
+	AddArchiveData *add_archive_data;
+
+	add_archive_data = g_new0 (AddArchiveData, 1);
+	add_archive_data->source = g_object_ref (source);
+	add_archive_data->source_password = g_strdup (source_password);
+
+	return add_archive_data;
+}
+
+
+static void
+add_archive_data_free (AddArchiveData *add_archive_data)
+{
+	g_object_unref (add_archive_data->source);
+	g_free (add_archive_data->source_password);
+	g_free (add_archive_data);
+}
+
+
+static void
+_add_archive_begin (SaveData *save_data,
+		    gpointer  user_data)
+{
+	LoadData       *load_data = LOAD_DATA (save_data);
+	AddArchiveData *add_archive_data = user_data;
+	FrArchive      *source = add_archive_data->source;
+	FrArchiveLibarchivePrivate *source_private = fr_archive_libarchive_get_instance_private (FR_ARCHIVE_LIBARCHIVE (source));
+
+	fr_archive_progress_set_total_files (load_data->archive, source->files->len);
+	fr_archive_progress_set_total_bytes (load_data->archive, source_private->uncompressed_size);
+}
+
+
+static LoadData *
+add_archive_source_data_new (LoadData       *load_data,
+			     AddArchiveData *add_archive_data)
+{
+	LoadData *source_data;
+
+	source_data = g_new0 (LoadData, 1);
+	load_data_init (source_data);
+	source_data->archive = g_object_ref (add_archive_data->source);
+	source_data->cancellable = _g_object_ref (load_data->cancellable);
+	source_data->result = g_object_ref (load_data->result);
+	source_data->password = g_strdup (add_archive_data->source_password);
+
+	return source_data;
+}
+
+
+static gboolean
+_archive_write_supports_hardlinks (struct archive *b)
+{
+	switch (archive_format (b) & ARCHIVE_FORMAT_BASE_MASK) {
+	case ARCHIVE_FORMAT_ZIP:
+	case ARCHIVE_FORMAT_7ZIP:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
+
+/* Copies the data of the current entry of @a, the holes of sparse entries
+ * are written as zeros. */
+static gboolean
+_add_archive_copy_data (SaveData       *save_data,
+			struct archive *a)
+{
+	LoadData     *load_data = LOAD_DATA (save_data);
+	const void   *buffer;
+	size_t        buffer_size;
+	__LA_INT64_T  target_offset = 0;
+	__LA_INT64_T  actual_offset = 0;
+	int           ra;
+
+	for (;;) {
+		ra = archive_read_data_block (a, &buffer, &buffer_size, &target_offset);
+		if ((ra != ARCHIVE_OK) && (ra != ARCHIVE_EOF))
+			break;
+
+		if (target_offset > actual_offset)
+			memset (save_data->buffer, 0, save_data->buffer_size);
+		while (target_offset > actual_offset) {
+			gsize count = MIN (target_offset - actual_offset, (__LA_INT64_T) save_data->buffer_size);
+
+			if (archive_write_data (save_data->b, save_data->buffer, count) < 0) {
+				load_data->error = _g_error_new_from_archive_error (archive_error_string (save_data->b));
+				return FALSE;
+			}
+			actual_offset += count;
+			fr_archive_progress_inc_completed_bytes (load_data->archive, count);
+		}
+
+		if (ra == ARCHIVE_EOF)
+			break;
+
+		if (archive_write_data (save_data->b, buffer, buffer_size) < 0) {
+			load_data->error = _g_error_new_from_archive_error (archive_error_string (save_data->b));
+			return FALSE;
+		}
+		actual_offset += buffer_size;
+		fr_archive_progress_inc_completed_bytes (load_data->archive, buffer_size);
+	}
+
+	if (ra <= ARCHIVE_FAILED) {
+		load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static gboolean
+_add_archive_write_entry (SaveData             *save_data,
+			  struct archive       *a,
+			  struct archive_entry *entry,
+			  gboolean              copy_data)
+{
+	LoadData *load_data = LOAD_DATA (save_data);
+
+	if (archive_write_header (save_data->b, entry) <= ARCHIVE_FAILED) {
+		load_data->error = _g_error_new_from_archive_error (archive_error_string (save_data->b));
+		return FALSE;
+	}
+
+	if (copy_data && ! _add_archive_copy_data (save_data, a))
+		return FALSE;
+
+	if (archive_write_finish_entry (save_data->b) <= ARCHIVE_FAILED) {
+		load_data->error = _g_error_new_from_archive_error (archive_error_string (save_data->b));
+		return FALSE;
+	}
+
+	fr_archive_progress_inc_completed_files (load_data->archive, 1);
+
+	return TRUE;
+}
+
+
+/* Sets the error of the copy from @source_data, after the loop on the
+ * headers of @a ended with @ra. */
+static void
+_add_archive_check_source (LoadData       *load_data,
+			   LoadData       *source_data,
+			   struct archive *a,
+			   int             ra)
+{
+	if (load_data->error == NULL) {
+		if (source_data->error != NULL) {
+			load_data->error = source_data->error;
+			source_data->error = NULL;
+		}
+		else if ((ra != ARCHIVE_EOF) && ! g_cancellable_is_cancelled (load_data->cancellable))
+			load_data->error = _g_error_new_from_archive_error (archive_error_string (a));
+	}
+	g_clear_error (&source_data->error);
+}
+
+
+static void
+link_queue_free (GQueue *links)
+{
+	g_queue_free_full (links, (GDestroyNotify) archive_entry_free);
+}
+
+
+/* The formats without hard links store a copy of the data for each link.
+ * The target comes before the links in the source archive, so it is read
+ * again, once for each link to the same target. */
+static void
+_add_archive_copy_hardlinks (SaveData       *save_data,
+			     AddArchiveData *add_archive_data,
+			     GHashTable     *hardlinks)
+{
+	LoadData *load_data = LOAD_DATA (save_data);
+
+	while ((load_data->error == NULL) && (g_hash_table_size (hardlinks) > 0)) {
+		g_autoptr (LoadData)  source_data = NULL;
+		g_autoptr (_archive_read_ctx) a = NULL;
+		struct archive_entry *r_entry;
+		int                   ra = ARCHIVE_OK;
+		gboolean              found = FALSE;
+
+		source_data = add_archive_source_data_new (load_data, add_archive_data);
+		create_read_object (source_data, &a);
+		while ((source_data->error == NULL)
+		       && (load_data->error == NULL)
+		       && (ra = archive_read_next_header (a, &r_entry)) == ARCHIVE_OK)
+		{
+			g_autoptr (_archive_entry_ctx) link_entry = NULL;
+			GQueue *links;
+
+			if (g_cancellable_is_cancelled (load_data->cancellable))
+				break;
+
+			links = g_hash_table_lookup (hardlinks, archive_entry_pathname (r_entry));
+			if (links == NULL)
+				continue;
+
+			link_entry = g_queue_pop_head (links);
+			if (g_queue_is_empty (links))
+				g_hash_table_remove (hardlinks, archive_entry_pathname (r_entry));
+			found = TRUE;
+
+			archive_entry_set_hardlink (link_entry, NULL);
+			archive_entry_set_filetype (link_entry, AE_IFREG);
+			archive_entry_set_size (link_entry, archive_entry_size (r_entry));
+			if (! _add_archive_write_entry (save_data, a, link_entry, TRUE))
+				break;
+		}
+
+		_add_archive_check_source (load_data, source_data, a, ra);
+
+		/* the targets of the links left are not in the archive */
+		if (! found)
+			break;
+	}
+}
+
+
+static void
+_add_archive_end (SaveData *save_data,
+		  gpointer  user_data)
+{
+	LoadData             *load_data = LOAD_DATA (save_data);
+	AddArchiveData       *add_archive_data = user_data;
+	g_autoptr (LoadData)  source_data = NULL;
+	g_autoptr (_archive_read_ctx) a = NULL;
+	g_autoptr (GHashTable) hardlinks = NULL;
+	struct archive_entry *r_entry;
+	int                   ra = ARCHIVE_OK;
+
+	/* the new archive doesn't exist yet */
+
+	if (g_error_matches (load_data->error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		g_clear_error (&load_data->error);
+
+	if (load_data->error != NULL)
+		return;
+
+	/* copy the entries of the source archive, the data is decompressed
+	 * (and decrypted) and compressed again without being written to
+	 * disk */
+
+	if (! _archive_write_supports_hardlinks (save_data->b))
+		hardlinks = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) link_queue_free);
+
+	source_data = add_archive_source_data_new (load_data, add_archive_data);
+	create_read_object (source_data, &a);
+	while ((source_data->error == NULL)
+	       && (load_data->error == NULL)
+	       && (ra = archive_read_next_header (a, &r_entry)) == ARCHIVE_OK)
+	{
+		if (g_cancellable_is_cancelled (load_data->cancellable))
+			break;
+
+		if ((hardlinks != NULL) && (archive_entry_hardlink (r_entry) != NULL)) {
+			const char *target = archive_entry_hardlink (r_entry);
+			GQueue     *links;
+
+			/* a link that carries the data is copied as a regular file */
+
+			if (archive_entry_size (r_entry) > 0) {
+				g_autoptr (_archive_entry_ctx) w_entry = archive_entry_clone (r_entry);
+
+				archive_entry_set_hardlink (w_entry, NULL);
+				archive_entry_set_filetype (w_entry, AE_IFREG);
+				if (! _add_archive_write_entry (save_data, a, w_entry, TRUE))
+					break;
+				continue;
+			}
+
+			links = g_hash_table_lookup (hardlinks, target);
+			if (links == NULL) {
+				links = g_queue_new ();
+				g_hash_table_insert (hardlinks, g_strdup (target), links);
+			}
+			g_queue_push_tail (links, archive_entry_clone (r_entry));
+			continue;
+		}
+
+		if (! _add_archive_write_entry (save_data, a, r_entry, archive_entry_filetype (r_entry) == AE_IFREG))
+			break;
+	}
+
+	_add_archive_check_source (load_data, source_data, a, ra);
+
+	if ((hardlinks != NULL) && ! g_cancellable_is_cancelled (load_data->cancellable))
+		_add_archive_copy_hardlinks (save_data, add_archive_data, hardlinks);
+}
+
+
+static void
+fr_archive_libarchive_add_archive (FrArchive           *archive,
+				   FrArchive           *source,
+				   const char          *source_password,
+				   const char          *password,
+				   gboolean             encrypt_header,
+				   FrCompression        compression,
+				   guint                volume_size,
+				   GCancellable        *cancellable,
+				   GAsyncReadyCallback  callback,
+				   gpointer             user_data)
+{
+	_fr_archive_libarchive_save (archive,
+				     FALSE,
+				     password,
+				     encrypt_header,
+				     compression,
+				     volume_size,
+				     cancellable,
+				     g_simple_async_result_new (G_OBJECT (archive),
+								callback,
+								user_data,
+								fr_archive_add_archive),
+				     _add_archive_begin,
+				     _add_archive_end,
+				     NULL,
+				     add_archive_data_new (source, source_password),
+				     (GDestroyNotify) add_archive_data_free);
+}
+
+
 /* -- fr_archive_libarchive_rename -- */
 
 
@@ -2084,10 +6572,18 @@ _rename_files_entry_action (SaveData             *save_data,
 	if (new_pathname != NULL) {
 		archive_entry_set_pathname (w_entry, new_pathname);
 		rename_data->n_files_to_rename--;
-		g_hash_table_remove (rename_data->files_to_rename, pathname);
 		fr_archive_progress_inc_completed_files (load_data->archive, 1);
 	}
 
+	/* the renamed files are kept in the table to update the hard links
+	 * that follow */
+
+	if (archive_entry_hardlink (w_entry) != NULL) {
+		new_pathname = g_hash_table_lookup (rename_data->files_to_rename, archive_entry_hardlink (w_entry));
+		if (new_pathname != NULL)
+			archive_entry_set_hardlink (w_entry, new_pathname);
+	}
+
 	return action;
 }
 
@@ -2188,7 +6684,7 @@ fr_archive_libarchive_paste_clipboard (FrArchive           *archive,
 
 		new_name = g_build_filename (current_dir, old_name + strlen (base_dir) - 1, NULL);
 		file = _g_file_append_path (tmp_dir, old_name, NULL);
-		g_hash_table_insert (add_data->files_to_add, new_name, add_file_new (file, new_name));
+		g_hash_table_insert (add_data->files_to_add, new_name, add_file_new (file, new_name, NULL));
 		add_data->n_files_to_add++;
 	}
 
@@ -2241,7 +6737,7 @@ fr_archive_libarchive_add_dropped_files (FrArchive           *archive,
 
 		g_hash_table_insert (add_data->files_to_add,
 				     g_strdup (archive_pathname),
-				     add_file_new (file, archive_pathname));
+				     add_file_new (file, archive_pathname, NULL));
 	}
 
 	_fr_archive_libarchive_save (archive,
@@ -2291,7 +6787,7 @@ fr_archive_libarchive_update_open_files (FrArchive           *archive,
 		GFile *temp_dir = G_FILE (scan_dir->data);
 		GFile *extracted_file = G_FILE (scan_file->data);
 		g_autofree char *archive_pathname = g_file_get_relative_path (temp_dir, extracted_file);
-		g_hash_table_insert (add_data->files_to_add, g_strdup (archive_pathname), add_file_new (extracted_file, archive_pathname));
+		g_hash_table_insert (add_data->files_to_add, g_strdup (archive_pathname), add_file_new (extracted_file, archive_pathname, NULL));
 		add_data->n_files_to_add++;
 	}
 
@@ -2332,7 +6828,10 @@ fr_archive_libarchive_class_init (FrArchiveLibarchiveClass *klass)
 	archive_class->list = fr_archive_libarchive_list;
 	archive_class->extract_files = fr_archive_libarchive_extract_files;
 	archive_class->add_files = fr_archive_libarchive_add_files;
+	archive_class->add_archive = fr_archive_libarchive_add_archive;
+	archive_class->scan_and_add_files = fr_archive_libarchive_scan_and_add_files;
 	archive_class->remove_files = fr_archive_libarchive_remove_files;
+	archive_class->test_integrity = fr_archive_libarchive_test_integrity;
 	archive_class->rename = fr_archive_libarchive_rename;
 	archive_class->paste_clipboard = fr_archive_libarchive_paste_clipboard;
 	archive_class->add_dropped_files = fr_archive_libarchive_add_dropped_files;
@@ -2353,6 +6852,7 @@ fr_archive_libarchive_init (FrArchiveLibarchive *self)
 	base->propExtractCanSkipOlder = TRUE;
 	base->propExtractCanJunkPaths = TRUE;
 	base->propCanExtractAll = TRUE;
+	base->propTest = TRUE;
 	base->propCanDeleteNonEmptyFolders = TRUE;
 	base->propCanExtractNonEmptyFolders = TRUE;
 }
@@ -32,4 +32,10 @@ struct _FrArchiveLibarchive {
 	FrArchive __parent;
 };
 
+/**
+ * fr_archive_libarchive_get_last_output:
+ * Returns: (element-type utf8) (transfer none): List of the lines reported by the last integrity test.
+ */
+GList *  fr_archive_libarchive_get_last_output  (FrArchiveLibarchive *self);
+
 #endif /* FR_ARCHIVE_LIBARCHIVE_H */
@@ -39,11 +39,15 @@
 #include "fr-marshal.h"
 #include "fr-process.h"
 #include "fr-init.h"
+#include "fr-trace.h"
 
 #define FILE_ARRAY_INITIAL_SIZE	256
 #define PROGRESS_DELAY          50
-#define BYTES_FRACTION(self)    ((double) ((FrArchivePrivate*) fr_archive_get_instance_private (self))->completed_bytes / ((FrArchivePrivate*) fr_archive_get_instance_private (self))->total_bytes)
-#define FILES_FRACTION(self)    ((double) ((FrArchivePrivate*) fr_archive_get_instance_private (self))->completed_files + 0.5) / (((FrArchivePrivate*) fr_archive_get_instance_private (self))->total_files + 1)
+#define RATE_SAMPLE_INTERVAL    (G_USEC_PER_SEC / 2)
+#define RATE_SMOOTHING          0.3
+#define MAX_REMAINING_SECONDS   (2 * 24 * 60 * 60)
+#define BYTES_FRACTION(completed, total) ((double) (completed) / (total))
+#define FILES_FRACTION(completed, total) (((double) (completed) + 0.5) / ((total) + 1))
 
 
 char *action_names[] = { "NONE",
@@ -73,18 +77,28 @@ typedef struct {
 	GFile         *file;
 	FrArchiveCaps  capabilities;
 
-	/* progress data */
+	/* progress data, the counters are updated atomically by the
+	 * worker threads and sampled by the progress timer */
 
 	int            total_files;
 	int            completed_files;
 	gsize          total_bytes;
 	gsize          completed_bytes;
-	GMutex         progress_mutex;
 	gulong         progress_event;
 
+	/* transfer rate, only used in the main thread */
+
+	gint64         rate_sample_time;
+	gsize          rate_sample_bytes;
+	int            rate_sample_files;
+	double         bytes_per_second;
+	double         files_per_second;
+
 	/* others */
 
 	gboolean       creating_archive;
+	gboolean       scanning_files;             /* getting the file list
+						    * while adding the files */
 	GFile         *extraction_destination;
 	gboolean       have_write_permissions;     /* true if we have the
 						    * permissions to write the
@@ -246,7 +260,6 @@ fr_archive_finalize (GObject *object)
 		g_source_remove (private->progress_event);
 		private->progress_event = 0;
 	}
-	g_mutex_clear (&private->progress_mutex);
 	g_hash_table_unref (archive->files_hash);
 	g_ptr_array_unref (archive->files);
 	if (private->dropped_items_data != NULL) {
@@ -321,6 +334,8 @@ fr_archive_class_init (FrArchiveClass *klass)
 	klass->open = NULL;
 	klass->list = NULL;
 	klass->add_files = NULL;
+	klass->scan_and_add_files = NULL;
+	klass->add_archive = NULL;
 	klass->extract_files = NULL;
 	klass->remove_files = NULL;
 	klass->test_integrity = NULL;
@@ -468,8 +483,10 @@ fr_archive_init (FrArchive *self)
 	private->total_files = 0;
 	private->completed_bytes = 0;
 	private->total_bytes = 0;
+	private->rate_sample_time = 0;
+	private->bytes_per_second = 0.0;
+	private->files_per_second = 0.0;
 	private->dropped_items_data = NULL;
-	g_mutex_init (&private->progress_mutex);
 }
 
 
@@ -635,6 +652,7 @@ typedef struct {
 	char               *buffer;
         gsize               buffer_size;
 	FrArchive          *archive;
+	gint64              trace_begin;
 } OpenData;
 
 
@@ -767,6 +785,8 @@ open_archive_buffer_ready_cb (GObject      *source_object,
 		}
 	}
 
+	fr_trace_end (open_data->trace_begin, "open", "detect-type", mime_type, open_data->buffer_size);
+
 	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
 	private->have_write_permissions = _g_file_check_permissions (fr_archive_get_file (archive), W_OK);
 	archive->read_only = ! fr_archive_is_capable_of (archive, FR_ARCHIVE_CAN_WRITE) || ! private->have_write_permissions;
@@ -804,6 +824,7 @@ fr_archive_open (GFile               *file,
 						       fr_archive_open);
 	open_data->buffer_size = 0;
 	open_data->buffer = NULL;
+	open_data->trace_begin = fr_trace_begin ();
         g_simple_async_result_set_op_res_gpointer (open_data->result,
         					   open_data,
                                                    (GDestroyNotify) open_data_free);
@@ -838,11 +859,78 @@ fr_archive_open_finish (GFile         *file,
 }
 
 
+static void
+_fr_archive_reset_progress_rate (FrArchive *archive)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
+
+	private->rate_sample_time = g_get_monotonic_time ();
+	private->rate_sample_bytes = (gsize) g_atomic_pointer_get (&private->completed_bytes);
+	private->rate_sample_files = g_atomic_int_get (&private->completed_files);
+	private->bytes_per_second = 0.0;
+	private->files_per_second = 0.0;
+}
+
+
+static void
+_fr_archive_sample_progress_rate (FrArchive *archive)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
+	gint64            now;
+	gsize             completed_bytes;
+	int               completed_files;
+	double            elapsed;
+	double            bytes_per_second;
+	double            files_per_second;
+
+	now = g_get_monotonic_time ();
+	if (now - private->rate_sample_time < RATE_SAMPLE_INTERVAL)
+		return;
+
+	completed_bytes = (gsize) g_atomic_pointer_get (&private->completed_bytes);
+	completed_files = g_atomic_int_get (&private->completed_files);
+
+	/* the counters were reset by a new step of the operation */
+	if ((completed_bytes < private->rate_sample_bytes) || (completed_files < private->rate_sample_files)) {
+		_fr_archive_reset_progress_rate (archive);
+		return;
+	}
+
+	elapsed = (double) (now - private->rate_sample_time) / G_USEC_PER_SEC;
+	bytes_per_second = (completed_bytes - private->rate_sample_bytes) / elapsed;
+	files_per_second = (completed_files - private->rate_sample_files) / elapsed;
+
+	if ((private->bytes_per_second == 0.0) && (private->files_per_second == 0.0)) {
+		private->bytes_per_second = bytes_per_second;
+		private->files_per_second = files_per_second;
+	}
+	else {
+		private->bytes_per_second += RATE_SMOOTHING * (bytes_per_second - private->bytes_per_second);
+		private->files_per_second += RATE_SMOOTHING * (files_per_second - private->files_per_second);
+	}
+
+	private->rate_sample_time = now;
+	private->rate_sample_bytes = completed_bytes;
+	private->rate_sample_files = completed_files;
+}
+
+
 static gboolean
 _fr_archive_update_progress_cb (gpointer user_data)
 {
-	FrArchive *archive = user_data;
+	FrArchive        *archive = user_data;
+	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
+
+	/* the scan found the first file, the files are being added now */
+
+	if (private->scanning_files && (fr_archive_progress_get_total_files (archive) > 0)) {
+		private->scanning_files = FALSE;
+		fr_archive_action_started (archive, FR_ACTION_ADDING_FILES);
+	}
+
+	_fr_archive_sample_progress_rate (archive);
 	fr_archive_progress (archive, fr_archive_progress_get_fraction (archive));
+
 	return TRUE;
 }
 
@@ -851,8 +939,10 @@ static void
 _fr_archive_activate_progress_update (FrArchive *archive)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
-	if (private->progress_event == 0)
+	if (private->progress_event == 0) {
+		_fr_archive_reset_progress_rate (archive);
 		private->progress_event = g_timeout_add (PROGRESS_DELAY, _fr_archive_update_progress_cb, archive);
+	}
 }
 
 
@@ -890,6 +980,7 @@ fr_archive_operation_finish (FrArchive     *archive,
 		g_source_remove (private->progress_event);
 		private->progress_event = 0;
 	}
+	private->scanning_files = FALSE;
 
 	success = ! g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), error);
 
@@ -935,6 +1026,10 @@ typedef struct {
 	FileFilter          *include_files_filter;
 	FileFilter          *exclude_files_filter;
 	FileFilter          *exclude_directories_filter;
+	GList               *file_list;
+	FileListFlags        scan_flags;
+	FilterMatchCallback  directory_filter_func;
+	FilterMatchCallback  file_filter_func;
 } AddData;
 
 
@@ -944,6 +1039,7 @@ add_data_free (AddData *add_data)
 	file_filter_unref (add_data->include_files_filter);
 	file_filter_unref (add_data->exclude_files_filter);
 	file_filter_unref (add_data->exclude_directories_filter);
+	_g_object_list_unref (add_data->file_list);
 	_g_object_unref (add_data->base_dir);
 	g_free (add_data->dest_dir);
 	g_free (add_data->password);
@@ -1024,6 +1120,118 @@ fr_archive_add_files_ready_cb (GList    *file_info_list, /* FileInfo list */
 }
 
 
+static void
+_fr_archive_scan_and_add_files (FrArchive *archive,
+				AddData   *add_data)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
+
+	archive->files_to_add_size = 0;
+
+	/* FR_ACTION_ADDING_FILES is started by the progress timer when the
+	 * first file is found */
+
+	private->scanning_files = TRUE;
+	_fr_archive_activate_progress_update (archive);
+
+	/* add_data is freed by the archive when the operation is completed */
+
+	FR_ARCHIVE_GET_CLASS (archive)->scan_and_add_files (archive,
+							    add_data->file_list,
+							    add_data->scan_flags,
+							    add_data->directory_filter_func,
+							    add_data->file_filter_func,
+							    add_data,
+							    (GDestroyNotify) add_data_free,
+							    add_data->base_dir,
+							    add_data->dest_dir,
+							    add_data->follow_links,
+							    add_data->password,
+							    add_data->encrypt_header,
+							    add_data->compression,
+							    add_data->volume_size,
+							    add_data->cancellable,
+							    add_data->callback,
+							    add_data->user_data);
+}
+
+
+static void
+_fr_archive_query_files_info (FrArchive *archive,
+			      AddData   *add_data)
+{
+	_g_file_list_query_info_async (add_data->file_list,
+				       add_data->scan_flags,
+				       (G_FILE_ATTRIBUTE_STANDARD_NAME ","
+					G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+					G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
+					G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP),
+				       add_data->cancellable,
+				       add_data->directory_filter_func,
+				       add_data->file_filter_func,
+				       fr_archive_add_files_ready_cb,
+				       add_data);
+}
+
+
+static void
+archive_file_query_info_ready_cb (GObject      *source_object,
+				  GAsyncResult *result,
+				  gpointer      user_data)
+{
+	AddData   *add_data = user_data;
+	GFileInfo *info;
+	GError    *error = NULL;
+
+	/* the files can be added while the directories are being scanned
+	 * only when creating a new archive, otherwise the files to replace
+	 * must be known before the archive is rewritten */
+
+	info = g_file_query_info_finish (G_FILE (source_object), result, &error);
+	if ((info == NULL) && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+		_fr_archive_scan_and_add_files (add_data->archive, add_data);
+	else
+		_fr_archive_query_files_info (add_data->archive, add_data);
+
+	_g_object_unref (info);
+	_g_error_free (error);
+}
+
+
+static void
+_fr_archive_add_files_start (FrArchive           *archive,
+			     AddData             *add_data,
+			     GList               *file_list,
+			     FileListFlags        flags,
+			     FilterMatchCallback  directory_filter_func,
+			     FilterMatchCallback  file_filter_func)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (archive);
+
+	add_data->file_list = _g_object_list_ref (file_list);
+	add_data->scan_flags = flags;
+	add_data->directory_filter_func = directory_filter_func;
+	add_data->file_filter_func = file_filter_func;
+
+	fr_archive_action_started (archive, FR_ACTION_GETTING_FILE_LIST);
+
+	if ((FR_ARCHIVE_GET_CLASS (archive)->scan_and_add_files != NULL)
+	    && ((archive->files == NULL) || (archive->files->len == 0)))
+	{
+		g_file_query_info_async (private->file,
+					 G_FILE_ATTRIBUTE_STANDARD_TYPE,
+					 G_FILE_QUERY_INFO_NONE,
+					 G_PRIORITY_DEFAULT,
+					 add_data->cancellable,
+					 archive_file_query_info_ready_cb,
+					 add_data);
+		return;
+	}
+
+	_fr_archive_query_files_info (archive, add_data);
+}
+
+
 void
 fr_archive_add_files (FrArchive           *archive,
 		      GList               *file_list,
@@ -1058,19 +1266,12 @@ fr_archive_add_files (FrArchive           *archive,
 	add_data->callback = callback;
 	add_data->user_data = user_data;
 
-	fr_archive_action_started (archive, FR_ACTION_GETTING_FILE_LIST);
-
-	_g_file_list_query_info_async (file_list,
-				       FILE_LIST_RECURSIVE | FILE_LIST_NO_BACKUP_FILES,
-				       (G_FILE_ATTRIBUTE_STANDARD_NAME ","
-					G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-					G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
-					G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP),
-				       cancellable,
-				       NULL,
-				       NULL,
-				       fr_archive_add_files_ready_cb,
-				       add_data);
+	_fr_archive_add_files_start (archive,
+				     add_data,
+				     file_list,
+				     FILE_LIST_RECURSIVE | FILE_LIST_NO_BACKUP_FILES,
+				     NULL,
+				     NULL);
 }
 
 
@@ -1144,22 +1345,59 @@ fr_archive_add_files_with_filter (FrArchive           *archive,
 	add_data->exclude_files_filter = file_filter_new (exclude_files);
 	add_data->exclude_directories_filter = file_filter_new (exclude_directories);
 
-	fr_archive_action_started (archive, FR_ACTION_GETTING_FILE_LIST);
-
 	flags = FILE_LIST_RECURSIVE | FILE_LIST_NO_BACKUP_FILES;
 	if (! follow_links)
 		flags |= FILE_LIST_NO_FOLLOW_LINKS;
-	_g_file_list_query_info_async (file_list,
-				       flags,
-				       (G_FILE_ATTRIBUTE_STANDARD_NAME ","
-					G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-					G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
-					G_FILE_ATTRIBUTE_STANDARD_IS_BACKUP),
-				       cancellable,
-				       directory_filter_cb,
-				       file_filter_cb,
-				       fr_archive_add_files_ready_cb,
-				       add_data);
+
+	_fr_archive_add_files_start (archive,
+				     add_data,
+				     file_list,
+				     flags,
+				     directory_filter_cb,
+				     file_filter_cb);
+}
+
+
+/* Whether the entries of @source can be copied directly into @archive,
+ * without extracting them to a temporary directory. */
+gboolean
+fr_archive_can_add_archive (FrArchive *archive,
+			    FrArchive *source)
+{
+	if (FR_ARCHIVE_GET_CLASS (archive)->add_archive == NULL)
+		return FALSE;
+
+	return G_OBJECT_TYPE (archive) == G_OBJECT_TYPE (source);
+}
+
+
+void
+fr_archive_add_archive (FrArchive           *archive,
+			FrArchive           *source,
+			const char          *source_password,
+			const char          *password,
+			gboolean             encrypt_header,
+			FrCompression        compression,
+			guint                volume_size,
+			GCancellable        *cancellable,
+			GAsyncReadyCallback  callback,
+			gpointer             user_data)
+{
+	g_return_if_fail (! archive->read_only);
+
+	fr_archive_action_started (archive, FR_ACTION_ADDING_FILES);
+	_fr_archive_activate_progress_update (archive);
+
+	FR_ARCHIVE_GET_CLASS (archive)->add_archive (archive,
+						     source,
+						     source_password,
+						     password,
+						     encrypt_header,
+						     compression,
+						     volume_size,
+						     cancellable,
+						     callback,
+						     user_data);
 }
 
 
@@ -2022,24 +2260,25 @@ fr_archive_progress_set_total_files (FrArchive *self,
 				     int        n_files)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	g_mutex_lock (&private->progress_mutex);
-	private->total_files = n_files;
-	private->completed_files = 0;
-	g_mutex_unlock (&private->progress_mutex);
+	g_atomic_int_set (&private->total_files, n_files);
+	g_atomic_int_set (&private->completed_files, 0);
 }
 
 
-int
-fr_archive_progress_get_total_files (FrArchive *self)
+void
+fr_archive_progress_inc_total_files (FrArchive *self,
+				     int        new_total)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	int result;
+	g_atomic_int_add (&private->total_files, new_total);
+}
 
-	g_mutex_lock (&private->progress_mutex);
-	result = private->total_files;
-	g_mutex_unlock (&private->progress_mutex);
 
-	return result;
+int
+fr_archive_progress_get_total_files (FrArchive *self)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (self);
+	return g_atomic_int_get (&private->total_files);
 }
 
 
@@ -2047,13 +2286,7 @@ int
 fr_archive_progress_get_completed_files (FrArchive *self)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	int result;
-
-	g_mutex_lock (&private->progress_mutex);
-	result = private->completed_files;
-	g_mutex_unlock (&private->progress_mutex);
-
-	return result;
+	return g_atomic_int_get (&private->completed_files);
 }
 
 
@@ -2062,19 +2295,14 @@ fr_archive_progress_inc_completed_files (FrArchive *self,
 		 	 	 	 int        new_completed)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	double fraction;
+	int completed_files;
+	int total_files;
 
-	g_mutex_lock (&private->progress_mutex);
-	private->completed_files += new_completed;
-	if (private->total_files > 0)
-		fraction = FILES_FRACTION (self);
-	else
-		fraction = 0.0;
-	/*g_print ("%d / %d  : %f\n", private->completed_files, private->total_files + 1, fraction);*/
-	g_mutex_unlock (&private->progress_mutex);
-
-	return fraction;
+	completed_files = g_atomic_int_add (&private->completed_files, new_completed) + new_completed;
+	total_files = g_atomic_int_get (&private->total_files);
+	/*g_print ("%d / %d  : %f\n", completed_files, total_files + 1, FILES_FRACTION (completed_files, total_files));*/
 
+	return (total_files > 0) ? FILES_FRACTION (completed_files, total_files) : 0.0;
 }
 
 
@@ -2083,28 +2311,31 @@ fr_archive_progress_set_total_bytes (FrArchive *self,
 				     gsize      total)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	g_mutex_lock (&private->progress_mutex);
-	private->total_bytes = total;
-	private->completed_bytes = 0;
-	g_mutex_unlock (&private->progress_mutex);
+	g_atomic_pointer_set (&private->total_bytes, total);
+	g_atomic_pointer_set (&private->completed_bytes, 0);
+}
+
+
+void
+fr_archive_progress_inc_total_bytes (FrArchive *self,
+				     gsize      new_total)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (self);
+	g_atomic_pointer_add (&private->total_bytes, new_total);
 }
 
 
 static double
-_set_completed_bytes (FrArchive *self,
-		      gsize      completed_bytes)
+_get_bytes_fraction (FrArchive *self,
+		     gsize      completed_bytes)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	double fraction;
+	gsize total_bytes;
 
-	private->completed_bytes = completed_bytes;
-	if (private->total_bytes > 0)
-		fraction = BYTES_FRACTION (self);
-	else
-		fraction = 0.0;
-	/*g_print ("%" G_GSIZE_FORMAT " / %" G_GSIZE_FORMAT "  : %f\n", private->completed_bytes, private->total_bytes + 1, fraction);*/
+	total_bytes = (gsize) g_atomic_pointer_get (&private->total_bytes);
+	/*g_print ("%" G_GSIZE_FORMAT " / %" G_GSIZE_FORMAT "  : %f\n", completed_bytes, total_bytes + 1, BYTES_FRACTION (completed_bytes, total_bytes));*/
 
-	return fraction;
+	return (total_bytes > 0) ? BYTES_FRACTION (completed_bytes, total_bytes) : 0.0;
 }
 
 
@@ -2113,13 +2344,8 @@ fr_archive_progress_set_completed_bytes (FrArchive *self,
 					 gsize      completed_bytes)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	double fraction;
-
-	g_mutex_lock (&private->progress_mutex);
-	fraction = _set_completed_bytes (self, completed_bytes);
-	g_mutex_unlock (&private->progress_mutex);
-
-	return fraction;
+	g_atomic_pointer_set (&private->completed_bytes, completed_bytes);
+	return _get_bytes_fraction (self, completed_bytes);
 }
 
 double
@@ -2127,13 +2353,10 @@ fr_archive_progress_inc_completed_bytes (FrArchive *self,
 					 gsize      new_completed)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
-	double fraction;
-
-	g_mutex_lock (&private->progress_mutex);
-	fraction = _set_completed_bytes (self, private->completed_bytes + new_completed);
-	g_mutex_unlock (&private->progress_mutex);
+	gsize completed_bytes;
 
-	return fraction;
+	completed_bytes = (gsize) g_atomic_pointer_add (&private->completed_bytes, new_completed) + new_completed;
+	return _get_bytes_fraction (self, completed_bytes);
 }
 
 
@@ -2141,25 +2364,75 @@ double
 fr_archive_progress_get_fraction (FrArchive *self)
 {
 	FrArchivePrivate *private = fr_archive_get_instance_private (self);
+	gsize total_bytes;
+	gsize completed_bytes;
+	int   total_files;
+	int   completed_files;
 	double fraction;
 
-	g_mutex_lock (&private->progress_mutex);
-	if ((private->total_bytes > 0) && (private->completed_bytes > 0)) {
-		fraction = BYTES_FRACTION (self);
-		/*g_print ("%" G_GSIZE_FORMAT " / %" G_GSIZE_FORMAT "  : %f\n", private->completed_bytes, private->total_bytes + 1, fraction);*/
+	total_bytes = (gsize) g_atomic_pointer_get (&private->total_bytes);
+	completed_bytes = (gsize) g_atomic_pointer_get (&private->completed_bytes);
+	total_files = g_atomic_int_get (&private->total_files);
+	completed_files = g_atomic_int_get (&private->completed_files);
+
+	if ((total_bytes > 0) && (completed_bytes > 0)) {
+		fraction = BYTES_FRACTION (completed_bytes, total_bytes);
+		/*g_print ("%" G_GSIZE_FORMAT " / %" G_GSIZE_FORMAT "  : %f\n", completed_bytes, total_bytes + 1, fraction);*/
 	}
-	else if (private->total_files > 0) {
-		fraction = FILES_FRACTION (self);
-		/*g_print ("%d / %d  : %f\n", private->completed_files, private->total_files + 1, fraction);*/
+	else if (total_files > 0) {
+		fraction = FILES_FRACTION (completed_files, total_files);
+		/*g_print ("%d / %d  : %f\n", completed_files, total_files + 1, fraction);*/
 	}
 	else
 		fraction = 0.0;
-	g_mutex_unlock (&private->progress_mutex);
 
 	return fraction;
 }
 
 
+/* Returns the rates measured by the progress timer of the current
+ * operation and the estimated time left, -1 if unknown or longer than
+ * MAX_REMAINING_SECONDS, as with a very low rate at the start.  Returns
+ * FALSE until the first rate is available.  Call from the main thread. */
+gboolean
+fr_archive_progress_get_rate (FrArchive *self,
+			      double    *bytes_per_second,
+			      double    *files_per_second,
+			      gint64    *remaining_seconds)
+{
+	FrArchivePrivate *private = fr_archive_get_instance_private (self);
+	gsize  total_bytes;
+	gsize  completed_bytes;
+	int    total_files;
+	int    completed_files;
+	double remaining = -1.0;
+
+	if (bytes_per_second != NULL)
+		*bytes_per_second = private->bytes_per_second;
+	if (files_per_second != NULL)
+		*files_per_second = private->files_per_second;
+
+	total_bytes = (gsize) g_atomic_pointer_get (&private->total_bytes);
+	completed_bytes = (gsize) g_atomic_pointer_get (&private->completed_bytes);
+	total_files = g_atomic_int_get (&private->total_files);
+	completed_files = g_atomic_int_get (&private->completed_files);
+
+	if ((total_bytes > 0) && (completed_bytes > 0)) {
+		if ((private->bytes_per_second > 0.0) && (completed_bytes <= total_bytes))
+			remaining = (total_bytes - completed_bytes) / private->bytes_per_second;
+	}
+	else if (total_files > 0) {
+		if ((private->files_per_second > 0.0) && (completed_files <= total_files))
+			remaining = (total_files - completed_files) / private->files_per_second;
+	}
+
+	if (remaining_seconds != NULL)
+		*remaining_seconds = ((remaining >= 0.0) && (remaining <= MAX_REMAINING_SECONDS)) ? (gint64) remaining : -1;
+
+	return (private->bytes_per_second > 0.0) || (private->files_per_second > 0.0);
+}
+
+
 void
 fr_archive_add_file (FrArchive *self,
 		     FrFileData *file_data)
@@ -24,6 +24,7 @@
 
 #include <glib.h>
 #include "fr-file-data.h"
+#include "gio-utils.h"
 #include "typedefs.h"
 
 typedef enum {
@@ -275,6 +276,33 @@ struct _FrArchiveClass {
 					    GCancellable        *cancellable,
 					    GAsyncReadyCallback  callback,
 					    gpointer             user_data);
+	void          (*scan_and_add_files)(FrArchive           *archive,
+					    GList               *file_list, /* GFile list */
+					    FileListFlags        scan_flags,
+					    FilterMatchCallback  directory_filter_func,
+					    FilterMatchCallback  file_filter_func,
+					    gpointer             filter_data,
+					    GDestroyNotify       filter_data_notify,
+					    GFile               *base_dir,
+					    const char          *dest_dir,
+					    gboolean             follow_links,
+					    const char          *password,
+					    gboolean             encrypt_header,
+					    FrCompression        compression,
+					    guint                volume_size,
+					    GCancellable        *cancellable,
+					    GAsyncReadyCallback  callback,
+					    gpointer             user_data);
+	void          (*add_archive)       (FrArchive           *archive,
+					    FrArchive           *source,
+					    const char          *source_password,
+					    const char          *password,
+					    gboolean             encrypt_header,
+					    FrCompression        compression,
+					    guint                volume_size,
+					    GCancellable        *cancellable,
+					    GAsyncReadyCallback  callback,
+					    gpointer             user_data);
 	void          (*extract_files)     (FrArchive           *archive,
 	    				    GList               *file_list,
 	    				    GFile               *destination,
@@ -437,6 +465,19 @@ void          fr_archive_add_files_with_filter   (FrArchive           *archive,
 						  GAsyncReadyCallback  callback,
 						  gpointer             user_data);
 
+gboolean      fr_archive_can_add_archive         (FrArchive           *archive,
+						  FrArchive           *source);
+void          fr_archive_add_archive             (FrArchive           *archive,
+						  FrArchive           *source,
+						  const char          *source_password,
+						  const char          *password,
+						  gboolean             encrypt_header,
+						  FrCompression        compression,
+						  guint                volume_size,
+						  GCancellable        *cancellable,
+						  GAsyncReadyCallback  callback,
+						  gpointer             user_data);
+
 /**
  * fr_archive_remove:
  * @file_list: (element-type GFile)
@@ -569,6 +610,8 @@ void          fr_archive_working_archive         (FrArchive           *archive,
 						  const char          *archive_name);
 void          fr_archive_progress_set_total_files(FrArchive           *archive,
 						  int                  total);
+void          fr_archive_progress_inc_total_files(FrArchive           *archive,
+						  int                  new_total);
 int           fr_archive_progress_get_total_files(FrArchive           *archive);
 int           fr_archive_progress_get_completed_files
 						 (FrArchive           *archive);
@@ -577,6 +620,8 @@ double        fr_archive_progress_inc_completed_files
 						  int                  new_completed);
 void          fr_archive_progress_set_total_bytes (FrArchive           *archive,
 						  gsize                total);
+void          fr_archive_progress_inc_total_bytes (FrArchive           *archive,
+						  gsize                new_total);
 double        fr_archive_progress_set_completed_bytes
 						 (FrArchive           *self,
 						  gsize                completed_bytes);
@@ -584,6 +629,10 @@ double        fr_archive_progress_inc_completed_bytes
 						 (FrArchive           *archive,
 						  gsize                new_completed);
 double        fr_archive_progress_get_fraction   (FrArchive           *archive);
+gboolean      fr_archive_progress_get_rate       (FrArchive           *archive,
+						  double              *bytes_per_second,
+						  double              *files_per_second,
+						  gint64              *remaining_seconds);
 void          fr_archive_add_file                (FrArchive           *archive,
 						  FrFileData *file_data);
 
@@ -603,11 +603,7 @@ fr_command_7z_get_mime_types (FrArchive *archive)
 
 
 static gboolean
-check_info_subcommand_for_codec_support (char *program_name, char *codec_name) {
-	if (! _g_program_is_in_path (program_name)) {
-		return FALSE;
-	}
-
+run_info_subcommand_for_codec_support (char *program_name, char *codec_name) {
 	g_autofree gchar *standard_output = NULL;
 
 	gchar* argv[] = {
@@ -642,6 +638,28 @@ check_info_subcommand_for_codec_support (char *program_name, char *codec_name) {
 }
 
 
+static gboolean
+check_info_subcommand_for_codec_support (char *program_name, char *codec_name) {
+	if (! _g_program_is_in_path (program_name)) {
+		return FALSE;
+	}
+
+	/* running the program is slow, the result is cached together with
+	 * the programs in the path, but only in memory: installing a codec
+	 * plugin doesn't change the path. */
+	g_autofree gchar *cache_key = g_strconcat (program_name, ":", codec_name, NULL);
+	gboolean result;
+
+	if (_g_programs_cache_lookup (cache_key, &result))
+		return result;
+
+	result = run_info_subcommand_for_codec_support (program_name, codec_name);
+	_g_programs_cache_insert (cache_key, result, FALSE);
+
+	return result;
+}
+
+
 static gboolean
 has_rar_support (gboolean check_command)
 {
@@ -97,104 +97,411 @@ get_uncompressed_name_from_archive (FrCommand  *comm,
 }
 
 
-static void
-list__process_line (char     *line,
-		    gpointer  data)
+static gboolean
+read_at_offset (GInputStream *stream,
+		goffset       offset,
+		guchar       *buffer,
+		gsize         size)
 {
-	FrCommand  *comm = FR_COMMAND (data);
-	FrFileData *fdata;
-	char      **fields;
-	GFile      *file;
-	char       *filename;
+	gsize bytes_read;
 
-	fdata = fr_file_data_new ();
+	if ((offset < 0) || ! g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL, NULL))
+		return FALSE;
 
-	fields = _g_str_split_line (line, 2);
-	if (strcmp (fields[1], "-1") != 0)
-		fdata->size = g_ascii_strtoull (fields[1], NULL, 10);
-	g_strfreev (fields);
+	return g_input_stream_read_all (stream, buffer, size, &bytes_read, NULL, NULL) && (bytes_read == size);
+}
 
-	file = g_file_new_for_path (comm->filename);
 
-	if (fdata->size == 0)
-		fdata->size = _g_file_get_file_size (file);
+static guint32
+get_le32 (const guchar *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((guint32) data[3] << 24);
+}
+
+
+static guint64
+get_le64 (const guchar *data)
+{
+	return get_le32 (data) | ((guint64) get_le32 (data + 4) << 32);
+}
+
+
+static goffset
+get_gzip_uncompressed_size (GInputStream *stream,
+			    goffset       file_size)
+{
+	guchar  trailer[4];
+	goffset size;
+	goffset compressed_size;
+
+	if ((file_size < 18) || ! read_at_offset (stream, file_size - 4, trailer, 4))
+		return -1;
+
+	/* ISIZE is the size modulo 2^32, a value smaller than the deflate
+	 * data means that it wrapped around, and the real size is unknown.
+	 * Deflate expands incompressible data only by the 5 bytes header of
+	 * each stored block. */
+
+	size = get_le32 (trailer);
+	compressed_size = file_size - 18;
+	if (size < compressed_size - 5 * (compressed_size / 65535 + 1))
+		return -1;
+
+	return size;
+}
+
+
+static gboolean
+read_xz_varint (const guchar **p,
+		const guchar  *end,
+		guint64       *value)
+{
+	int i;
+
+	*value = 0;
+	for (i = 0; (i < 9) && (*p < end); i++) {
+		guchar b = *(*p)++;
+
+		*value |= (guint64) (b & 0x7F) << (i * 7);
+		if ((b & 0x80) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/* Sums the uncompressed sizes stored in the index of each stream,
+ * walking the concatenated streams backwards from the end of the file. */
+static goffset
+get_xz_uncompressed_size (GInputStream *stream,
+			  goffset       file_size)
+{
+	goffset pos = file_size;
+	goffset total = 0;
+
+	while (pos > 0) {
+		guchar        footer[12];
+		guint64       index_size;
+		guint64       blocks_size = 0;
+		guint64       n_records;
+		guint64       i;
+		guchar       *index;
+		const guchar *p;
+		const guchar *end;
+		gboolean      valid;
+
+		/* skip the stream padding */
+
+		for (;;) {
+			if ((pos < 24) || ! read_at_offset (stream, pos - 4, footer, 4))
+				return -1;
+			if (get_le32 (footer) != 0)
+				break;
+			pos -= 4;
+		}
+
+		if (! read_at_offset (stream, pos - 12, footer, 12))
+			return -1;
+		if ((footer[10] != 'Y') || (footer[11] != 'Z'))
+			return -1;
+
+		index_size = ((guint64) get_le32 (footer + 4) + 1) * 4;
+		if (index_size > (guint64) pos - 24)
+			return -1;
+
+		index = g_malloc (index_size);
+		valid = read_at_offset (stream, pos - 12 - index_size, index, index_size);
+		p = index;
+		end = index + index_size;
+		valid = valid && (*p++ == 0) && read_xz_varint (&p, end, &n_records);
+		for (i = 0; valid && (i < n_records); i++) {
+			guint64 unpadded_size;
+			guint64 uncompressed_size;
+
+			valid = read_xz_varint (&p, end, &unpadded_size)
+				&& read_xz_varint (&p, end, &uncompressed_size);
+			if (valid) {
+				blocks_size += (unpadded_size + 3) & ~G_GUINT64_CONSTANT (3);
+				total += uncompressed_size;
+			}
+		}
+		g_free (index);
+
+		if (! valid || (blocks_size > (guint64) pos - 24 - index_size))
+			return -1;
+
+		pos -= 12 + index_size + blocks_size + 12;
+	}
+
+	return total;
+}
+
+
+/* Uses the frame content size, which zstd stores when the input size is
+ * known in advance.  Frames written by pzstd are preceded by a skippable
+ * frame holding their compressed size, which allows to sum all of them. */
+static goffset
+get_zstd_uncompressed_size (GInputStream *stream,
+			    goffset       file_size)
+{
+	static const int dict_id_size[] = { 0, 1, 2, 4 };
+	goffset pos = 0;
+	goffset frame_end = 0;
+	goffset total = 0;
+
+	while (pos + 6 <= file_size) {
+		guchar  header[18];
+		gsize   header_size;
+		guint32 magic;
+		guchar  descriptor;
+		gsize   offset;
+		gsize   fcs_size;
+
+		header_size = MIN (sizeof (header), (gsize) (file_size - pos));
+		if (! read_at_offset (stream, pos, header, header_size))
+			return -1;
+
+		magic = get_le32 (header);
+		if ((magic & 0xFFFFFFF0) == 0x184D2A50) {
+			guint32 skip = get_le32 (header + 4);
+
+			if ((skip == 4) && (header_size >= 12))
+				frame_end = pos + 12 + get_le32 (header + 8);
+			pos += 8 + (goffset) skip;
+			continue;
+		}
+		if (magic != 0xFD2FB528)
+			return -1;
+
+		descriptor = header[4];
+		offset = 5 + (((descriptor & 0x20) == 0) ? 1 : 0) + dict_id_size[descriptor & 0x03];
+		switch (descriptor >> 6) {
+		case 0:
+			fcs_size = ((descriptor & 0x20) != 0) ? 1 : 0;
+			break;
+		case 1:
+			fcs_size = 2;
+			break;
+		case 2:
+			fcs_size = 4;
+			break;
+		default:
+			fcs_size = 8;
+			break;
+		}
+		if ((fcs_size == 0) || (offset + fcs_size > header_size))
+			return -1;
+
+		switch (fcs_size) {
+		case 1:
+			total += header[offset];
+			break;
+		case 2:
+			total += (header[offset] | (header[offset + 1] << 8)) + 256;
+			break;
+		case 4:
+			total += get_le32 (header + offset);
+			break;
+		default:
+			total += get_le64 (header + offset);
+			break;
+		}
+
+		/* without a size hint the frame cannot be skipped without
+		 * decoding the block headers, assume it is the last one. */
+
+		if (frame_end <= pos)
+			break;
+		pos = frame_end;
+	}
+
+	return total;
+}
+
+
+static goffset
+get_lz4_uncompressed_size (GInputStream *stream,
+			   goffset       file_size)
+{
+	guchar header[14];
+
+	if ((file_size < 14) || ! read_at_offset (stream, 0, header, 14))
+		return -1;
+	if (get_le32 (header) != 0x184D2204)
+		return -1;
+
+	/* FLG.ContentSize */
+	if ((header[4] & 0x08) == 0)
+		return -1;
+
+	return get_le64 (header + 6);
+}
+
+
+static goffset
+get_lzma_uncompressed_size (GInputStream *stream,
+			    goffset       file_size)
+{
+	guchar  header[13];
+	guint64 size;
+
+	if ((file_size < 13) || ! read_at_offset (stream, 0, header, 13))
+		return -1;
+
+	size = get_le64 (header + 5);
+	if (size == G_MAXUINT64)
+		return -1;
+
+	return size;
+}
+
+
+/* Sums the data size stored in the trailer of each member, walking the
+ * members backwards from the end of the file. */
+static goffset
+get_lzip_uncompressed_size (GInputStream *stream,
+			    goffset       file_size)
+{
+	goffset pos = file_size;
+	goffset total = 0;
+
+	while (pos > 0) {
+		guchar  trailer[20];
+		guint64 member_size;
+
+		if ((pos < 26) || ! read_at_offset (stream, pos - 20, trailer, 20))
+			return -1;
+
+		member_size = get_le64 (trailer + 12);
+		if ((member_size < 26) || (member_size > (guint64) pos))
+			return -1;
+
+		total += get_le64 (trailer + 4);
+		pos -= member_size;
+
+		if (! read_at_offset (stream, pos, trailer, 4) || (memcmp (trailer, "LZIP", 4) != 0))
+			return -1;
+	}
+
+	return total;
+}
+
+
+/* Returns the uncompressed size stored in the headers or in the trailers
+ * of the compressed file, or -1 if the format does not store it. */
+static goffset
+get_uncompressed_size_from_archive (FrCommand *comm,
+				    GFile     *file,
+				    goffset    file_size)
+{
+	const char   *mime_type = FR_ARCHIVE (comm)->mime_type;
+	GInputStream *stream;
+	goffset       size = -1;
+
+	stream = (GInputStream *) g_file_read (file, NULL, NULL);
+	if (stream == NULL)
+		return -1;
+
+	if (_g_mime_type_matches (mime_type, "application/x-gzip"))
+		size = get_gzip_uncompressed_size (stream, file_size);
+	else if (_g_mime_type_matches (mime_type, "application/x-xz"))
+		size = get_xz_uncompressed_size (stream, file_size);
+	else if (_g_mime_type_matches (mime_type, "application/zstd"))
+		size = get_zstd_uncompressed_size (stream, file_size);
+	else if (_g_mime_type_matches (mime_type, "application/x-lz4"))
+		size = get_lz4_uncompressed_size (stream, file_size);
+	else if (_g_mime_type_matches (mime_type, "application/x-lzma"))
+		size = get_lzma_uncompressed_size (stream, file_size);
+	else if (_g_mime_type_matches (mime_type, "application/x-lzip"))
+		size = get_lzip_uncompressed_size (stream, file_size);
+
+	g_object_unref (stream);
+
+	return size;
+}
+
+
+static gboolean
+fr_command_cfile_list (FrCommand *comm)
+{
+	FrFileData *fdata;
+	char       *filename;
+	GFile      *file;
+
+	fdata = fr_file_data_new ();
 
 	filename = get_uncompressed_name_from_archive (comm, comm->filename);
 	if (filename == NULL)
 		filename = _g_path_remove_first_extension (comm->filename);
-
-	fdata->full_path = g_strconcat ("/", _g_path_get_basename (filename), NULL);
+	fdata->full_path = g_strconcat ("/",
+					_g_path_get_basename (filename),
+					NULL);
 	g_free (filename);
 
+	file = g_file_new_for_path (comm->filename);
+
 	fdata->original_path = fdata->full_path + 1;
 	fdata->link = NULL;
+	fdata->size = _g_file_get_file_size (file);
 	fdata->modified = _g_file_get_file_mtime (file);
-
 	fdata->name = g_strdup (_g_path_get_basename (fdata->full_path));
 	fdata->path = _g_path_remove_level (fdata->full_path);
 
+	/* use the archive size when the format does not store the
+	 * uncompressed size, suboptimal but there is no alternative. */
+
+	if (fdata->size > 0) {
+		goffset size = get_uncompressed_size_from_archive (comm, file, fdata->size);
+		if (size >= 0)
+			fdata->size = size;
+	}
+
 	if (*fdata->name == 0)
 		fr_file_data_free (fdata);
 	else
 		fr_archive_add_file (FR_ARCHIVE (comm), fdata);
 
 	g_object_unref (file);
+
+	return FALSE;
 }
 
 
-static gboolean
-fr_command_cfile_list (FrCommand *comm)
+/* The command line that writes the compressed or the uncompressed data
+ * to the standard output. */
+static const char *
+get_filter_command (FrArchive *archive,
+		    gboolean   decompress)
 {
-	if (_g_mime_type_matches (FR_ARCHIVE (comm)->mime_type, "application/x-gzip")) {
-		/* gzip let us known the uncompressed size */
-
-		fr_process_set_out_line_func (comm->process,
-					      list__process_line,
-					      comm);
-
-		fr_process_begin_command (comm->process, "gzip");
-		fr_process_add_arg (comm->process, "-l");
-		fr_process_add_arg (comm->process, "-q");
-		fr_process_add_arg (comm->process, comm->filename);
-		fr_process_end_command (comm->process);
-	}
-	else {
-		/* ... other compressors do not support this feature so
-		 * simply use the archive size, suboptimal but there is no
-		 * alternative. */
-
-		FrFileData *fdata;
-		char     *filename;
-		GFile    *file;
-
-		fdata = fr_file_data_new ();
-
-		filename = _g_path_remove_first_extension (comm->filename);
-		fdata->full_path = g_strconcat ("/",
-						_g_path_get_basename (filename),
-						NULL);
-		g_free (filename);
-
-		file = g_file_new_for_path (comm->filename);
-
-		fdata->original_path = fdata->full_path + 1;
-		fdata->link = NULL;
-		fdata->size = _g_file_get_file_size (file);
-		fdata->modified = _g_file_get_file_mtime (file);
-		fdata->name = g_strdup (_g_path_get_basename (fdata->full_path));
-		fdata->path = _g_path_remove_level (fdata->full_path);
-
-		if (*fdata->name == 0)
-			fr_file_data_free (fdata);
-		else
-			fr_archive_add_file (FR_ARCHIVE (comm), fdata);
-
-		g_object_unref (file);
+	const char *mime_type = archive->mime_type;
 
-		return FALSE;
+	if (_g_mime_type_matches (mime_type, "application/x-gzip"))
+		return decompress ? "gzip -d -n -c" : "gzip -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-brotli"))
+		return decompress ? "brotli -d -c" : "brotli -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-bzip"))
+		return decompress ? "bzip2 -d -c" : "bzip2 -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-compress")) {
+		if (! decompress)
+			return "compress -c";
+		return _g_program_is_in_path ("gzip") ? "gzip -d -n -c" : "uncompress -c";
 	}
+	else if (_g_mime_type_matches (mime_type, "application/x-lzip"))
+		return decompress ? "lzip -d -c" : "lzip -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-lzma"))
+		return decompress ? "lzma -d -c" : "lzma -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-xz"))
+		return decompress ? "xz -d -T0 -c" : "xz -T0 -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-lzop"))
+		return decompress ? "lzop -d -c" : "lzop -c";
+	else if (_g_mime_type_matches (mime_type, "application/x-lz4"))
+		/* store the content size, used when listing the archive */
+		return decompress ? "lz4 -d -c" : "lz4 --content-size -c";
+	else if (_g_mime_type_matches (mime_type, "application/zstd"))
+		return decompress ? "zstd -d -c" : "zstd -T0 -c";
 
-	return TRUE;
+	return NULL;
 }
 
 
@@ -208,150 +515,82 @@ fr_command_cfile_add (FrCommand  *comm,
 {
 	FrArchive  *archive = FR_ARCHIVE (comm);
 	const char *filename;
-	char       *temp_dir;
-	char       *temp_file;
-	char       *compressed_filename;
+	char       *e_filename;
+	char       *archive_folder;
+	char       *tmp_dir;
+	char       *tmp_file;
+	char       *e_tmp_dir;
+	char       *e_tmp_file;
+	char       *compress;
 
 	if ((file_list == NULL) || (file_list->data == NULL))
 		return;
 
-	/* copy file to the temp dir */
+	/* compress the file without copying it to a temporary directory
+	 * first.  The output goes to a temporary file in the same folder,
+	 * moved over the archive only if the compression succeeds. */
 
-	temp_dir = _g_path_get_temp_work_dir (NULL);
 	filename = file_list->data;
-	temp_file = g_strconcat (temp_dir, "/", filename, NULL);
-
-	fr_process_begin_command (comm->process, "cp");
-	fr_process_set_working_dir (comm->process, base_dir);
-	fr_process_add_arg (comm->process, "-f");
-	fr_process_add_arg (comm->process, "--");
-	fr_process_add_arg (comm->process, filename);
-	fr_process_add_arg (comm->process, temp_file);
-	fr_process_end_command (comm->process);
+	e_filename = g_shell_quote (filename);
 
-	/**/
+	archive_folder = _g_path_remove_level (comm->filename);
+	tmp_dir = _g_path_get_temp_work_dir (archive_folder);
+	if (tmp_dir == NULL)
+		tmp_dir = _g_path_get_temp_work_dir (NULL);
+	g_free (archive_folder);
 
-	if (_g_mime_type_matches (archive->mime_type, "application/x-gzip")) {
-		fr_process_begin_command (comm->process, "gzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".gz", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-brotli")) {
-		fr_process_begin_command (comm->process, "brotli");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".br", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-bzip")) {
-		fr_process_begin_command (comm->process, "bzip2");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".bz2", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-compress")) {
-		fr_process_begin_command (comm->process, "compress");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".Z", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzip")) {
-		fr_process_begin_command (comm->process, "lzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".lz", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzma")) {
-		fr_process_begin_command (comm->process, "lzma");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".lzma", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-xz")) {
-		fr_process_begin_command (comm->process, "xz");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".xz", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzop")) {
-		fr_process_begin_command (comm->process, "lzop");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-fU");
-		fr_process_add_arg (comm->process, "--no-stdin");
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".lzo", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-rzip")) {
-		fr_process_begin_command (comm->process, "rzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".rz", NULL);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lz4")) {
-		compressed_filename = g_strconcat (filename, ".lz4", NULL);
-		fr_process_begin_command (comm->process, "lz4");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-z");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_add_arg (comm->process, compressed_filename);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/zstd")) {
-		fr_process_begin_command (comm->process, "zstd");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "--");
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-		compressed_filename = g_strconcat (filename, ".zst", NULL);
-	}
-	else {
-		g_warning ("Unhandled mime type: '%s'", archive->mime_type);
-		g_warn_if_reached ();
-		g_free (temp_file);
-		g_free (temp_dir);
+	if (tmp_dir == NULL) {
+		g_warning ("Could not create a temporary folder for '%s'", comm->filename);
+		g_free (e_filename);
 		return;
 	}
 
-      	/* copy compressed file to the dest dir */
+	tmp_file = g_build_filename (tmp_dir, _g_path_get_basename (comm->filename), NULL);
+	e_tmp_dir = g_shell_quote (tmp_dir);
+	e_tmp_file = g_shell_quote (tmp_file);
 
-	fr_process_begin_command (comm->process, "cp");
-	fr_process_set_working_dir (comm->process, temp_dir);
-	fr_process_add_arg (comm->process, "-f");
-	fr_process_add_arg (comm->process, "--");
-	fr_process_add_arg (comm->process, compressed_filename);
-	fr_process_add_arg (comm->process, comm->filename);
-	fr_process_end_command (comm->process);
+	if (_g_mime_type_matches (archive->mime_type, "application/x-rzip")) {
+		/* rzip needs seekable files, it cannot write to a pipe */
+		compress = g_strconcat ("rzip -k -f -o ", e_tmp_file, " ", e_filename, NULL);
+	}
+	else {
+		const char *command;
+
+		command = get_filter_command (archive, FALSE);
+		if (command == NULL) {
+			g_warning ("Unhandled mime type: '%s'", archive->mime_type);
+			g_warn_if_reached ();
+			rmdir (tmp_dir);
+			g_free (e_tmp_file);
+			g_free (e_tmp_dir);
+			g_free (tmp_file);
+			g_free (tmp_dir);
+			g_free (e_filename);
+			return;
+		}
 
-	/* remove the temp dir */
+		if (_g_mime_type_matches (archive->mime_type, "application/x-compress"))
+			compress = g_strconcat (command, " < ", e_filename, " > ", e_tmp_file, NULL);
+		else
+			compress = g_strconcat (command, " -- ", e_filename, " > ", e_tmp_file, NULL);
+	}
 
-	fr_process_begin_command (comm->process, "rm");
-	fr_process_set_sticky (comm->process, TRUE);
-	fr_process_add_arg (comm->process, "-rf");
-	fr_process_add_arg (comm->process, "--");
-	fr_process_add_arg (comm->process, temp_dir);
+	fr_process_begin_command (comm->process, "sh");
+	fr_process_set_working_dir (comm->process, base_dir);
+	fr_process_add_arg (comm->process, "-c");
+	fr_process_add_arg_concat (comm->process,
+				   compress,
+				   " && mv -f ", e_tmp_file, " ", comm->e_filename,
+				   "; r=$?; rm -rf ", e_tmp_dir, "; exit $r",
+				   NULL);
 	fr_process_end_command (comm->process);
 
-	g_free (compressed_filename);
-	g_free (temp_file);
-	g_free (temp_dir);
+	g_free (compress);
+	g_free (e_tmp_file);
+	g_free (e_tmp_dir);
+	g_free (tmp_file);
+	g_free (tmp_dir);
+	g_free (e_filename);
 }
 
 
@@ -373,157 +612,83 @@ fr_command_cfile_extract (FrCommand  *comm,
 			  gboolean    skip_older,
 			  gboolean    junk_paths)
 {
-	FrArchive *archive = FR_ARCHIVE (comm);
-	char      *temp_dir;
-	char      *dest_file;
-	char      *temp_file;
-	char      *uncompr_file;
-	char      *compr_file;
-
-	/* copy file to the temp dir, remove the already existing file first */
-
-	temp_dir = _g_path_get_temp_work_dir (NULL);
-	temp_file = g_strconcat (temp_dir,
+	FrArchive  *archive = FR_ARCHIVE (comm);
+	char       *uncompr_file;
+	char       *dest_file;
+	char       *e_dest_file;
+	char       *tmp_dir;
+	char       *tmp_file;
+	char       *e_tmp_dir;
+	char       *e_tmp_file;
+	char       *uncompress;
+
+	uncompr_file = get_uncompressed_name_from_archive (comm, comm->filename);
+	if (uncompr_file == NULL)
+		uncompr_file = _g_path_remove_first_extension (_g_path_get_basename (comm->filename));
+	dest_file = g_strconcat (dest_dir,
 				 "/",
-				 _g_path_get_basename (comm->filename),
+				 uncompr_file,
 				 NULL);
 
-	fr_process_begin_command (comm->process, "cp");
-	fr_process_add_arg (comm->process, "-f");
-	fr_process_add_arg (comm->process, comm->filename);
-	fr_process_add_arg (comm->process, temp_file);
-	fr_process_end_command (comm->process);
-
-	/* uncompress the file */
+	/* uncompress the file to a temporary file in the destination folder,
+	 * moved over the destination file only if the decompression
+	 * succeeds. */
 
-	uncompr_file = _g_path_remove_first_extension (temp_file);
+	tmp_dir = _g_path_get_temp_work_dir (dest_dir);
+	if (tmp_dir == NULL)
+		tmp_dir = _g_path_get_temp_work_dir (NULL);
 
-	if (_g_mime_type_matches (archive->mime_type, "application/x-gzip")) {
-		fr_process_begin_command (comm->process, "gzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, "-n");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-brotli")) {
-		fr_process_begin_command (comm->process, "brotli");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-bzip")) {
-		fr_process_begin_command (comm->process, "bzip2");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-compress")) {
-		if (_g_program_is_in_path ("gzip")) {
-			fr_process_begin_command (comm->process, "gzip");
-			fr_process_add_arg (comm->process, "-d");
-			fr_process_add_arg (comm->process, "-n");
-		}
-		else
-			fr_process_begin_command (comm->process, "uncompress");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzip")) {
-		fr_process_begin_command (comm->process, "lzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzma")) {
-		fr_process_begin_command (comm->process, "lzma");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-xz")) {
-		fr_process_begin_command (comm->process, "xz");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lzop")) {
-		fr_process_begin_command (comm->process, "lzop");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, "-fU");
-		fr_process_add_arg (comm->process, "--no-stdin");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-rzip")) {
-		fr_process_begin_command (comm->process, "rzip");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/x-lz4")) {
-		fr_process_begin_command (comm->process, "lz4");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_add_arg (comm->process, uncompr_file);
-		fr_process_end_command (comm->process);
-	}
-	else if (_g_mime_type_matches (archive->mime_type, "application/zstd")) {
-		fr_process_begin_command (comm->process, "zstd");
-		fr_process_set_working_dir (comm->process, temp_dir);
-		fr_process_add_arg (comm->process, "-f");
-		fr_process_add_arg (comm->process, "-d");
-		fr_process_add_arg (comm->process, temp_file);
-		fr_process_end_command (comm->process);
+	if (tmp_dir == NULL) {
+		g_warning ("Could not create a temporary folder for '%s'", dest_file);
+		g_free (dest_file);
+		g_free (uncompr_file);
+		return;
 	}
 
-	/* copy uncompress file to the dest dir */
+	tmp_file = g_build_filename (tmp_dir, uncompr_file, NULL);
+	e_tmp_dir = g_shell_quote (tmp_dir);
+	e_tmp_file = g_shell_quote (tmp_file);
 
-	compr_file = get_uncompressed_name_from_archive (comm, comm->filename);
-	if (compr_file == NULL)
-		compr_file = _g_path_remove_first_extension (_g_path_get_basename (comm->filename));
-	dest_file = g_strconcat (dest_dir,
-				 "/",
-				 compr_file,
-				 NULL);
+	if (_g_mime_type_matches (archive->mime_type, "application/x-rzip")) {
+		uncompress = g_strconcat ("rzip -d -k -f -o ", e_tmp_file, " ", comm->e_filename, NULL);
+	}
+	else {
+		const char *command;
+
+		command = get_filter_command (archive, TRUE);
+		if (command == NULL) {
+			rmdir (tmp_dir);
+			g_free (e_tmp_file);
+			g_free (e_tmp_dir);
+			g_free (tmp_file);
+			g_free (tmp_dir);
+			g_free (dest_file);
+			g_free (uncompr_file);
+			return;
+		}
 
-	fr_process_begin_command (comm->process, "cp");
-	fr_process_add_arg (comm->process, "-f");
-	fr_process_add_arg (comm->process, uncompr_file);
-	fr_process_add_arg (comm->process, dest_file);
-	fr_process_end_command (comm->process);
+		uncompress = g_strconcat (command, " < ", comm->e_filename, " > ", e_tmp_file, NULL);
+	}
 
-	/* remove the temp dir */
+	e_dest_file = g_shell_quote (dest_file);
 
-	fr_process_begin_command (comm->process, "rm");
-	fr_process_set_sticky (comm->process, TRUE);
-	fr_process_add_arg (comm->process, "-rf");
-	fr_process_add_arg (comm->process, temp_dir);
+	fr_process_begin_command (comm->process, "sh");
+	fr_process_add_arg (comm->process, "-c");
+	fr_process_add_arg_concat (comm->process,
+				   uncompress,
+				   " && mv -f ", e_tmp_file, " ", e_dest_file,
+				   "; r=$?; rm -rf ", e_tmp_dir, "; exit $r",
+				   NULL);
 	fr_process_end_command (comm->process);
 
+	g_free (e_dest_file);
+	g_free (uncompress);
+	g_free (e_tmp_file);
+	g_free (e_tmp_dir);
+	g_free (tmp_file);
+	g_free (tmp_dir);
 	g_free (dest_file);
-	g_free (compr_file);
 	g_free (uncompr_file);
-	g_free (temp_file);
-	g_free (temp_dir);
 }
 
 
@@ -163,42 +163,63 @@ fr_command_iso_extract (FrCommand  *comm,
 			gboolean    skip_older,
 			gboolean    junk_paths)
 {
-	GList *scan;
+	GHashTable *created_dirs;
+	GList      *scan;
 
+	/* create the folders in advance, the script only writes the files */
+
+	created_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	for (scan = file_list; scan; scan = scan->next) {
-		char       *path = scan->data;
-		const char *filename;
-		char       *file_dir;
-		char       *temp_dest_dir = NULL;
-		GFile      *directory;
+		char  *path = scan->data;
+		char  *file_dir;
+		char  *temp_dest_dir;
+		GFile *directory;
 
-		filename = _g_path_get_basename (path);
 		file_dir = _g_path_remove_level (path);
-		if ((file_dir != NULL) && (strcmp (file_dir, "/") != 0))
+		if ((file_dir == NULL) || g_hash_table_contains (created_dirs, file_dir)) {
+			g_free (file_dir);
+			continue;
+		}
+
+		if (strcmp (file_dir, "/") != 0)
 			temp_dest_dir = g_build_filename (dest_dir, file_dir, NULL);
-		 else
+		else
 			temp_dest_dir = g_strdup (dest_dir);
-		g_free (file_dir);
-
-		if (temp_dest_dir == NULL)
-			continue;
 
 		directory = g_file_new_for_path (temp_dest_dir);
 		_g_file_make_directory_tree (directory, 0700, NULL);
 
-		fr_process_begin_command (comm->process, "sh");
-		fr_process_set_working_dir (comm->process, temp_dest_dir);
-		fr_process_add_arg (comm->process, SHDIR "isoinfo.sh");
-		fr_process_add_arg (comm->process, "-i");
-		fr_process_add_arg (comm->process, comm->filename);
-		fr_process_add_arg (comm->process, "-x");
-		fr_process_add_arg (comm->process, path);
-		fr_process_add_arg (comm->process, filename);
-		fr_process_end_command (comm->process);
-
 		g_object_unref (directory);
 		g_free (temp_dest_dir);
+		g_hash_table_add (created_dirs, file_dir);
+	}
+	g_hash_table_destroy (created_dirs);
+
+	/* extract all the files with a single script, that detects the
+	 * Joliet and Rock Ridge extensions only once. */
+
+	fr_process_begin_command (comm->process, "sh");
+	fr_process_set_working_dir (comm->process, dest_dir);
+	fr_process_add_arg (comm->process, SHDIR "isoinfo.sh");
+	fr_process_add_arg (comm->process, "-i");
+	fr_process_add_arg (comm->process, comm->filename);
+	fr_process_add_arg (comm->process, "-x");
+	fr_process_add_arg (comm->process, dest_dir);
+	if (from_file != NULL) {
+		fr_process_add_arg (comm->process, "-T");
+		fr_process_add_arg (comm->process, from_file);
+	}
+	else {
+		for (scan = file_list; scan; scan = scan->next) {
+			char *path = scan->data;
+
+			if (path[0] != '/')
+				fr_process_add_arg_concat (comm->process, "/", path, NULL);
+			else
+				fr_process_add_arg (comm->process, path);
+		}
 	}
+	fr_process_end_command (comm->process);
 }
 
 
@@ -287,6 +308,7 @@ fr_command_iso_init (FrCommandIso *self)
 	base->propPassword                 = FALSE;
 	base->propTest                     = FALSE;
 	base->propCanExtractAll            = FALSE;
+	base->propListFromFile             = TRUE;
 
 	self->cur_path = NULL;
 	self->joliet = TRUE;
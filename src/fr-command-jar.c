@@ -49,6 +49,77 @@ typedef struct {
 } JarData;
 
 
+/* The package names are read by several threads, the files are assigned
+ * to the threads one at a time. */
+typedef struct {
+	const char  *base_dir;
+	char       **filenames;
+	char       **packages;
+	int          n_files;
+	int          next_file;
+} PackageScan;
+
+
+static gpointer
+package_scan_thread (gpointer user_data)
+{
+	PackageScan *scan = user_data;
+	int          i;
+
+	while ((i = g_atomic_int_add (&scan->next_file, 1)) < scan->n_files) {
+		const char *filename = scan->filenames[i];
+		char       *path;
+
+		if (_g_filename_has_extension (filename, ".java")) {
+			path = g_build_filename (scan->base_dir, filename, NULL);
+			scan->packages[i] = get_package_name_from_java_file (path);
+			g_free (path);
+		}
+		else if (_g_filename_has_extension (filename, ".class")) {
+			path = g_build_filename (scan->base_dir, filename, NULL);
+			scan->packages[i] = get_package_name_from_class_file (path);
+			g_free (path);
+		}
+	}
+
+	return NULL;
+}
+
+
+static char **
+get_package_names (GList      *file_list,
+		   const char *base_dir,
+		   int         n_files)
+{
+	PackageScan   scan;
+	GList        *list;
+	GThread     **threads;
+	guint         n_threads;
+	int           i;
+
+	scan.base_dir = base_dir;
+	scan.filenames = g_new (char *, n_files);
+	scan.packages = g_new0 (char *, n_files);
+	scan.n_files = n_files;
+	scan.next_file = 0;
+
+	for (list = file_list, i = 0; list; list = list->next, i++)
+		scan.filenames[i] = list->data;
+
+	n_threads = CLAMP (n_files / 64, 1, fr_get_n_threads ());
+	threads = g_new (GThread *, n_threads);
+	for (guint t = 0; t < n_threads; t++)
+		threads[t] = g_thread_new ("jar-scan", package_scan_thread, &scan);
+	for (guint t = 0; t < n_threads; t++)
+		g_thread_join (threads[t]);
+
+	g_free (threads);
+	g_free (scan.filenames);
+
+	return scan.packages;
+}
+
+
 static void
 fr_command_jar_add (FrCommand  *comm,
 		    const char *from_file,
@@ -57,23 +128,24 @@ fr_command_jar_add (FrCommand  *comm,
 		    gboolean    update,
 		    gboolean    follow_links)
 {
-	FrProcess *proc = comm->process;
-	GList     *zip_list = NULL, *jardata_list = NULL, *jar_list = NULL;
-	GList     *scan;
-	char      *tmp_dir;
-
-	for (scan = file_list; scan; scan = scan->next) {
+	FrProcess   *proc = comm->process;
+	GList       *zip_list = NULL, *jardata_list = NULL, *jar_list = NULL;
+	GList       *scan;
+	char        *tmp_dir;
+	char       **packages;
+	int          n_files;
+	int          i;
+	GHashTable  *links;
+
+	n_files = g_list_length (file_list);
+	packages = get_package_names (file_list, base_dir, n_files);
+
+	for (scan = file_list, i = 0; scan; scan = scan->next, i++) {
 		char *filename = scan->data;
-		char *path = g_build_filename (base_dir, filename, NULL);
-		char *package = NULL;
-
-		if (_g_filename_has_extension (filename, ".java"))
-			package = get_package_name_from_java_file (path);
-		else if (_g_filename_has_extension (filename, ".class"))
-			package = get_package_name_from_class_file (path);
+		char *package = packages[i];
 
 		if ((package == NULL) || (strlen (package) == 0))
-			zip_list = g_list_append (zip_list, g_strdup (filename));
+			zip_list = g_list_prepend (zip_list, g_strdup (filename));
 		else {
 			JarData *newdata = g_new0 (JarData, 1);
 
@@ -81,46 +153,67 @@ fr_command_jar_add (FrCommand  *comm,
 			newdata->link_name = g_strdup (_g_path_get_basename (package));
 			newdata->rel_path = _g_path_remove_level (filename);
 			newdata->filename = g_strdup (_g_path_get_basename (filename));
-			jardata_list = g_list_append (jardata_list, newdata);
+			jardata_list = g_list_prepend (jardata_list, newdata);
 		}
 
 		g_free (package);
-		g_free (path);
 	}
+	g_free (packages);
 
+	zip_list = g_list_reverse (zip_list);
+	jardata_list = g_list_reverse (jardata_list);
+
+	/* the files of a folder share the same link, create it only once */
+
+	links = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 	tmp_dir = _g_path_get_temp_work_dir (NULL);
 	for (scan = jardata_list; scan ; scan = scan->next) {
 		JarData *jdata = scan->data;
 		char    *pack_path;
-		GFile   *directory;
-		char    *old_link;
 		char    *link_name;
-		int      retval;
 
 		pack_path = g_build_filename (tmp_dir, jdata->package_minus_one_level, NULL);
-		directory = g_file_new_for_path (pack_path);
-		if (! _g_file_make_directory_tree (directory, 0755, NULL)) {
+		link_name = g_build_filename (pack_path, jdata->link_name, NULL);
+
+		if (! g_hash_table_contains (links, link_name)) {
+			GFile *directory;
+			char  *old_link;
+			int    retval;
+
+			directory = g_file_new_for_path (pack_path);
+			if (! _g_file_make_directory_tree (directory, 0755, NULL)) {
+				g_object_unref (directory);
+				g_free (link_name);
+				g_free (pack_path);
+				continue;
+			}
+
+			old_link = g_build_filename (base_dir, jdata->rel_path, NULL);
+			retval = symlink (old_link, link_name);
+			if ((retval == -1) && (errno != EEXIST)) {
+				g_free (old_link);
+				g_object_unref (directory);
+				g_free (link_name);
+				g_free (pack_path);
+				continue;
+			}
+
+			g_hash_table_add (links, g_strdup (link_name));
+
+			g_free (old_link);
 			g_object_unref (directory);
-			g_free (pack_path);
-			continue;
 		}
 
-		old_link = g_build_filename (base_dir, jdata->rel_path, NULL);
-		link_name = g_build_filename (pack_path, jdata->link_name, NULL);
-
-		retval = symlink (old_link, link_name);
-		if ((retval != -1) || (errno == EEXIST))
-			jar_list = g_list_append (jar_list,
-						  g_build_filename (jdata->package_minus_one_level,
-							            jdata->link_name,
-						      	            jdata->filename,
-						      	            NULL));
+		jar_list = g_list_prepend (jar_list,
+					   g_build_filename (jdata->package_minus_one_level,
+							     jdata->link_name,
+							     jdata->filename,
+							     NULL));
 
 		g_free (link_name);
-		g_free (old_link);
-		g_object_unref (directory);
 		g_free (pack_path);
 	}
+	jar_list = g_list_reverse (jar_list);
 
 	if (zip_list != NULL)
 		FR_COMMAND_CLASS (fr_command_jar_parent_class)->add (comm, NULL, zip_list, base_dir, update, follow_links);
@@ -144,6 +237,7 @@ fr_command_jar_add (FrCommand  *comm,
 		g_free (jdata->rel_path);
 	}
 
+	g_hash_table_unref (links);
 	_g_string_list_free (jardata_list);
 	_g_string_list_free (jar_list);
 	_g_string_list_free (zip_list);
@@ -34,6 +34,7 @@
 #include "fr-command.h"
 #include "fr-error.h"
 #include "fr-process.h"
+#include "fr-trace.h"
 #include "gio-utils.h"
 #include "glib-utils.h"
 
@@ -65,6 +66,7 @@ typedef struct {
 	guint               volume_size;
 	GCancellable       *cancellable;
 	GSimpleAsyncResult *result;
+	gint64              trace_begin;
 } XferData;
 
 
@@ -86,6 +88,20 @@ xfer_data_free (XferData *data)
 }
 
 
+static void
+xfer_data_trace_end (XferData   *data,
+		     const char *name)
+{
+	g_autofree char *uri = NULL;
+
+	if (data->trace_begin == 0)
+		return;
+
+	uri = g_file_get_uri (fr_archive_get_file (data->archive));
+	fr_trace_end (data->trace_begin, "transfer", name, uri, -1);
+}
+
+
 /* -- FrCommand -- */
 
 
@@ -139,6 +155,8 @@ copy_archive_to_remote_location_done (GError   *error,
 {
 	XferData *xfer_data = user_data;
 
+	xfer_data_trace_end (xfer_data, "copy-to-remote");
+
 	if (error != NULL)
 		g_simple_async_result_set_from_error (xfer_data->result, error);
 	g_simple_async_result_complete_in_idle (xfer_data->result);
@@ -173,6 +191,7 @@ copy_archive_to_remote_location (FrArchive          *archive,
 	xfer_data->archive = _g_object_ref (archive);
 	xfer_data->result = _g_object_ref (result);
 	xfer_data->cancellable = _g_object_ref (cancellable);
+	xfer_data->trace_begin = fr_trace_begin ();
 
 	fr_archive_action_started (archive, FR_ACTION_SAVING_REMOTE_ARCHIVE);
 	FrCommandPrivate *private = fr_command_get_instance_private (FR_COMMAND (xfer_data->archive));
@@ -200,6 +219,8 @@ copy_extracted_files_done (GError   *error,
 	FrCommand *self = FR_COMMAND (xfer_data->archive);
 	FrCommandPrivate *private = fr_command_get_instance_private (self);
 
+	xfer_data_trace_end (xfer_data, "copy-extracted-files");
+
 	if (error != NULL)
 		g_simple_async_result_set_from_error (xfer_data->result, error);
 
@@ -223,7 +244,10 @@ copy_extracted_files_progress (goffset   current_file,
 {
 	FrArchive *archive = user_data;
 
-	fr_archive_progress (archive, (double) current_file / (total_files + 1));
+	if (total_num_bytes > 0)
+		fr_archive_progress (archive, (double) current_num_bytes / total_num_bytes);
+	else
+		fr_archive_progress (archive, (double) current_file / (total_files + 1));
 }
 
 
@@ -240,6 +264,7 @@ copy_extracted_files_to_destination (FrArchive          *archive,
 	xfer_data->archive = _g_object_ref (archive);
 	xfer_data->result = _g_object_ref (result);
 	xfer_data->cancellable = _g_object_ref (cancellable);
+	xfer_data->trace_begin = fr_trace_begin ();
 
 	fr_archive_action_started (archive, FR_ACTION_COPYING_FILES_TO_REMOTE);
 
@@ -556,6 +581,8 @@ copy_remote_file_done (GError   *error,
 {
 	XferData *xfer_data = user_data;
 
+	xfer_data_trace_end (xfer_data, "copy-from-remote");
+
 	if (error != NULL)
 		g_simple_async_result_set_from_error (xfer_data->result, error);
 	g_simple_async_result_complete_in_idle (xfer_data->result);
@@ -613,6 +640,7 @@ fr_command_open (FrArchive           *archive,
 	}
 
 	fr_archive_action_started (archive, FR_ACTION_LOADING_ARCHIVE);
+	xfer_data->trace_begin = fr_trace_begin ();
 	g_copy_file_async (fr_archive_get_file (archive),
 			   private->local_copy,
 			   G_FILE_COPY_OVERWRITE,
@@ -59,7 +59,7 @@
 
 
 /* The capabilities are computed automatically in
- * compute_supported_archive_types() so it's correct to initialize to 0 here. */
+ * fr_ensure_supported_archive_types() so it's correct to initialize to 0 here. */
 FrMimeTypeDescription mime_type_desc[] = {
 	{ "application/epub+zip",                  ".epub",     0 },
 	{ "application/x-7z-compressed",           ".7z",       0 },
@@ -236,10 +236,12 @@ fr_registered_archive_new (GType command_type)
 
 		mime_type = _g_str_get_static (mime_types[i]);
 
+		/* the capabilities are computed when needed, see
+		 * fr_registered_archive_probe() */
+
 		cap = g_new0 (FrMimeTypeCap, 1);
 		cap->mime_type = mime_type;
-		cap->current_capabilities = fr_archive_get_capabilities (archive, mime_type, TRUE);
-		cap->potential_capabilities = fr_archive_get_capabilities (archive, mime_type, FALSE);
+		cap->probed = FALSE;
 		g_ptr_array_add (reg_com->caps, cap);
 
 		packages = g_new0 (FrMimeTypePackages, 1);
@@ -272,6 +274,27 @@ fr_registered_archive_unref (FrRegisteredArchive *reg_com)
 }
 
 
+/* Checking the capabilities can require to search the programs in the path
+ * or even to execute them, so it's done only for the mime types actually
+ * used. */
+static void
+fr_registered_archive_probe (FrRegisteredArchive *reg_com,
+			     FrMimeTypeCap       *cap)
+{
+	FrArchive *archive;
+
+	if (cap->probed)
+		return;
+
+	archive = g_object_new (reg_com->type, NULL);
+	cap->current_capabilities = fr_archive_get_capabilities (archive, cap->mime_type, TRUE);
+	cap->potential_capabilities = fr_archive_get_capabilities (archive, cap->mime_type, FALSE);
+	cap->probed = TRUE;
+
+	g_object_unref (archive);
+}
+
+
 static FrArchiveCaps
 fr_registered_archive_get_capabilities (FrRegisteredArchive *reg_com,
 				        const char          *mime_type)
@@ -280,8 +303,10 @@ fr_registered_archive_get_capabilities (FrRegisteredArchive *reg_com,
 		FrMimeTypeCap *cap;
 
 		cap = g_ptr_array_index (reg_com->caps, i);
-		if (strcmp (mime_type, cap->mime_type) == 0)
+		if (strcmp (mime_type, cap->mime_type) == 0) {
+			fr_registered_archive_probe (reg_com, cap);
 			return cap->current_capabilities;
+		}
 	}
 
 	return FR_ARCHIVE_CAN_DO_NOTHING;
@@ -299,8 +324,10 @@ fr_registered_archive_get_potential_capabilities (FrRegisteredArchive *reg_com,
 		FrMimeTypeCap *cap;
 
 		cap = g_ptr_array_index (reg_com->caps, i);
-		if ((cap->mime_type != NULL) && (strcmp (mime_type, cap->mime_type) == 0))
+		if ((cap->mime_type != NULL) && (strcmp (mime_type, cap->mime_type) == 0)) {
+			fr_registered_archive_probe (reg_com, cap);
 			return cap->potential_capabilities;
+		}
 	}
 
 	return FR_ARCHIVE_CAN_DO_NOTHING;
@@ -415,26 +442,42 @@ fr_get_preferred_archive_for_mime_type (const char    *mime_type,
 }
 
 
-void
-fr_update_registered_archives_capabilities (void)
-{
-	g_hash_table_remove_all (ProgramsCache);
+static gboolean supported_types_computed = FALSE;
+
 
+static void
+reset_registered_archives_capabilities (void)
+{
 	for (guint i = 0; i < Registered_Archives->len; i++) {
 		FrRegisteredArchive *reg_com;
-		FrArchive           *archive;
 
 		reg_com = g_ptr_array_index (Registered_Archives, i);
-		archive = g_object_new (reg_com->type, NULL);
 		for (guint j = 0; j < reg_com->caps->len; j++) {
 			FrMimeTypeCap *cap = g_ptr_array_index (reg_com->caps, j);
-
-			cap->current_capabilities = fr_archive_get_capabilities (archive, cap->mime_type, TRUE);
-			cap->potential_capabilities = fr_archive_get_capabilities (archive, cap->mime_type, FALSE);
+			cap->probed = FALSE;
 		}
-
-		g_object_unref (archive);
 	}
+	supported_types_computed = FALSE;
+}
+
+
+/* Probes the capabilities again, for example after installing a package. */
+void
+fr_update_registered_archives_capabilities (void)
+{
+	_g_programs_cache_clear ();
+	reset_registered_archives_capabilities ();
+}
+
+
+/* Probes the capabilities again only if a program was installed or
+ * removed from the path. */
+void
+fr_check_registered_archives_capabilities (void)
+{
+	if (_g_programs_cache_revalidate ())
+		return;
+	reset_registered_archives_capabilities ();
 }
 
 
@@ -557,11 +600,18 @@ fr_sort_mime_types_by_extension (int *a)
 }
 
 
-static void
-compute_supported_archive_types (void)
+void
+fr_ensure_supported_archive_types (void)
 {
 	int sf_i = 0, s_i = 0, o_i = 0, c_i = 0;
 
+	if (supported_types_computed)
+		return;
+	supported_types_computed = TRUE;
+
+	for (guint i = 0; mime_type_desc[i].mime_type != NULL; i++)
+		mime_type_desc[i].capabilities = 0;
+
 	for (guint i = 0; i < Registered_Archives->len; i++) {
 		FrRegisteredArchive *reg_com;
 
@@ -571,6 +621,7 @@ compute_supported_archive_types (void)
 			int            idx;
 
 			cap = g_ptr_array_index (reg_com->caps, j);
+			fr_registered_archive_probe (reg_com, cap);
 			idx = fr_get_mime_type_index (cap->mime_type);
 			if (idx < 0) {
 				g_warning ("mime type not recognized: %s", cap->mime_type);
@@ -607,8 +658,8 @@ fr_initialize_data (void)
 		return;
 	initialized = TRUE;
 	ProgramsCache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	_g_programs_cache_load ();
 	register_archives ();
-	compute_supported_archive_types ();
 }
 
 
@@ -641,4 +692,6 @@ fr_release_data (void)
 		FrCommandData *cdata = CommandList->data;
 		command_done (cdata);
 	}
+
+	_g_programs_cache_save ();
 }
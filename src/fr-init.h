@@ -54,6 +54,8 @@ GType        fr_get_archive_type_from_mime_type         (const char    *mime_typ
 GType        fr_get_preferred_archive_for_mime_type     (const char    *mime_type,
 						      FrArchiveCaps  requested_capabilities);
 void         fr_update_registered_archives_capabilities (void);
+void         fr_check_registered_archives_capabilities  (void);
+void         fr_ensure_supported_archive_types          (void);
 const char * _g_mime_type_get_from_extension         (const char    *ext);
 const char * _g_mime_type_get_from_filename          (GFile         *file);
 const char * fr_get_archive_filename_extension          (const char    *uri);
@@ -503,6 +503,7 @@ _fr_new_archive_dialog_construct (FrNewArchiveDialog *self,
 	gtk_box_append (GTK_BOX (gtk_dialog_get_content_area (GTK_DIALOG (self))), GET_WIDGET ("content"));
 
 	gtk_dialog_add_button (GTK_DIALOG (self), _GTK_LABEL_CANCEL, GTK_RESPONSE_CANCEL);
+	fr_ensure_supported_archive_types ();
 	switch (action) {
 	case FR_NEW_ARCHIVE_ACTION_NEW_MANY_FILES:
 		self->supported_types = create_type;
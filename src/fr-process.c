@@ -32,6 +32,7 @@
 #include <glib.h>
 #include "file-utils.h"
 #include "fr-process.h"
+#include "fr-trace.h"
 #include "glib-utils.h"
 
 #define REFRESH_RATE 20
@@ -248,6 +249,7 @@ typedef struct {
 
 	GPid         command_pid;
 	guint        check_timeout;
+	gint64       command_trace_begin;
 
 	gboolean     running;
 	gboolean     stopping;
@@ -833,6 +835,25 @@ check_child (gpointer data)
 		}
 	}
 
+	if (private->command_trace_begin != 0) {
+		GString *command_line;
+		GList   *scan;
+
+		command_line = g_string_new ("");
+		for (scan = info->args; scan; scan = scan->next) {
+			if (scan != info->args)
+				g_string_append_c (command_line, ' ');
+			g_string_append (command_line, scan->data);
+		}
+		fr_trace_end (private->command_trace_begin,
+			      "process",
+			      (info->args != NULL) ? info->args->data : "",
+			      command_line->str,
+			      -1);
+		g_string_free (command_line, TRUE);
+		private->command_trace_begin = 0;
+	}
+
 	if (info->ignore_error && (exec_data->error != NULL)) {
 #ifdef DEBUG
 			{
@@ -1007,6 +1028,7 @@ execute_current_command (ExecuteData *exec_data)
 	if (info->begin_func != NULL)
 		(*info->begin_func) (info->begin_data);
 
+	private->command_trace_begin = fr_trace_begin ();
 	if (! g_spawn_async_with_pipes (info->dir,
 					argv,
 					NULL,
@@ -1021,6 +1043,7 @@ execute_current_command (ExecuteData *exec_data)
 					&err_fd,
 					&error))
 	{
+		private->command_trace_begin = 0;
 		exec_data->error = fr_error_new (FR_ERROR_SPAWN, 0, error);
 		_fr_process_execute_complete_in_idle (exec_data);
 
@@ -0,0 +1,224 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+ *  File-Roller
+ *
+ *  Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "fr-trace.h"
+
+
+static FILE    *trace_file = NULL;
+static GMutex   trace_mutex;
+static gboolean first_event = TRUE;
+static gint     next_thread_id = 1;
+
+
+static void
+fr_trace_close (void)
+{
+	g_mutex_lock (&trace_mutex);
+	if (trace_file != NULL) {
+		/* the closing bracket is optional in the trace format, the
+		 * events written before a crash are readable as well */
+		fputs ("\n]\n", trace_file);
+		fclose (trace_file);
+		trace_file = NULL;
+	}
+	g_mutex_unlock (&trace_mutex);
+}
+
+
+static gboolean
+fr_trace_init (void)
+{
+	static gsize initialized = 0;
+
+	if (g_once_init_enter (&initialized)) {
+		const char *filename;
+
+		filename = g_getenv (FR_TRACE_ENV);
+		if ((filename != NULL) && (*filename != '\0')) {
+			trace_file = g_fopen (filename, "w");
+			if (trace_file != NULL) {
+				fputs ("[", trace_file);
+				atexit (fr_trace_close);
+			}
+			else
+				g_warning ("Could not create the trace file '%s'", filename);
+		}
+
+		g_once_init_leave (&initialized, 1);
+	}
+
+	return trace_file != NULL;
+}
+
+
+gint64
+fr_trace_begin (void)
+{
+	if (! fr_trace_init ())
+		return 0;
+
+	return g_get_monotonic_time ();
+}
+
+
+/* Uses the kernel thread id when available, to match the threads shown
+ * by perf and gdb. */
+static gint64
+_get_thread_id (void)
+{
+	static GPrivate thread_id_key;
+	gint64          thread_id;
+
+#if defined(__linux__) && defined(SYS_gettid)
+	thread_id = (gint64) syscall (SYS_gettid);
+	if (thread_id > 0)
+		return thread_id;
+#endif
+
+	thread_id = GPOINTER_TO_INT (g_private_get (&thread_id_key));
+	if (thread_id == 0) {
+		thread_id = g_atomic_int_add (&next_thread_id, 1);
+		g_private_set (&thread_id_key, GINT_TO_POINTER (thread_id));
+	}
+
+	return thread_id;
+}
+
+
+static void
+_g_string_append_json_string (GString    *str,
+			      const char *value)
+{
+	const char *p;
+
+	g_string_append_c (str, '"');
+	for (p = value; *p != '\0'; p++) {
+		switch (*p) {
+		case '"':
+			g_string_append (str, "\\\"");
+			break;
+		case '\\':
+			g_string_append (str, "\\\\");
+			break;
+		case '\n':
+			g_string_append (str, "\\n");
+			break;
+		case '\t':
+			g_string_append (str, "\\t");
+			break;
+		default:
+			if ((guchar) *p < 0x20)
+				g_string_append_printf (str, "\\u%04x", (guchar) *p);
+			else
+				g_string_append_c (str, *p);
+			break;
+		}
+	}
+	g_string_append_c (str, '"');
+}
+
+
+static void
+fr_trace_write_event (char        phase,
+		      gint64      timestamp,
+		      gint64      duration,
+		      const char *category,
+		      const char *name,
+		      const char *detail,
+		      gint64      bytes)
+{
+	GString *event;
+
+	event = g_string_new ("\n{\"name\":");
+	_g_string_append_json_string (event, name);
+	g_string_append (event, ",\"cat\":");
+	_g_string_append_json_string (event, category);
+	g_string_append_printf (event,
+				",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%" G_GINT64_FORMAT,
+				phase,
+				timestamp,
+				(int) getpid (),
+				_get_thread_id ());
+	if (phase == 'X')
+		g_string_append_printf (event, ",\"dur\":%" G_GINT64_FORMAT, duration);
+	else
+		g_string_append (event, ",\"s\":\"t\"");
+
+	if ((detail != NULL) || (bytes >= 0)) {
+		g_string_append (event, ",\"args\":{");
+		if (detail != NULL) {
+			g_string_append (event, "\"detail\":");
+			_g_string_append_json_string (event, detail);
+		}
+		if (bytes >= 0)
+			g_string_append_printf (event, "%s\"bytes\":%" G_GINT64_FORMAT, (detail != NULL) ? "," : "", bytes);
+		g_string_append_c (event, '}');
+	}
+	g_string_append_c (event, '}');
+
+	g_mutex_lock (&trace_mutex);
+	if (trace_file != NULL) {
+		if (! first_event)
+			fputc (',', trace_file);
+		fputs (event->str, trace_file);
+		first_event = FALSE;
+	}
+	g_mutex_unlock (&trace_mutex);
+
+	g_string_free (event, TRUE);
+}
+
+
+/* Records a span from @begin to now.  @detail and @bytes are optional,
+ * use NULL and -1 to omit them. */
+void
+fr_trace_end (gint64      begin,
+	      const char *category,
+	      const char *name,
+	      const char *detail,
+	      gint64      bytes)
+{
+	if (begin == 0)
+		return;
+
+	fr_trace_write_event ('X', begin, g_get_monotonic_time () - begin, category, name, detail, bytes);
+}
+
+
+void
+fr_trace_instant (const char *category,
+		  const char *name,
+		  const char *detail)
+{
+	if (! fr_trace_init ())
+		return;
+
+	fr_trace_write_event ('i', g_get_monotonic_time (), 0, category, name, detail, -1);
+}
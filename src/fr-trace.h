@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*- */
+
+/*
+ *  File-Roller
+ *
+ *  Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FR_TRACE_H__
+#define __FR_TRACE_H__
+
+#include <glib.h>
+
+/* Timing spans written as Chrome trace events (chrome://tracing,
+ * https://ui.perfetto.dev) to the file named by the FILE_ROLLER_TRACE
+ * environment variable.  A span is recorded with:
+ *
+ *	gint64 begin = fr_trace_begin ();
+ *	...
+ *	fr_trace_end (begin, "extract", "entry", pathname, size);
+ *
+ * fr_trace_begin() returns 0 when tracing is disabled, and
+ * fr_trace_end() ignores the spans that begin at 0. */
+
+#define FR_TRACE_ENV "FILE_ROLLER_TRACE"
+
+gint64    fr_trace_begin       (void);
+void      fr_trace_end         (gint64      begin,
+				const char *category,
+				const char *name,
+				const char *detail,
+				gint64      bytes);
+void      fr_trace_instant     (const char *category,
+				const char *name,
+				const char *detail);
+
+#endif /* __FR_TRACE_H__ */
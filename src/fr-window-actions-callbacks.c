@@ -338,6 +338,7 @@ fr_window_activate_open (GSimpleAction *action,
 	_gtk_dialog_add_to_window_group (GTK_DIALOG (file_sel));
 	gtk_window_set_modal (GTK_WINDOW (file_sel), TRUE);
 
+	fr_ensure_supported_archive_types ();
 	filter = gtk_file_filter_new ();
 	gtk_file_filter_set_name (filter, _("All archives"));
 	for (i = 0; open_type[i] != -1; i++)
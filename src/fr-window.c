@@ -38,9 +38,11 @@
 #include "dlg-update.h"
 #include "fr-marshal.h"
 #include "fr-archive.h"
+#include "fr-archive-libarchive.h"
 #include "fr-command.h"
 #include "fr-error.h"
 #include "fr-new-archive-dialog.h"
+#include "fr-trace.h"
 #include "fr-window.h"
 #include "fr-window-actions-entries.h"
 #include "fr-file-data.h"
@@ -1780,6 +1782,7 @@ fr_window_update_file_list (FrWindow *window,
 	FrWindowPrivate *private = fr_window_get_instance_private (window);
 	GPtrArray  *files;
 	gboolean    free_files = FALSE;
+	gint64      trace_begin;
 
 	if (! gtk_widget_get_realized (GTK_WIDGET (window)))
 		return;
@@ -1816,6 +1819,7 @@ fr_window_update_file_list (FrWindow *window,
 
 	/**/
 
+	trace_begin = fr_trace_begin ();
 	_fr_window_start_activity_mode (window);
 
 	if (private->list_mode == FR_WINDOW_LIST_MODE_FLAT) {
@@ -1854,6 +1858,8 @@ fr_window_update_file_list (FrWindow *window,
 
 	if (free_files)
 		g_ptr_array_free (files, TRUE);
+
+	fr_trace_end (trace_begin, "ui", "update-file-list", update_view ? "populate" : NULL, -1);
 }
 
 
@@ -2352,6 +2358,27 @@ open_progress_dialog (FrWindow *window,
 }
 
 
+static char *
+get_time_left_description (gint64 seconds)
+{
+	int minutes;
+	int hours;
+
+	/* fr_archive_progress_get_rate doesn't return longer estimates */
+	seconds = CLAMP (seconds, 0, G_MAXINT / 2);
+
+	if (seconds < 60)
+		return g_strdup_printf (ngettext ("%d second left", "%d seconds left", (int) seconds), (int) seconds);
+
+	minutes = (int) ((seconds + 30) / 60);
+	if (minutes < 60)
+		return g_strdup_printf (ngettext ("%d minute left", "%d minutes left", minutes), minutes);
+
+	hours = (minutes + 30) / 60;
+	return g_strdup_printf (ngettext ("%d hour left", "%d hours left", hours), hours);
+}
+
+
 static void
 fr_archive_progress_cb (FrArchive *archive,
 			double     fraction,
@@ -2375,10 +2402,25 @@ fr_archive_progress_cb (FrArchive *archive,
 			case FR_ACTION_EXTRACTING_FILES:
 			case FR_ACTION_DELETING_FILES:
 			case FR_ACTION_UPDATING_FILES:
-				if (remaining_files > 0)
+				if (remaining_files > 0) {
+					gint64 remaining_seconds;
+
 					message = g_strdup_printf (ngettext ("%d file remaining",
 									     "%'d files remaining",
 									     remaining_files), remaining_files);
+
+					if (fr_archive_progress_get_rate (archive, NULL, NULL, &remaining_seconds) && (remaining_seconds >= 0)) {
+						g_autofree char *time_left = get_time_left_description (remaining_seconds);
+						char            *tmp;
+
+						/* Translators: the number of files remaining and
+						 * the time left, for example "12 files remaining —
+						 * 3 minutes left" */
+						tmp = g_strdup_printf (_("%s — %s"), message, time_left);
+						g_free (message);
+						message = tmp;
+					}
+				}
 				else
 					message = g_strdup (_("Please wait…"));
 				break;
@@ -2786,6 +2828,8 @@ _handle_archive_operation_error (FrWindow  *window,
 
 		if ((error->code != FR_ERROR_GENERIC) && FR_IS_COMMAND (archive))
 			output = fr_command_get_last_output (FR_COMMAND (archive));
+		else if ((action == FR_ACTION_TESTING_ARCHIVE) && FR_IS_ARCHIVE_LIBARCHIVE (archive))
+			output = fr_archive_libarchive_get_last_output (FR_ARCHIVE_LIBARCHIVE (archive));
 
 		dialog = _gtk_error_dialog_new (dialog_parent,
 						0,
@@ -6751,6 +6795,23 @@ fr_window_archive_save_as (FrWindow   *window,
 	_g_object_unref (private->saving_file);
 	private->saving_file = g_object_ref (cdata->file);
 
+	/* copy the entries directly when possible, without extracting the
+	 * archive to a temporary directory */
+
+	if (fr_archive_can_add_archive (cdata->new_archive, window->archive)) {
+		fr_archive_add_archive (cdata->new_archive,
+					window->archive,
+					private->password,
+					cdata->password,
+					cdata->encrypt_header,
+					private->compression,
+					cdata->volume_size,
+					private->cancellable,
+					archive_add_ready_for_conversion_cb,
+					cdata);
+		return;
+	}
+
 	fr_archive_action_started (window->archive, FR_ACTION_EXTRACTING_FILES);
 	fr_archive_extract (window->archive,
 			    NULL,
@@ -6984,6 +7045,27 @@ archive_add_ready_for_encryption_cb (GObject      *source_object,
 		return;
 	}
 
+	/* the temporary file is created in the same folder when the archive
+	 * is local, in this case a rename is enough */
+
+	if (g_file_move (edata->temp_new_file,
+			 fr_archive_get_file (window->archive),
+			 G_FILE_COPY_OVERWRITE | G_FILE_COPY_NO_FALLBACK_FOR_MOVE,
+			 NULL,
+			 NULL,
+			 NULL,
+			 NULL))
+	{
+		_fr_window_stop_activity_mode (window);
+		close_progress_dialog (window, FALSE);
+
+		fr_window_set_password (window, edata->password);
+		fr_window_set_encrypt_header (window, edata->encrypt_header);
+		private->reload_archive = TRUE;
+		fr_window_batch_exec_next_action (window);
+		return;
+	}
+
 	fr_archive_action_started (window->archive, FR_ACTION_SAVING_REMOTE_ARCHIVE);
 	g_file_copy_async (edata->temp_new_file,
 			   fr_archive_get_file (window->archive),
@@ -7120,6 +7202,26 @@ fr_window_archive_encrypt (FrWindow   *window,
 					    edata,
 					    (GFreeFunc) encrypt_data_free);
 
+	/* re-encrypt the entries in a single pass when the new archive can be
+	 * written directly from the current one */
+
+	if (fr_archive_can_add_archive (edata->new_archive, window->archive)
+	    && ((password == NULL) || fr_archive_is_capable_of (edata->new_archive, FR_ARCHIVE_CAN_ENCRYPT))
+	    && (! encrypt_header || fr_archive_is_capable_of (edata->new_archive, FR_ARCHIVE_CAN_ENCRYPT_HEADER)))
+	{
+		fr_archive_add_archive (edata->new_archive,
+					window->archive,
+					private->password,
+					edata->password,
+					edata->encrypt_header,
+					private->compression,
+					0,
+					private->cancellable,
+					archive_add_ready_for_encryption_cb,
+					edata);
+		return;
+	}
+
 	fr_archive_action_started (window->archive, FR_ACTION_EXTRACTING_FILES);
 	fr_archive_extract (window->archive,
 			    NULL,
@@ -7220,6 +7322,8 @@ fr_window_view_last_output (FrWindow   *window,
 	gtk_text_buffer_get_iter_at_offset (text_buffer, &iter, 0);
 	if (FR_IS_COMMAND (window->archive))
 		scan = fr_command_get_last_output (FR_COMMAND (window->archive));
+	else if (FR_IS_ARCHIVE_LIBARCHIVE (window->archive))
+		scan = fr_archive_libarchive_get_last_output (FR_ARCHIVE_LIBARCHIVE (window->archive));
 	else
 		scan = NULL;
 	for (; scan; scan = scan->next) {
@@ -692,12 +692,277 @@ _g_file_list_query_info_async (GList               *file_list,
 }
 
 
-/* -- g_copy_files_async -- */
+/* -- _g_file_list_foreach_info -- */
+
+
+typedef struct {
+	FileListFlags        flags;
+	char                *attributes;
+	GCancellable        *cancellable;
+	FilterMatchCallback  directory_filter_func;
+	FilterMatchCallback  file_filter_func;
+	gpointer             filter_data;
+	ForEachInfoCallback  for_each_file_func;
+	gpointer             user_data;
+	GHashTable          *already_visited;
+	gboolean             stopped;
+} ScanData;
+
+
+static gboolean
+scan_data_directory_is_new (ScanData  *scan_data,
+			    GFile     *file,
+			    GFileInfo *info)
+{
+	char *id;
+
+	/* avoid to visit a directory more than ones */
+
+	id = g_strdup (g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE));
+	if (id == NULL)
+		id = g_file_get_uri (file);
+
+	if (g_hash_table_lookup (scan_data->already_visited, id) != NULL) {
+		g_free (id);
+		return FALSE;
+	}
+
+	g_hash_table_insert (scan_data->already_visited, id, GINT_TO_POINTER (1));
+
+	return TRUE;
+}
+
+
+static gboolean
+scan_data_start_dir (ScanData  *scan_data,
+		     FileInfo  *dir)
+{
+	if ((scan_data->flags & FILE_LIST_NO_BACKUP_FILES) && g_file_info_get_is_backup (dir->info))
+		return FALSE;
+	if ((scan_data->flags & FILE_LIST_NO_HIDDEN_FILES) && g_file_info_get_is_hidden (dir->info))
+		return FALSE;
+	if ((scan_data->directory_filter_func != NULL) && scan_data->directory_filter_func (dir->file, dir->info, scan_data->filter_data))
+		return FALSE;
+
+	if (! scan_data->for_each_file_func (dir->file, dir->info, scan_data->user_data))
+		scan_data->stopped = TRUE;
+
+	return ! scan_data->stopped;
+}
+
+
+static void
+scan_data_child_found (ScanData  *scan_data,
+		       GFile     *file,
+		       GFileInfo *info)
+{
+	if ((scan_data->flags & FILE_LIST_NO_BACKUP_FILES) && g_file_info_get_is_backup (info))
+		return;
+	if ((scan_data->flags & FILE_LIST_NO_HIDDEN_FILES) && g_file_info_get_is_hidden (info))
+		return;
+	if ((scan_data->file_filter_func != NULL) && scan_data->file_filter_func (file, info, scan_data->filter_data))
+		return;
+
+	if (! scan_data->for_each_file_func (file, info, scan_data->user_data))
+		scan_data->stopped = TRUE;
+}
+
+
+static gboolean
+scan_data_visit_directory (ScanData   *scan_data,
+			   GFile      *directory,
+			   GFileInfo  *info,
+			   GError    **error)
+{
+	GQueue    to_visit = G_QUEUE_INIT;
+	FileInfo *current;
+	gboolean  success = TRUE;
+
+	scan_data_directory_is_new (scan_data, directory, info);
+	g_queue_push_tail (&to_visit, file_info_new (directory, info));
+
+	while (success
+	       && ! scan_data->stopped
+	       && ((current = g_queue_pop_head (&to_visit)) != NULL))
+	{
+		GFileEnumerator *enumerator;
+		GFileInfo       *child_info;
+		GError          *local_error = NULL;
+
+		if (! scan_data_start_dir (scan_data, current)) {
+			file_info_free (current);
+			continue;
+		}
+
+		enumerator = g_file_enumerate_children (current->file,
+							scan_data->attributes,
+							(scan_data->flags & FILE_LIST_NO_FOLLOW_LINKS) ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : G_FILE_QUERY_INFO_NONE,
+							scan_data->cancellable,
+							error);
+		if (enumerator == NULL) {
+			file_info_free (current);
+			success = FALSE;
+			break;
+		}
+
+		while (! scan_data->stopped
+		       && ((child_info = g_file_enumerator_next_file (enumerator, scan_data->cancellable, &local_error)) != NULL))
+		{
+			GFile *child;
+
+			child = g_file_get_child (current->file, g_file_info_get_name (child_info));
+			if (g_file_info_get_file_type (child_info) == G_FILE_TYPE_DIRECTORY) {
+				if (scan_data_directory_is_new (scan_data, child, child_info))
+					g_queue_push_tail (&to_visit, file_info_new (child, child_info));
+			}
+			else
+				scan_data_child_found (scan_data, child, child_info);
+
+			g_object_unref (child);
+			g_object_unref (child_info);
+		}
+
+		if (local_error != NULL) {
+			g_propagate_error (error, local_error);
+			success = FALSE;
+		}
+
+		g_file_enumerator_close (enumerator, NULL, NULL);
+		g_object_unref (enumerator);
+		file_info_free (current);
+	}
+
+	g_queue_foreach (&to_visit, (GFunc) file_info_free, NULL);
+	g_queue_clear (&to_visit);
+
+	return success;
+}
+
+
+/**
+ * _g_file_list_foreach_info:
+ * @file_list: (element-type GFile): the files and directories to scan.
+ * @flags: the scan options.
+ * @attributes: the GFileInfo attributes to read.
+ * @cancellable: An optional @GCancellable object, used to cancel the scan.
+ * @directory_filter_func: returns %TRUE for the directories to skip, can be
+ *   %NULL.
+ * @file_filter_func: returns %TRUE for the files to skip, can be %NULL.
+ * @filter_data: data to pass to the filter functions.
+ * @for_each_file_func: the function called for each file and directory
+ *   found, return %FALSE to stop the scan.
+ * @user_data: data to pass to @for_each_file_func.
+ * @error: return location for an error.
+ *
+ * Synchronous version of _g_file_list_query_info_async() that calls
+ * @for_each_file_func as soon as a file is found instead of collecting the
+ * whole list, meant to be used in a worker thread.
+ */
+gboolean
+_g_file_list_foreach_info (GList                *file_list,
+			   FileListFlags         flags,
+			   const char           *attributes,
+			   GCancellable         *cancellable,
+			   FilterMatchCallback   directory_filter_func,
+			   FilterMatchCallback   file_filter_func,
+			   gpointer              filter_data,
+			   ForEachInfoCallback   for_each_file_func,
+			   gpointer              user_data,
+			   GError              **error)
+{
+	ScanData  scan_data;
+	GList    *scan;
+	gboolean  success = TRUE;
+
+	g_return_val_if_fail (for_each_file_func != NULL, FALSE);
+
+	scan_data.flags = flags;
+	scan_data.attributes = g_strconcat ("standard::name,standard::type,standard::is-hidden,standard::is-backup,id::file",
+					    (((attributes != NULL) && (strcmp (attributes, "") != 0)) ? "," : NULL),
+					    attributes,
+					    NULL);
+	scan_data.cancellable = cancellable;
+	scan_data.directory_filter_func = directory_filter_func;
+	scan_data.file_filter_func = file_filter_func;
+	scan_data.filter_data = filter_data;
+	scan_data.for_each_file_func = for_each_file_func;
+	scan_data.user_data = user_data;
+	scan_data.already_visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	scan_data.stopped = FALSE;
+
+	for (scan = file_list; success && ! scan_data.stopped && scan; scan = scan->next) {
+		GFile     *file = scan->data;
+		GFileInfo *info;
+
+		if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+			success = FALSE;
+			break;
+		}
+
+		/* files that cannot be read are ignored, as done by
+		 * _g_file_list_query_info_async */
+
+		info = g_file_query_info (file,
+					  scan_data.attributes,
+					  (flags & FILE_LIST_NO_FOLLOW_LINKS) ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : G_FILE_QUERY_INFO_NONE,
+					  cancellable,
+					  NULL);
+		if (info == NULL)
+			continue;
+
+		if ((flags & FILE_LIST_RECURSIVE) && (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY))
+			success = scan_data_visit_directory (&scan_data, file, info, error);
+		else if (! for_each_file_func (file, info, user_data))
+			scan_data.stopped = TRUE;
+
+		g_object_unref (info);
+	}
+
+	g_hash_table_destroy (scan_data.already_visited);
+	g_free (scan_data.attributes);
+
+	return success;
+}
+
+
+/* -- CopyQueue -- */
+
+
+/* Copies a list of files keeping more copies in flight at the same time,
+ * this hides the per-file latency of the remote locations.  Native to
+ * native copies are done by g_file_copy, which uses copy_file_range() or
+ * splice() when available.  The directories and the symbolic links are
+ * created by jobs in the same queue, a job starts after the job of its
+ * parent directory is completed. */
+
+
+#define COPY_QUEUE_MAX_JOBS 8
+#define COPY_QUEUE_MAX_JOBS_PER_HOST 4
+
+
+typedef struct _CopyQueue CopyQueue;
+
+
+typedef enum {
+	COPY_JOB_FILE,
+	COPY_JOB_DIRECTORY,
+	COPY_JOB_SYMBOLIC_LINK
+} CopyJobType;
 
 
 typedef struct {
-	GList                 *sources;
-	GList                 *destinations;
+	CopyQueue   *queue;
+	CopyJobType  type;
+	GFile       *source;
+	GFile       *destination;
+	char        *symlink_target;
+	char        *host;
+	goffset      current_num_bytes;
+	goffset      total_num_bytes;
+} CopyJob;
+
+
+struct _CopyQueue {
 	GFileCopyFlags         flags;
 	int                    io_priority;
 	GCancellable          *cancellable;
@@ -705,146 +970,428 @@ typedef struct {
 	gpointer               progress_callback_data;
 	CopyDoneCallback       callback;
 	gpointer               user_data;
+	GError                *error;
 
-	GList                 *source;
-	GList                 *destination;
-	int                    n_file;
+	GQueue                *pending;
+	GList                 *running;
+	GHashTable            *host_jobs;
+	int                    n_files;
 	int                    tot_files;
-} CopyFilesData;
+	goffset                completed_num_bytes;
+	goffset                tot_num_bytes;
+};
 
 
-static CopyFilesData*
-copy_files_data_new (GList                 *sources,
-		     GList                 *destinations,
-		     GFileCopyFlags         flags,
-		     int                    io_priority,
-		     GCancellable          *cancellable,
-		     CopyProgressCallback   progress_callback,
-		     gpointer               progress_callback_data,
-		     CopyDoneCallback       callback,
-		     gpointer               user_data)
+static CopyJob *
+copy_job_new (CopyQueue   *queue,
+	      CopyJobType  type,
+	      GFile       *source,
+	      GFile       *destination,
+	      goffset      size)
 {
-	CopyFilesData *cfd;
+	CopyJob *job;
+	GFile   *remote_file;
+
+	job = g_new0 (CopyJob, 1);
+	job->queue = queue;
+	job->type = type;
+	job->source = g_object_ref (source);
+	job->destination = g_object_ref (destination);
+	job->current_num_bytes = 0;
+	job->total_num_bytes = size;
+
+	/* the concurrent copies are limited per remote host */
+
+	remote_file = NULL;
+	if (! g_file_is_native (source))
+		remote_file = source;
+	else if (! g_file_is_native (destination))
+		remote_file = destination;
+	if (remote_file != NULL) {
+		char *uri;
+
+		uri = g_file_get_uri (remote_file);
+		job->host = _g_uri_get_host (uri);
+		g_free (uri);
+	}
 
-	cfd = g_new0 (CopyFilesData, 1);
-	cfd->sources = _g_file_list_dup (sources);
-	cfd->destinations = _g_file_list_dup (destinations);
-	cfd->flags = flags;
-	cfd->io_priority = io_priority;
-	cfd->cancellable = cancellable;
-	cfd->progress_callback = progress_callback;
-	cfd->progress_callback_data = progress_callback_data;
-	cfd->callback = callback;
-	cfd->user_data = user_data;
+	return job;
+}
 
-	cfd->source = cfd->sources;
-	cfd->destination = cfd->destinations;
-	cfd->n_file = 1;
-	cfd->tot_files = g_list_length (cfd->sources);
 
-	return cfd;
+static void
+copy_job_free (CopyJob *job)
+{
+	g_object_unref (job->source);
+	g_object_unref (job->destination);
+	g_free (job->symlink_target);
+	g_free (job->host);
+	g_free (job);
+}
+
+
+static CopyQueue *
+copy_queue_new (GFileCopyFlags         flags,
+		int                    io_priority,
+		GCancellable          *cancellable,
+		CopyProgressCallback   progress_callback,
+		gpointer               progress_callback_data,
+		CopyDoneCallback       callback,
+		gpointer               user_data)
+{
+	CopyQueue *queue;
+
+	queue = g_new0 (CopyQueue, 1);
+	queue->flags = flags;
+	queue->io_priority = io_priority;
+	queue->cancellable = _g_object_ref (cancellable);
+	queue->progress_callback = progress_callback;
+	queue->progress_callback_data = progress_callback_data;
+	queue->callback = callback;
+	queue->user_data = user_data;
+	queue->error = NULL;
+	queue->pending = g_queue_new ();
+	queue->running = NULL;
+	queue->host_jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	queue->n_files = 0;
+	queue->tot_files = 0;
+	queue->completed_num_bytes = 0;
+	queue->tot_num_bytes = 0;
+
+	return queue;
 }
 
 
 static void
-copy_files_data_free (CopyFilesData *cfd)
+copy_queue_free (CopyQueue *queue)
 {
-	if (cfd == NULL)
+	g_queue_free_full (queue->pending, (GDestroyNotify) copy_job_free);
+	g_list_free_full (queue->running, (GDestroyNotify) copy_job_free);
+	g_hash_table_unref (queue->host_jobs);
+	_g_object_unref (queue->cancellable);
+	if (queue->error != NULL)
+		g_error_free (queue->error);
+	g_free (queue);
+}
+
+
+static void
+copy_queue_add (CopyQueue *queue,
+		GFile     *source,
+		GFile     *destination,
+		goffset    size)
+{
+	g_queue_push_tail (queue->pending, copy_job_new (queue, COPY_JOB_FILE, source, destination, size));
+	queue->tot_files++;
+	if (size > 0)
+		queue->tot_num_bytes += size;
+}
+
+
+static void
+copy_queue_add_directory (CopyQueue *queue,
+			  GFile     *source,
+			  GFile     *destination)
+{
+	g_queue_push_tail (queue->pending, copy_job_new (queue, COPY_JOB_DIRECTORY, source, destination, 0));
+}
+
+
+static void
+copy_queue_add_symbolic_link (CopyQueue  *queue,
+			      GFile      *source,
+			      GFile      *destination,
+			      const char *symlink_target)
+{
+	CopyJob *job;
+
+	job = copy_job_new (queue, COPY_JOB_SYMBOLIC_LINK, source, destination, 0);
+	job->symlink_target = g_strdup (symlink_target);
+	g_queue_push_tail (queue->pending, job);
+}
+
+
+static gboolean
+copy_queue_done_cb (gpointer user_data)
+{
+	CopyQueue *queue = user_data;
+
+	if (queue->callback)
+		queue->callback (queue->error, queue->user_data);
+	copy_queue_free (queue);
+
+	return FALSE;
+}
+
+
+static void
+copy_queue_progress (CopyQueue *queue,
+		     CopyJob   *job)
+{
+	goffset  current_num_bytes;
+	goffset  total_num_bytes;
+	GList   *scan;
+
+	if (queue->progress_callback == NULL)
 		return;
-	_g_file_list_free (cfd->sources);
-	_g_file_list_free (cfd->destinations);
-	g_free (cfd);
+
+	current_num_bytes = queue->completed_num_bytes;
+	total_num_bytes = queue->completed_num_bytes;
+	for (scan = queue->running; scan; scan = scan->next) {
+		CopyJob *running_job = scan->data;
+
+		current_num_bytes += running_job->current_num_bytes;
+		total_num_bytes += MAX (running_job->total_num_bytes, 0);
+	}
+	total_num_bytes = MAX (total_num_bytes, queue->tot_num_bytes);
+
+	queue->progress_callback (MIN (queue->n_files + 1, queue->tot_files),
+				  queue->tot_files,
+				  job->source,
+				  job->destination,
+				  current_num_bytes,
+				  total_num_bytes,
+				  queue->progress_callback_data);
+}
+
+
+static void
+copy_job_progress_cb (goffset  current_num_bytes,
+		      goffset  total_num_bytes,
+		      gpointer user_data)
+{
+	CopyJob *job = user_data;
+
+	job->current_num_bytes = current_num_bytes;
+	job->total_num_bytes = total_num_bytes;
+	copy_queue_progress (job->queue, job);
 }
 
 
-static void g_copy_current_file (CopyFilesData *cfd);
+static void copy_queue_start_jobs (CopyQueue *queue);
 
 
 static void
-g_copy_next_file (CopyFilesData *cfd)
+copy_job_completed (CopyJob *job,
+		    GError  *error)
 {
-	cfd->source = g_list_next (cfd->source);
-	cfd->destination = g_list_next (cfd->destination);
-	cfd->n_file++;
+	CopyQueue *queue = job->queue;
+
+	if ((error != NULL) && (queue->error == NULL))
+		queue->error = g_error_copy (error);
+	g_clear_error (&error);
+
+	queue->running = g_list_remove (queue->running, job);
+	if (job->host != NULL) {
+		guint n_jobs;
 
-	g_copy_current_file (cfd);
+		n_jobs = GPOINTER_TO_UINT (g_hash_table_lookup (queue->host_jobs, job->host));
+		g_hash_table_insert (queue->host_jobs, g_strdup (job->host), GUINT_TO_POINTER (n_jobs - 1));
+	}
+	if (job->type == COPY_JOB_FILE) {
+		queue->n_files++;
+		queue->completed_num_bytes += MAX (job->total_num_bytes, job->current_num_bytes);
+	}
+	copy_job_free (job);
+
+	copy_queue_start_jobs (queue);
 }
 
 
 static void
-g_copy_files_ready_cb (GObject      *source_object,
-                       GAsyncResult *result,
-                       gpointer      user_data)
+copy_job_ready_cb (GObject      *source_object,
+		   GAsyncResult *result,
+		   gpointer      user_data)
 {
-	CopyFilesData *cfd = user_data;
-	GFile         *source = cfd->source->data;
-	GError        *error = NULL;
+	CopyJob *job = user_data;
+	GError  *error = NULL;
 
-	if (! g_file_copy_finish (source, result, &error)) {
+	if (! g_file_copy_finish (job->source, result, &error)) {
 		/* source and target are directories, ignore the error */
 		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_MERGE))
 			g_clear_error (&error);
 		/* source is directory, create target directory */
-		if (g_error_matches (error, G_IO_ERROR,  G_IO_ERROR_WOULD_RECURSE)) {
+		if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE)) {
 			g_clear_error (&error);
-			g_file_make_directory ((GFile*) cfd->destination->data,
-					       cfd->cancellable,
+			g_file_make_directory (job->destination,
+					       job->queue->cancellable,
 					       &error);
 		}
 	}
 
-	if (error) {
-		if (cfd->callback)
-			cfd->callback (error, cfd->user_data);
+	copy_job_completed (job, error);
+	_g_error_free (error);
+}
+
+
+/* Doesn't check the errors other than the cancellation, because when an
+ * error occurs the code is not returned (for example when a directory
+ * already exists the G_IO_ERROR_EXISTS code is *not* returned), so we
+ * cannot discriminate between warnings and fatal errors. (see bug
+ * #525155) */
+static void
+copy_job_make_ready (CopyJob *job,
+		     GError  *error)
+{
+	if (! g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
 		g_clear_error (&error);
-		copy_files_data_free (cfd);
-		return;
-	}
 
-	g_copy_next_file (cfd);
+	copy_job_completed (job, error);
+	_g_error_free (error);
+}
+
+
+static void
+copy_job_make_directory_ready_cb (GObject      *source_object,
+				  GAsyncResult *result,
+				  gpointer      user_data)
+{
+	CopyJob *job = user_data;
+	GError  *error = NULL;
+
+	g_file_make_directory_finish (G_FILE (source_object), result, &error);
+	copy_job_make_ready (job, error);
+}
+
+
+static void
+make_symbolic_link_thread (GSimpleAsyncResult *result,
+			   GObject            *object,
+			   GCancellable       *cancellable)
+{
+	CopyJob *job = g_simple_async_result_get_op_res_gpointer (result);
+	GError  *error = NULL;
+
+	if (! g_file_make_symbolic_link (job->destination, job->symlink_target, cancellable, &error))
+		g_simple_async_result_take_error (result, error);
 }
 
 
 static void
-g_copy_files_progress_cb (goffset  current_num_bytes,
-                          goffset  total_num_bytes,
-                          gpointer user_data)
+copy_job_make_symbolic_link_ready_cb (GObject      *source_object,
+				      GAsyncResult *result,
+				      gpointer      user_data)
 {
-	CopyFilesData *cfd = user_data;
+	CopyJob *job = user_data;
+	GError  *error = NULL;
 
-	if (cfd->progress_callback)
-		cfd->progress_callback (cfd->n_file,
-					cfd->tot_files,
-					(GFile*) cfd->source->data,
-					(GFile*) cfd->destination->data,
-					current_num_bytes,
-					total_num_bytes,
-					cfd->progress_callback_data);
+	g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (result), &error);
+	copy_job_make_ready (job, error);
 }
 
 
 static void
-g_copy_current_file (CopyFilesData *cfd)
+copy_job_start (CopyJob *job)
 {
-	if ((cfd->source == NULL) || (cfd->destination == NULL)) {
-		if (cfd->callback)
-			cfd->callback (NULL, cfd->user_data);
-		copy_files_data_free (cfd);
+	CopyQueue          *queue = job->queue;
+	GSimpleAsyncResult *result;
+
+	switch (job->type) {
+	case COPY_JOB_FILE:
+		g_file_copy_async (job->source,
+				   job->destination,
+				   queue->flags,
+				   queue->io_priority,
+				   queue->cancellable,
+				   copy_job_progress_cb,
+				   job,
+				   copy_job_ready_cb,
+				   job);
+		break;
+
+	case COPY_JOB_DIRECTORY:
+		g_file_make_directory_async (job->destination,
+					     queue->io_priority,
+					     queue->cancellable,
+					     copy_job_make_directory_ready_cb,
+					     job);
+		break;
+
+	case COPY_JOB_SYMBOLIC_LINK:
+		/* g_file_make_symbolic_link_async requires GLib 2.74 */
+		result = g_simple_async_result_new (G_OBJECT (job->destination),
+						    copy_job_make_symbolic_link_ready_cb,
+						    job,
+						    copy_job_start);
+		g_simple_async_result_set_op_res_gpointer (result, job, NULL);
+		g_simple_async_result_run_in_thread (result,
+						     make_symbolic_link_thread,
+						     queue->io_priority,
+						     queue->cancellable);
+		g_object_unref (result);
+		break;
+	}
+}
+
+
+static gboolean
+copy_queue_can_start_job (CopyQueue *queue,
+			  CopyJob   *job)
+{
+	GList *scan;
+
+	if (g_list_length (queue->running) >= COPY_QUEUE_MAX_JOBS)
+		return FALSE;
+
+	if ((job->host != NULL)
+	    && (GPOINTER_TO_UINT (g_hash_table_lookup (queue->host_jobs, job->host)) >= COPY_QUEUE_MAX_JOBS_PER_HOST))
+	{
+		return FALSE;
+	}
+
+	/* wait for the parent directory to be copied */
+
+	for (scan = queue->running; scan; scan = scan->next) {
+		CopyJob *running_job = scan->data;
+
+		if (g_file_has_prefix (job->destination, running_job->destination))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void
+copy_queue_start_jobs (CopyQueue *queue)
+{
+	/* stop at the first error, after the running copies are completed */
+
+	if (queue->error != NULL) {
+		if (queue->running == NULL)
+			g_idle_add (copy_queue_done_cb, queue);
 		return;
 	}
 
-	g_file_copy_async ((GFile*) cfd->source->data,
-			   (GFile*) cfd->destination->data,
-			   cfd->flags,
-			   cfd->io_priority,
-			   cfd->cancellable,
-			   g_copy_files_progress_cb,
-			   cfd,
-			   g_copy_files_ready_cb,
-			   cfd);
+	/* the files are copied in order, so a job waits for all the previous
+	 * jobs to be started */
+
+	while (! g_queue_is_empty (queue->pending)) {
+		CopyJob *job = g_queue_peek_head (queue->pending);
+
+		if (! copy_queue_can_start_job (queue, job))
+			break;
+
+		g_queue_pop_head (queue->pending);
+		queue->running = g_list_prepend (queue->running, job);
+		if (job->host != NULL) {
+			guint n_jobs;
+
+			n_jobs = GPOINTER_TO_UINT (g_hash_table_lookup (queue->host_jobs, job->host));
+			g_hash_table_insert (queue->host_jobs, g_strdup (job->host), GUINT_TO_POINTER (n_jobs + 1));
+		}
+
+		copy_job_start (job);
+	}
+
+	if (queue->running == NULL)
+		g_idle_add (copy_queue_done_cb, queue);
 }
 
 
+/* -- g_copy_files_async -- */
+
+
 void
 g_copy_files_async (GList                 *sources,
 		    GList                 *destinations,
@@ -856,18 +1403,24 @@ g_copy_files_async (GList                 *sources,
 		    CopyDoneCallback       callback,
 		    gpointer               user_data)
 {
-	CopyFilesData *cfd;
-
-	cfd = copy_files_data_new (sources,
-				   destinations,
-				   flags,
-				   io_priority,
-				   cancellable,
-				   progress_callback,
-				   progress_callback_data,
-				   callback,
-				   user_data);
-	g_copy_current_file (cfd);
+	CopyQueue *queue;
+	GList     *scan_source;
+	GList     *scan_destination;
+
+	queue = copy_queue_new (flags,
+				io_priority,
+				cancellable,
+				progress_callback,
+				progress_callback_data,
+				callback,
+				user_data);
+	for (scan_source = sources, scan_destination = destinations;
+	     (scan_source != NULL) && (scan_destination != NULL);
+	     scan_source = scan_source->next, scan_destination = scan_destination->next)
+	{
+		copy_queue_add (queue, (GFile *) scan_source->data, (GFile *) scan_destination->data, -1);
+	}
+	copy_queue_start_jobs (queue);
 }
 
 
@@ -919,10 +1472,7 @@ typedef struct {
 	GError                *error;
 
 	GList                 *to_copy;
-	GList                 *current;
-	GFile                 *current_source;
-	GFile                 *current_destination;
-	int                    n_file, tot_files;
+	int                    tot_files;
 	guint                  source_id;
 } DirectoryCopyData;
 
@@ -937,14 +1487,6 @@ directory_copy_data_free (DirectoryCopyData *dcd)
 		g_object_unref (dcd->source);
 	if (dcd->destination != NULL)
 		g_object_unref (dcd->destination);
-	if (dcd->current_source != NULL) {
-		g_object_unref (dcd->current_source);
-		dcd->current_source = NULL;
-	}
-	if (dcd->current_destination != NULL) {
-		g_object_unref (dcd->current_destination);
-		dcd->current_destination = NULL;
-	}
 	g_list_free_full (dcd->to_copy, (GDestroyNotify) file_info_free);
 	g_free (dcd);
 }
@@ -986,157 +1528,57 @@ get_destination_for_uri (DirectoryCopyData *dcd,
 }
 
 
-static void g_directory_copy_current_child (DirectoryCopyData *dcd);
-
-
 static gboolean
-g_directory_copy_next_child (gpointer user_data)
+g_directory_copy_start_copying (gpointer user_data)
 {
 	DirectoryCopyData *dcd = user_data;
+	CopyQueue         *queue;
+	GList             *scan;
 
 	g_source_remove (dcd->source_id);
 
-	dcd->current = g_list_next (dcd->current);
-	dcd->n_file++;
-	g_directory_copy_current_child (dcd);
-
-	return FALSE;
-}
-
-
-static void
-g_directory_copy_child_done_cb (GObject      *source_object,
-                        	GAsyncResult *result,
- 	                        gpointer      user_data)
-{
-	DirectoryCopyData *dcd = user_data;
-
-	if (! g_file_copy_finish ((GFile*)source_object, result, &(dcd->error))) {
-		dcd->source_id = g_idle_add (g_directory_copy_done, dcd);
-		return;
-	}
-
-	dcd->source_id = g_idle_add (g_directory_copy_next_child, dcd);
-}
-
-
-static void
-g_directory_copy_child_progress_cb (goffset  current_num_bytes,
-                                    goffset  total_num_bytes,
-                                    gpointer user_data)
-{
-	DirectoryCopyData *dcd = user_data;
-
-	if (dcd->progress_callback)
-		dcd->progress_callback (dcd->n_file,
-					dcd->tot_files,
-					dcd->current_source,
-					dcd->current_destination,
-					current_num_bytes,
-					total_num_bytes,
-					dcd->progress_callback_data);
-}
+	/* the directories come before their content in the list, so they
+	 * are created before the files and the links they contain */
 
+	queue = copy_queue_new (dcd->flags,
+				dcd->io_priority,
+				dcd->cancellable,
+				dcd->progress_callback,
+				dcd->progress_callback_data,
+				dcd->callback,
+				dcd->user_data);
 
-static void
-g_directory_copy_current_child (DirectoryCopyData *dcd)
-{
-	FileInfo *child;
-	gboolean   async_op = FALSE;
-
-	if (dcd->current == NULL) {
-		dcd->source_id = g_idle_add (g_directory_copy_done, dcd);
-		return;
-	}
-
-	if (dcd->current_source != NULL) {
-		g_object_unref (dcd->current_source);
-		dcd->current_source = NULL;
-	}
-	if (dcd->current_destination != NULL) {
-		g_object_unref (dcd->current_destination);
-		dcd->current_destination = NULL;
-	}
-
-	child = dcd->current->data;
-	dcd->current_source = g_object_ref (child->file);
-	dcd->current_destination = get_destination_for_uri (dcd, child->file);
-	if (dcd->current_destination == NULL) {
-		dcd->source_id = g_idle_add (g_directory_copy_next_child, dcd);
-		return;
-	}
-
-	switch (g_file_info_get_file_type (child->info)) {
-	case G_FILE_TYPE_DIRECTORY:
-		/* FIXME: how to make a directory asynchronously ? */
+	dcd->to_copy = g_list_reverse (dcd->to_copy);
+	for (scan = dcd->to_copy; scan; scan = scan->next) {
+		FileInfo *child = scan->data;
+		GFile    *destination;
 
-		/* doesn't check the returned error for now, because when an
-		 * error occurs the code is not returned (for example when
-		 * a directory already exists the G_IO_ERROR_EXISTS code is
-		 * *not* returned), so we cannot discriminate between warnings
-		 * and fatal errors. (see bug #525155) */
+		destination = get_destination_for_uri (dcd, child->file);
+		if (destination == NULL)
+			continue;
 
-		g_file_make_directory (dcd->current_destination,
-				       NULL,
-				       NULL);
+		switch (g_file_info_get_file_type (child->info)) {
+		case G_FILE_TYPE_DIRECTORY:
+			copy_queue_add_directory (queue, child->file, destination);
+			break;
+		case G_FILE_TYPE_SYMBOLIC_LINK:
+			copy_queue_add_symbolic_link (queue,
+						      child->file,
+						      destination,
+						      g_file_info_get_symlink_target (child->info));
+			break;
+		case G_FILE_TYPE_REGULAR:
+			copy_queue_add (queue, child->file, destination, g_file_info_get_size (child->info));
+			break;
+		default:
+			break;
+		}
 
-		/*if (! g_file_make_directory (dcd->current_destination,
-					     dcd->cancellable,
-					     &(dcd->error)))
-		{
-			dcd->source_id = g_idle_add (g_directory_copy_done, dcd);
-			return;
-		}*/
-		break;
-	case G_FILE_TYPE_SYMBOLIC_LINK:
-		/* FIXME: how to make a link asynchronously ? */
-
-		g_file_make_symbolic_link (dcd->current_destination,
-					   g_file_info_get_symlink_target (child->info),
-					   NULL,
-					   NULL);
-
-		/*if (! g_file_make_symbolic_link (dcd->current_destination,
-						 g_file_info_get_symlink_target (child->info),
-						 dcd->cancellable,
-						 &(dcd->error)))
-		{
-			dcd->source_id = g_idle_add (g_directory_copy_done, dcd);
-			return;
-		}*/
-		break;
-	case G_FILE_TYPE_REGULAR:
-		g_file_copy_async (dcd->current_source,
-				   dcd->current_destination,
-				   dcd->flags,
-				   dcd->io_priority,
-				   dcd->cancellable,
-				   g_directory_copy_child_progress_cb,
-				   dcd,
-				   g_directory_copy_child_done_cb,
-				   dcd);
-		async_op = TRUE;
-		break;
-	default:
-		break;
+		g_object_unref (destination);
 	}
 
-	if (! async_op)
-		dcd->source_id = g_idle_add (g_directory_copy_next_child, dcd);
-}
-
-
-static gboolean
-g_directory_copy_start_copying (gpointer user_data)
-{
-	DirectoryCopyData *dcd = user_data;
-
-	g_source_remove (dcd->source_id);
-
-	dcd->to_copy = g_list_reverse (dcd->to_copy);
-	dcd->current = dcd->to_copy;
-	dcd->n_file = 1;
-	g_directory_copy_current_child (dcd);
+	copy_queue_start_jobs (queue);
+	directory_copy_data_free (dcd);
 
 	return FALSE;
 }
@@ -1213,7 +1655,7 @@ g_directory_copy_async (GFile                 *source,
 	g_directory_foreach_child (dcd->source,
 			           TRUE,
 			           TRUE,
-			           NULL,
+			           "standard::size,standard::symlink-target",
 			           dcd->cancellable,
 			           g_directory_copy_start_dir,
 			           g_directory_copy_for_each_file,
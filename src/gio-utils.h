@@ -95,6 +95,9 @@ typedef void (*CopyProgressCallback) (goffset                current_file,
                                       gpointer               user_data);
 typedef void (*CopyDoneCallback)     (GError                *error,
 				      gpointer               user_data);
+typedef gboolean (*ForEachInfoCallback) (GFile              *file,
+				      GFileInfo             *info,
+				      gpointer               user_data);
 
 /* asynchronous recursive list functions */
 
@@ -116,6 +119,19 @@ void   _g_file_list_query_info_async (GList                 *file_list, /* GFile
                      	     	      InfoReadyCallback      ready_callback,
                      	     	      gpointer               user_data);
 
+/* synchronous recursive list functions */
+
+gboolean _g_file_list_foreach_info   (GList                 *file_list, /* GFile list */
+				      FileListFlags          flags,
+				      const char            *attributes,
+				      GCancellable          *cancellable,
+				      FilterMatchCallback    directory_filter_func,
+				      FilterMatchCallback    file_filter_func,
+				      gpointer               filter_data,
+				      ForEachInfoCallback    for_each_file_func,
+				      gpointer               user_data,
+				      GError               **error);
+
 /* asynchronous copy functions */
 
 void   g_copy_files_async            (GList                 *sources,
@@ -1503,17 +1503,22 @@ _g_line_get_prev_field (const char *line,
 
 /* threading */
 
-gchar *
-fr_get_thread_count (void)
+guint
+fr_get_n_threads (void)
 {
-	gchar *cpus;
 	if (g_get_num_processors() >= 8)
-		cpus = g_strdup_printf("%u", g_get_num_processors() - 2);
+		return g_get_num_processors() - 2;
 	else if (g_get_num_processors() >= 4)
-		cpus = g_strdup_printf("%u", g_get_num_processors() - 1);
+		return g_get_num_processors() - 1;
 	else
-		cpus = g_strdup_printf("%u", g_get_num_processors());
-	return cpus;
+		return g_get_num_processors();
+}
+
+
+gchar *
+fr_get_thread_count (void)
+{
+	return g_strdup_printf("%u", fr_get_n_threads ());
 }
 
 /* debug */
@@ -192,6 +192,7 @@ char*               _g_line_get_prev_field         (const char          *line,
 
 /* threading */
 
+guint               fr_get_n_threads               (void);
 gchar * 	   fr_get_thread_count 		   (void);
 
 /* debug */
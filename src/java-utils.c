@@ -20,9 +20,6 @@
  */
 
 #include <config.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <errno.h>
 #include <string.h>
 #include <glib.h>
 #include "java-utils.h"
@@ -35,6 +32,8 @@
  */
 
 
+#define CLASS_FILE_MAGIC		0xCAFEBABE
+
 /* Tags that identify structures */
 
 #define CONST_CLASS				 7
@@ -48,6 +47,12 @@
 #define CONST_DOUBLE				 6
 #define CONST_NAMEANDTYPE			12
 #define CONST_UTF8				 1
+#define CONST_METHODHANDLE			15
+#define CONST_METHODTYPE			16
+#define CONST_DYNAMIC				17
+#define CONST_INVOKEDYNAMIC			18
+#define CONST_MODULE				19
+#define CONST_PACKAGE				20
 
 /* Sizes of structures */
 
@@ -61,260 +66,190 @@
 #define CONST_LONG_INFO				 8
 #define CONST_DOUBLE_INFO			 8
 #define CONST_NAMEANDTYPE_INFO			 4
+#define CONST_METHODHANDLE_INFO			 3
+#define CONST_METHODTYPE_INFO			 2
+#define CONST_DYNAMIC_INFO			 4
+#define CONST_INVOKEDYNAMIC_INFO		 4
+#define CONST_MODULE_INFO			 2
+#define CONST_PACKAGE_INFO			 2
 
 
-/* represents the utf8 strings in class file */
-struct utf_string
-{
-	guint16  index;
-	guint16  length;
-	char    *str;
-};
-
-/* structure that holds class information in a class file */
-struct class_info
+static guint16
+read_u16 (const guchar *p)
 {
-	guint16 index;
-	guint16 name_index; /* index into the utf_strings */
-};
-
-typedef struct {
-	int     fd;
-
-	guint32 magic_no;		/* 0xCAFEBABE (JVM Specification) :) */
-
-	guint16 major;			/* versions */
-	guint16 minor;
-
-	guint16 const_pool_count;
-	GSList *const_pool_class;	/* (const_pool_count - 1) elements of tye 'CONST_class_info' */
-	GSList *const_pool_utf;		/* (const_pool_count - 1) elements of type 'utf_strings' */
-
-	guint16 access_flags;
-	guint16 this_class;		/* the index of the class the file is named after. */
-
-#if 0 /* not needed */
-	guint16         super_class;
-	guint16         interfaces_count;
-	guint16        *interfaces;
-	guint16         fields_count;
-	field_info     *fields;
-	guint16         methods_count;
-	method_info    *methods;
-	guint16         attributes_count;
-	attribute_info *attributes;
-#endif
-} JavaClassFile;
-
-
-static JavaClassFile*
-java_class_file_new (void)
-{
-	JavaClassFile *cfile;
-
-	cfile = g_new0 (JavaClassFile, 1);
-	cfile->fd = -1;
-
-	return cfile;
+	return (p[0] << 8) | p[1];
 }
 
 
-static void
-java_class_file_free (JavaClassFile *cfile)
+static guint32
+read_u32 (const guchar *p)
 {
-	GSList *scan;
-
-	if (cfile->const_pool_class != NULL) {
-		g_slist_free_full (cfile->const_pool_class, g_free);
-	}
-
-	for (scan = cfile->const_pool_utf; scan ; scan = scan->next) {
-		struct utf_string *string = scan->data;
-		g_free (string->str);
-	}
-
-	if (cfile->const_pool_utf != NULL) {
-		g_slist_free_full (cfile->const_pool_utf, g_free);
-	}
-
-	if (cfile->fd != -1)
-		close (cfile->fd);
-
-	g_free (cfile);
+	return ((guint32) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
 }
 
 
-/* The following function loads the utf8 strings and class structures from the
- * class file. */
-static void
-load_constant_pool_utfs (JavaClassFile *cfile)
+/* Returns the size of the constant pool entry starting at 'p', or 0 if the
+ * entry is not valid. */
+static gsize
+get_constant_size (const guchar *p,
+		   const guchar *end)
 {
-	guint8  tag;
-	guint16 i = 0;		/* should be comparable with const_pool_count */
-
-	while ((i < cfile->const_pool_count - 1) && (read (cfile->fd, &tag, 1) != -1)) {
-		struct utf_string *txt = NULL;
-		struct class_info *class = NULL;
-
-		switch (tag) {
-		case CONST_CLASS:
-			class = g_new0 (struct class_info, 1);
-			class->index = i + 1;
-			if (read (cfile->fd, &class->name_index, 2) != 2) {
-				g_free (class);
-				return;	/* error reading */
-			}
-			class->name_index = GUINT16_FROM_BE (class->name_index);
-			cfile->const_pool_class = g_slist_append (cfile->const_pool_class, class);
-			break;
-
-		case CONST_FIELDREF:
-			lseek (cfile->fd, CONST_FIELDREF_INFO, SEEK_CUR);
-			break;
-
-		case CONST_METHODREF:
-			lseek (cfile->fd, CONST_METHODREF_INFO, SEEK_CUR);
-			break;
-
-		case CONST_INTERFACEMETHODREF:
-			lseek (cfile->fd, CONST_INTERFACEMETHODREF_INFO, SEEK_CUR);
-			break;
-
-		case CONST_STRING:
-			lseek (cfile->fd, CONST_STRING_INFO, SEEK_CUR);
-			break;
-
-		case CONST_INTEGER:
-			lseek (cfile->fd, CONST_INTEGER_INFO, SEEK_CUR);
-			break;
-
-		case CONST_FLOAT:
-			lseek (cfile->fd, CONST_FLOAT_INFO, SEEK_CUR);
-			break;
-
-		case CONST_LONG:
-			lseek (cfile->fd, CONST_LONG_INFO, SEEK_CUR);
-			break;
-
-		case CONST_DOUBLE:
-			lseek (cfile->fd, CONST_DOUBLE_INFO, SEEK_CUR);
-			break;
-
-		case CONST_NAMEANDTYPE:
-			lseek (cfile->fd, CONST_NAMEANDTYPE_INFO, SEEK_CUR);
-			break;
-
-		case CONST_UTF8:
-			txt = g_new0 (struct utf_string, 1);
-			txt->index = i + 1;
-			if (read (cfile->fd, &(txt->length), 2) == -1) {
-				g_free (txt);
-				return;	/* error while reading */
-			}
-			txt->length = GUINT16_FROM_BE (txt->length);
-			txt->str = g_new0 (char, txt->length);
-			if (read (cfile->fd, txt->str, txt->length) == -1) {
-				g_free (txt);
-				return;	/* error while reading */
-			}
-			cfile->const_pool_utf = g_slist_append (cfile->const_pool_utf, txt);
-			break;
-
-		default:
-			return;	/* error - unknown tag in class file */
-			break;
-		}
-		i++;
+	gsize size;
+
+	switch (*p) {
+	case CONST_CLASS:
+		size = CONST_CLASS_INFO;
+		break;
+	case CONST_FIELDREF:
+		size = CONST_FIELDREF_INFO;
+		break;
+	case CONST_METHODREF:
+		size = CONST_METHODREF_INFO;
+		break;
+	case CONST_INTERFACEMETHODREF:
+		size = CONST_INTERFACEMETHODREF_INFO;
+		break;
+	case CONST_STRING:
+		size = CONST_STRING_INFO;
+		break;
+	case CONST_INTEGER:
+		size = CONST_INTEGER_INFO;
+		break;
+	case CONST_FLOAT:
+		size = CONST_FLOAT_INFO;
+		break;
+	case CONST_LONG:
+		size = CONST_LONG_INFO;
+		break;
+	case CONST_DOUBLE:
+		size = CONST_DOUBLE_INFO;
+		break;
+	case CONST_NAMEANDTYPE:
+		size = CONST_NAMEANDTYPE_INFO;
+		break;
+	case CONST_METHODHANDLE:
+		size = CONST_METHODHANDLE_INFO;
+		break;
+	case CONST_METHODTYPE:
+		size = CONST_METHODTYPE_INFO;
+		break;
+	case CONST_DYNAMIC:
+		size = CONST_DYNAMIC_INFO;
+		break;
+	case CONST_INVOKEDYNAMIC:
+		size = CONST_INVOKEDYNAMIC_INFO;
+		break;
+	case CONST_MODULE:
+		size = CONST_MODULE_INFO;
+		break;
+	case CONST_PACKAGE:
+		size = CONST_PACKAGE_INFO;
+		break;
+	case CONST_UTF8:
+		if (end - p < 3)
+			return 0;
+		size = 2 + read_u16 (p + 1);
+		break;
+	default:
+		return 0; /* error - unknown tag in class file */
 	}
 
-#ifdef DEBUG
-	g_print( "Number of Entries: %d\n", i );
-#endif
-}
+	size += 1; /* the tag */
+	if ((gsize) (end - p) < size)
+		return 0;
 
-
-static char*
-close_and_exit (JavaClassFile *cfile)
-{
-	java_class_file_free (cfile);
-	return NULL;
+	return size;
 }
 
 
-/* This function extracts the package name from a class file */
+/* This function extracts the package name from a class file.  The constant
+ * pool is scanned only to find the position of its entries, the name of the
+ * class is read once 'this_class' is known. */
 char*
 get_package_name_from_class_file (char *fname)
 {
-	char          *package = NULL;
-	JavaClassFile *cfile;
-	guint16        length = 0, end = 0, utf_index = 0;
-	guint32        magic;
-	guint16        major, minor, count;
-
-	if (! g_file_test (fname, G_FILE_TEST_EXISTS))
+	GMappedFile  *mapped;
+	const guchar *data;
+	const guchar *end;
+	const guchar *p;
+	gsize         length;
+	guint16       count;
+	guint32      *offsets = NULL;	/* position of the constant pool entries */
+	guint16       this_class;
+	guint16       name_index;
+	const guchar *name;
+	const guchar *name_end;
+	const guchar *slash;
+	char         *package = NULL;
+
+	mapped = g_mapped_file_new (fname, FALSE, NULL);
+	if (mapped == NULL)
 		return NULL;
 
-	cfile = java_class_file_new ();
-	cfile->fd = open (fname, O_RDONLY);
-	if (cfile->fd == -1)
-		return close_and_exit (cfile);
+	data = (const guchar *) g_mapped_file_get_contents (mapped);
+	length = g_mapped_file_get_length (mapped);
+	end = data + length;
+
+	/* magic, minor and major version, constant pool count */
 
-	if (read (cfile->fd, &magic, 4) != 4)
-		return close_and_exit (cfile);
-	cfile->magic_no = GUINT32_FROM_BE (magic);
+	if ((length < 10) || (read_u32 (data) != CLASS_FILE_MAGIC))
+		goto out;
 
-	if (read (cfile->fd, &major, 2 ) != 2)
-		return close_and_exit (cfile);
-	cfile->major = GUINT16_FROM_BE (major);
+	count = read_u16 (data + 8);
+	offsets = g_new0 (guint32, MAX (count, 1));
 
-	if (read (cfile->fd, &minor, 2) != 2)
-		return close_and_exit (cfile);
-	cfile->minor = GUINT16_FROM_BE (minor);
+	p = data + 10;
+	for (guint i = 1; i < count; i++) {
+		gsize size;
 
-	if (read (cfile->fd, &count, 2) != 2)
-		return close_and_exit (cfile);
-	cfile->const_pool_count = GUINT16_FROM_BE(count);
-	load_constant_pool_utfs (cfile);
+		if (p >= end)
+			goto out;
 
-	if (read (cfile->fd, &cfile->access_flags, 2) != 2)
-		return close_and_exit (cfile);
-	cfile->access_flags = GUINT16_FROM_BE (cfile->access_flags);
+		size = get_constant_size (p, end);
+		if (size == 0)
+			goto out;
 
-	if (read (cfile->fd, &cfile->this_class, 2) != 2)
-		return close_and_exit (cfile);
-	cfile->this_class = GUINT16_FROM_BE(cfile->this_class);
+		offsets[i] = p - data;
 
-	/* now search for the class structure with index = cfile->this_class */
+		/* longs and doubles take two entries */
+		if ((*p == CONST_LONG) || (*p == CONST_DOUBLE))
+			i++;
 
-	for (guint i = 0; (i < g_slist_length (cfile->const_pool_class)) && (utf_index == 0); i++ ) {
-		struct class_info *class = g_slist_nth_data (cfile->const_pool_class, i);
-		if (class->index == cfile->this_class)
-			utf_index = class->name_index; /* terminates loop */
+		p += size;
 	}
 
-	/* now search for the utf8 string with index = utf_index */
+	/* access flags and this_class */
 
-	for (guint i = 0; i < g_slist_length (cfile->const_pool_utf); i++) {
-		struct utf_string *data = g_slist_nth_data (cfile->const_pool_utf, i);
-		if (data->index == utf_index) {
-			package = g_strndup (data->str, data->length);
-			length = data->length;
-			break;
-		}
-	}
+	if (end - p < 4)
+		goto out;
+	this_class = read_u16 (p + 2);
 
-	if (package != NULL) {
-		char *tmp;
+	if ((this_class == 0) || (this_class >= count) || (offsets[this_class] == 0))
+		goto out;
+	p = data + offsets[this_class];
+	if (*p != CONST_CLASS)
+		goto out;
 
-		for (int i = length; (i >= 0) && (end == 0); i--)
-			if (package[i] == '/')
-				end = i;
-		tmp = g_strndup (package, end);
-		g_free (package);
-		package = tmp;
-	}
+	name_index = read_u16 (p + 1);
+	if ((name_index == 0) || (name_index >= count) || (offsets[name_index] == 0))
+		goto out;
+	p = data + offsets[name_index];
+	if (*p != CONST_UTF8)
+		goto out;
 
-	java_class_file_free (cfile);
+	/* the package is the class name without the last component */
+
+	name = p + 3;
+	name_end = name + read_u16 (p + 1);
+	slash = NULL;
+	for (p = name; p < name_end; p++)
+		if (*p == '/')
+			slash = p;
+	package = g_strndup ((const char *) name, (slash != NULL) ? slash - name : 0);
+
+out:
+	g_free (offsets);
+	g_mapped_file_unref (mapped);
 
 	return package;
 }
@@ -322,26 +257,28 @@ get_package_name_from_class_file (char *fname)
 
 /* This function consumes a comment from the java file
  * multiline = TRUE implies that comment is multiline */
-static void
-consume_comment (int      fdesc,
-		 gboolean multiline)
+static const char *
+consume_comment (const char *p,
+		 const char *end,
+		 gboolean    multiline)
 {
 	gboolean escaped = FALSE;
 	gboolean star = FALSE;
-	char     ch;
 
-	while (read (fdesc, &ch, 1) == 1) {
+	while (p < end) {
+		char ch = *p++;
+
 		switch (ch) {
 		case '/':
 			if (escaped)
 				break;
 			else if (star)
-				return;
+				return p;
 			break;
 
 		case '\n':
 			if (! multiline)
-				return;
+				return p;
 			break;
 
 		case '*':
@@ -359,6 +296,8 @@ consume_comment (int      fdesc,
 			break;
 		}
 	}
+
+	return p;
 }
 
 
@@ -366,25 +305,28 @@ consume_comment (int      fdesc,
 char*
 get_package_name_from_java_file (char *fname)
 {
-	char          *package = NULL;
-	JavaClassFile *cfile;
-	gboolean       prev_char_is_bslash = FALSE;
-	gboolean       valid_char_found = FALSE;
-	char           ch;
-
-	if (! g_file_test (fname, G_FILE_TEST_EXISTS))
+	GMappedFile *mapped;
+	const char  *p;
+	const char  *end;
+	char        *package = NULL;
+	gboolean     prev_char_is_bslash = FALSE;
+	gboolean     valid_char_found = FALSE;
+	char         ch = 0;
+
+	mapped = g_mapped_file_new (fname, FALSE, NULL);
+	if (mapped == NULL)
 		return NULL;
 
-	cfile = java_class_file_new ();
-	cfile->fd = open (fname, O_RDONLY);
-	if (cfile->fd == -1)
-		return close_and_exit (cfile);
+	p = g_mapped_file_get_contents (mapped);
+	end = p + g_mapped_file_get_length (mapped);
+
+	while (! valid_char_found && (p < end)) {
+		ch = *p++;
 
-	while (! valid_char_found && (read (cfile->fd, &ch, 1) == 1)) {
 		switch (ch) {
 		case '/':
 			if (prev_char_is_bslash == TRUE) {
-				consume_comment (cfile->fd, FALSE);
+				p = consume_comment (p, end, FALSE);
 				prev_char_is_bslash = FALSE;
 			}
 			else
@@ -393,7 +335,7 @@ get_package_name_from_java_file (char *fname)
 
 		case '*':
 			if (prev_char_is_bslash == TRUE)
-				consume_comment (cfile->fd, TRUE);
+				p = consume_comment (p, end, TRUE);
 			prev_char_is_bslash = FALSE;
 			break;
 
@@ -411,32 +353,20 @@ get_package_name_from_java_file (char *fname)
 		}
 	}
 
-	if (ch == 'p')	{
-		char first_valid_word[8] = "";
-
-		first_valid_word[0] = 'p';
-		if (read (cfile->fd, &first_valid_word[1], 6) != 6)
-			return close_and_exit (cfile);
-
-		first_valid_word[7] = 0;
-		if (g_ascii_strcasecmp (first_valid_word, "package") == 0) {
-			char buffer[500];
-			int  index = 0;
-
-			while (read (cfile->fd, &ch, 1) == 1) {
-				if (ch == ';')
-					break;
-				if (ch == '.')
-					buffer[index++] = '/';
-				else
-					buffer[index++] = ch;
-			}
-			buffer[index] = 0;
-			package = g_strdup (buffer);
-		}
+	if (valid_char_found
+	    && (ch == 'p')
+	    && (end - p >= 6)
+	    && (g_ascii_strncasecmp (p, "ackage", 6) == 0))
+	{
+		GString *buffer;
+
+		buffer = g_string_new (NULL);
+		for (p += 6; (p < end) && (*p != ';'); p++)
+			g_string_append_c (buffer, (*p == '.') ? '/' : *p);
+		package = g_strstrip (g_string_free (buffer, FALSE));
 	}
 
-	java_class_file_free (cfile);
+	g_mapped_file_unref (mapped);
 
 	return package;
 }
@@ -19,9 +19,26 @@ elif test $JOLIET = true; then
 fi
 
 if test "x$3" = x-x; then
-	file_to_extract=$4
-	outfile=$5
-	isoinfo $iso_extensions -i "$filename" -x "$file_to_extract" > "$outfile"
+	# -x DEST_DIR [-T LIST_FILE | FILE...]
+	# extracts each file to DEST_DIR/FILE, the folders must already exist.
+	dest_dir=$4
+	shift 4
+	if test "x$1" = x-T; then
+		while IFS= read -r file_to_extract; do
+			# the paths in the list may lack the leading slash that
+			# the command line paths always have
+			case $file_to_extract in
+			"") continue ;;
+			/*) ;;
+			*) file_to_extract="/$file_to_extract" ;;
+			esac
+			isoinfo $iso_extensions -i "$filename" -x "$file_to_extract" > "$dest_dir$file_to_extract" || exit 1
+		done < "$2"
+	else
+		for file_to_extract in "$@"; do
+			isoinfo $iso_extensions -i "$filename" -x "$file_to_extract" > "$dest_dir$file_to_extract" || exit 1
+		done
+	fi
 else
 	isoinfo $iso_extensions -i "$filename" -l
 fi
@@ -72,6 +72,7 @@ typedef struct {
 	const char    *mime_type;
 	FrArchiveCaps  current_capabilities;
 	FrArchiveCaps  potential_capabilities;
+	gboolean       probed;
 } FrMimeTypeCap;
 
 typedef struct {